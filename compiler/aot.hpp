@@ -0,0 +1,320 @@
+#ifndef AOT_HPP
+#define AOT_HPP
+
+#include "expr.hpp"
+#include "stmt.hpp"
+
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Ahead-of-time compilation of a whole input (-S). Statements go through the
+// front end as usual, then each one becomes x86-64 code in a GNU assembler
+// file (AT&T syntax, linked against the C library):
+//  - a statement that fails to parse or check is known at compile time and
+//    just prints its error;
+//  - an expression is printed, lowered to bytecode, and each instruction is
+//    translated to straight-line code that branches to the statement's
+//    error handler on overflow or undefined behavior;
+//  - every variable gets a global slot that later statements load from.
+// Results are formatted at run time by a small runtime (rt_int) that
+// matches Expr::FormatInt for the output format chosen at compile time.
+struct Aot {
+private:
+  Context* cxt;
+  std::ostringstream text; // body of main
+  std::ostringstream data; // string literals
+  std::unordered_map<const Decl*, int> slots; // variable slot of each declared variable
+  int strings = 0; // string literals so far
+  int stmts = 0; // statements so far
+  int registers = 0; // size of the shared register file
+
+  std::string Literal(std::string_view); // returns the label of a string literal
+  void Print(std::string_view s) { text << "\tleaq\t" << Literal(s) << "(%rip), %rdi\n\tcall\trt_text\n"; }
+  void PrintValue(const Type*); // prints %edi as its type
+  void Compile(Expr*, const std::string& input);
+  static std::string Operand(const Program&, int);
+
+public:
+  Aot(Context* _cxt) : cxt(_cxt) {}
+  void Statement(Stmt*, std::string_view input);
+  void Error(std::string_view input, const std::string& message);
+  void Write(std::ostream&);
+};
+
+// A statement whose error is already known
+void Aot::Error(std::string_view input, const std::string& message) {
+  text << "\t# " << stmts++ << ": error\n";
+  Print("Input: " + std::string(input) + "\nError: " + message + "\n\n");
+}
+
+// A statement that parsed: prints it, evaluates it, and prints the result
+void Aot::Statement(Stmt* s, std::string_view input) {
+  if(Expr_Stmt* exp = dynamic_cast<Expr_Stmt*>(s)) {
+    text << "\t# " << stmts << ": expression\n";
+    Print("Input: " + exp->e->Print() + "\nResult: ");
+    Compile(exp->e, std::string(input));
+    text << "\tmovl\t%eax, %edi\n";
+    PrintValue(exp->e->Check());
+    Print("\n\n");
+  }
+  else if(Decl_Stmt* dec = dynamic_cast<Decl_Stmt*>(s)) {
+    if(Var_Decl* vd = dynamic_cast<Var_Decl*>(dec->d)) {
+      text << "\t# " << stmts << ": " << vd->name << "\n";
+      Compile(vd->fullInit, std::string(input));
+      int slot = slots.emplace(vd, int(slots.size())).first->second;
+      text << "\tmovl\t%eax, vars+" << 4 * slot << "(%rip)\n";
+      Print("Input: " + std::string(vd->name) + " = " + vd->fullInit->Print() + "\nResult: " + std::string(vd->name) + " = ");
+      text << "\tmovl\tvars+" << 4 * slot << "(%rip), %edi\n";
+      PrintValue(vd->type);
+      Print("\n\n");
+    }
+  }
+  text << ".Lnext" << stmts << ":\n";
+  ++stmts;
+}
+
+// Register file operand: an immediate for constants, else a global
+std::string Aot::Operand(const Program& p, int r) {
+  if(r < 0)
+    return "$" + std::to_string(p.constants[-1 - r]);
+  return "regs+" + std::to_string(4 * r) + "(%rip)";
+}
+
+// Emits code leaving the value of e in %eax. Errors print the statement's
+// input and message, then skip to the next statement.
+void Aot::Compile(Expr* e, const std::string& input) {
+  Program p;
+  Compiler c(p, &slots);
+  c.Emit(Op_Return, 0, e->Lower(c, 0));
+  if(p.registers > registers)
+    registers = p.registers;
+
+  const std::string label = ".L" + std::to_string(stmts) + "_";
+  const std::string overflow = label + "overflow", undefined = label + "undefined";
+  bool overflows = false, undefs = false;
+  std::vector<bool> targets(p.code.size() + 1);
+  for(const Instr& i : p.code)
+    if(i.op == Op_Jump || i.op == Op_Jump_False || i.op == Op_Jump_True)
+      targets[i.b] = true;
+
+  auto A = [&](const Instr& i) { return Operand(p, i.a); };
+  auto B = [&](const Instr& i) { return Operand(p, i.b); };
+  auto Dst = [&](const Instr& i) { return Operand(p, i.dst); };
+
+  for(size_t n = 0; n < p.code.size(); ++n) {
+    const Instr& i = p.code[n];
+    if(targets[n])
+      text << label << n << ":\n";
+
+    switch(i.op) {
+    case Op_Move:
+      text << "\tmovl\t" << A(i) << ", %eax\n\tmovl\t%eax, " << Dst(i) << "\n";
+      break;
+    case Op_Add: case Op_Sub: case Op_Mul:
+      text << "\tmovl\t" << A(i) << ", %eax\n";
+      if(i.op == Op_Mul && i.b < 0)
+	text << "\timull\t" << B(i) << ", %eax, %eax\n";
+      else
+	text << (i.op == Op_Add ? "\taddl\t" : i.op == Op_Sub ? "\tsubl\t" : "\timull\t") << B(i) << ", %eax\n";
+      text << "\tjo\t" << overflow << "\n\tmovl\t%eax, " << Dst(i) << "\n";
+      overflows = true;
+      break;
+    case Op_Div: case Op_Rem: // the checks of Undefined_Division
+      text << "\tmovl\t" << B(i) << ", %ecx\n"
+	   << "\tmovl\t" << A(i) << ", %eax\n"
+	   << "\ttestl\t%ecx, %ecx\n\tje\t" << undefined << "\n"
+	   << "\tcmpl\t$-2147483648, %ecx\n\tje\t" << undefined << "\n"
+	   << "\tcmpl\t$-1, %ecx\n\tjne\t1f\n"
+	   << "\tcmpl\t$-2147483648, %eax\n\tje\t" << undefined << "\n"
+	   << "1:\tcltd\n\tidivl\t%ecx\n"
+	   << "\tmovl\t" << (i.op == Op_Div ? "%eax" : "%edx") << ", " << Dst(i) << "\n";
+      undefs = true;
+      break;
+    case Op_Neg:
+      text << "\tmovl\t" << A(i) << ", %eax\n\tnegl\t%eax\n"
+	   << "\tjo\t" << overflow << "\n\tmovl\t%eax, " << Dst(i) << "\n";
+      overflows = true;
+      break;
+    case Op_Not:
+      text << "\tmovl\t" << A(i) << ", %eax\n\txorl\t%ecx, %ecx\n\ttestl\t%eax, %eax\n"
+	   << "\tsete\t%cl\n\tmovl\t%ecx, " << Dst(i) << "\n";
+      break;
+    case Op_Comp:
+      text << "\tmovl\t" << A(i) << ", %eax\n\tnotl\t%eax\n\tmovl\t%eax, " << Dst(i) << "\n";
+      break;
+    case Op_Bit_And: case Op_Bit_Or: case Op_Bit_Xor:
+      text << "\tmovl\t" << A(i) << ", %eax\n"
+	   << (i.op == Op_Bit_And ? "\tandl\t" : i.op == Op_Bit_Or ? "\torl\t" : "\txorl\t") << B(i) << ", %eax\n"
+	   << "\tmovl\t%eax, " << Dst(i) << "\n";
+      break;
+    case Op_Equal: case Op_Not_Equal: case Op_Less: case Op_Greater: case Op_Less_Equal: case Op_Greater_Equal: {
+      static const char* setcc[] = { "sete", "setne", "setl", "setg", "setle", "setge" };
+      text << "\tmovl\t" << A(i) << ", %eax\n\txorl\t%ecx, %ecx\n\tcmpl\t" << B(i) << ", %eax\n"
+	   << "\t" << setcc[i.op - Op_Equal] << "\t%cl\n\tmovl\t%ecx, " << Dst(i) << "\n";
+      break;
+    }
+    case Op_Jump:
+      text << "\tjmp\t" << label << i.b << "\n";
+      break;
+    case Op_Jump_False: case Op_Jump_True:
+      text << "\tmovl\t" << A(i) << ", %eax\n\ttestl\t%eax, %eax\n"
+	   << (i.op == Op_Jump_False ? "\tje\t" : "\tjne\t") << label << i.b << "\n";
+      break;
+    case Op_Load:
+      text << "\tmovl\tvars+" << 4 * i.a << "(%rip), %eax\n\tmovl\t%eax, " << Dst(i) << "\n";
+      break;
+    case Op_Return:
+      text << "\tmovl\t" << A(i) << ", %eax\n";
+      break;
+    default:
+      break;
+    }
+  }
+
+  // errors skip the rest of the statement
+  if(overflows || undefs) {
+    const std::string done = label + "done";
+    text << "\tjmp\t" << done << "\n";
+    if(overflows) {
+      text << overflow << ":\n";
+      Print("Input: " + input + "\nError: Integer overflow.\n\n");
+      text << "\tjmp\t.Lnext" << stmts << "\n";
+    }
+    if(undefs) {
+      text << undefined << ":\n";
+      Print("Input: " + input + "\nError: Undefined behavior.\n\n");
+      text << "\tjmp\t.Lnext" << stmts << "\n";
+    }
+    text << done << ":\n";
+  }
+}
+
+// Prints the int or bool in %edi
+void Aot::PrintValue(const Type* t) {
+  text << (t == &(cxt->Bool_) ? "\tcall\trt_bool\n" : "\tcall\trt_int\n");
+}
+
+// Adds a string literal, escaped for the assembler
+std::string Aot::Literal(std::string_view s) {
+  std::string label = ".Lstr" + std::to_string(strings++);
+  data << label << ":\n\t.string\t\"";
+  for(unsigned char ch : s) {
+    if(ch == '"' || ch == '\\')
+      data << '\\' << ch;
+    else if(ch == '\n')
+      data << "\\n";
+    else if(ch < ' ' || ch > '~') {
+      char oct[5];
+      snprintf(oct, sizeof(oct), "\\%03o", ch);
+      data << oct;
+    }
+    else
+      data << ch;
+  }
+  data << "\"\n";
+  return label;
+}
+
+// Writes the assembler file: main, the runtime, literals & storage
+void Aot::Write(std::ostream& out) {
+  out << "\t.text\n"
+      << "\t.globl\tmain\n"
+      << "\t.type\tmain, @function\n"
+      << "main:\n"
+      << "\tsubq\t$8, %rsp\n"
+      << text.str()
+      << "\txorl\t%eax, %eax\n"
+      << "\taddq\t$8, %rsp\n"
+      << "\tret\n\n";
+
+  // rt_text(const char*): write a string to stdout
+  out << "rt_text:\n"
+      << "\tsubq\t$8, %rsp\n"
+      << "\tmovq\tstdout@GOTPCREL(%rip), %rax\n"
+      << "\tmovq\t(%rax), %rsi\n"
+      << "\tcall\tfputs@PLT\n"
+      << "\taddq\t$8, %rsp\n"
+      << "\tret\n\n";
+
+  // rt_bool(int): true or false
+  out << "rt_bool:\n"
+      << "\ttestl\t%edi, %edi\n"
+      << "\tleaq\t.Ltrue(%rip), %rax\n"
+      << "\tleaq\t.Lfalse(%rip), %rdi\n"
+      << "\tcmovne\t%rax, %rdi\n"
+      << "\tjmp\trt_text\n\n";
+
+  // rt_int(int): formatted as by Expr::FormatInt
+  out << "rt_int:\n";
+  switch(cxt->outputFormat) {
+  case 'h': // [-]0x<hex of magnitude>
+    out << "\tmovl\t%edi, %esi\n"
+	<< "\tleaq\t.Lhex(%rip), %rdi\n"
+	<< "\ttestl\t%esi, %esi\n"
+	<< "\tjns\t1f\n"
+	<< "\tnegl\t%esi\n"
+	<< "\tleaq\t.Lneghex(%rip), %rdi\n"
+	<< "1:\tsubq\t$8, %rsp\n"
+	<< "\txorl\t%eax, %eax\n"
+	<< "\tcall\tprintf@PLT\n"
+	<< "\taddq\t$8, %rsp\n"
+	<< "\tret\n\n";
+    break;
+  case 'b': // [-]0b<binary of magnitude>, built backwards on the stack
+    out << "\tsubq\t$56, %rsp\n"
+	<< "\tleaq\t48(%rsp), %rsi\n"
+	<< "\tmovb\t$0, (%rsi)\n"
+	<< "\tmovl\t%edi, %eax\n"
+	<< "\ttestl\t%eax, %eax\n"
+	<< "\tjns\t1f\n"
+	<< "\tnegl\t%eax\n"
+	<< "1:\ttestl\t%eax, %eax\n"
+	<< "\tje\t3f\n"
+	<< "2:\tmovl\t%eax, %edx\n"
+	<< "\tandl\t$1, %edx\n"
+	<< "\taddl\t$48, %edx\n"
+	<< "\tdecq\t%rsi\n"
+	<< "\tmovb\t%dl, (%rsi)\n"
+	<< "\tshrl\t$1, %eax\n"
+	<< "\tjne\t2b\n"
+	<< "3:\tsubq\t$2, %rsi\n"
+	<< "\tmovw\t$0x6230, (%rsi)\n" // "0b"
+	<< "\ttestl\t%edi, %edi\n"
+	<< "\tjns\t4f\n"
+	<< "\tdecq\t%rsi\n"
+	<< "\tmovb\t$45, (%rsi)\n" // '-'
+	<< "4:\tmovq\t%rsi, %rdi\n"
+	<< "\tcall\trt_text\n"
+	<< "\taddq\t$56, %rsp\n"
+	<< "\tret\n\n";
+    break;
+  default: // decimal
+    out << "\tmovl\t%edi, %esi\n"
+	<< "\tleaq\t.Ldec(%rip), %rdi\n"
+	<< "\tsubq\t$8, %rsp\n"
+	<< "\txorl\t%eax, %eax\n"
+	<< "\tcall\tprintf@PLT\n"
+	<< "\taddq\t$8, %rsp\n"
+	<< "\tret\n\n";
+    break;
+  }
+
+  out << "\t.section\t.rodata\n"
+      << ".Ltrue:\n\t.string\t\"true\"\n"
+      << ".Lfalse:\n\t.string\t\"false\"\n"
+      << ".Ldec:\n\t.string\t\"%d\"\n"
+      << ".Lhex:\n\t.string\t\"0x%x\"\n"
+      << ".Lneghex:\n\t.string\t\"-0x%x\"\n"
+      << data.str() << "\n";
+
+  out << "\t.bss\n"
+      << "\t.align\t4\n"
+      << "regs:\n\t.zero\t" << 4 * (registers ? registers : 1) << "\n"
+      << "vars:\n\t.zero\t" << 4 * (slots.empty() ? 1 : slots.size()) << "\n"
+      << "\t.section\t.note.GNU-stack,\"\",@progbits\n";
+}
+
+#endif
@@ -0,0 +1,158 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+// Region allocator. Objects are bump-allocated out of large chunks and are
+// all released together by Reset() (or when the arena is destroyed), which
+// also runs the destructors of any non-trivially destructible objects.
+struct Arena {
+private:
+  struct Chunk {
+    Chunk* next; // previously allocated chunk
+    size_t size; // usable bytes following the header
+    char* Data() { return reinterpret_cast<char*>(this + 1); }
+  };
+  struct Finalizer {
+    void (*destroy)(void*);
+    void* obj;
+    Finalizer* next;
+  };
+
+  Chunk* head = nullptr; // chunk currently being filled
+  Chunk* spare = nullptr; // chunks kept by Reset() for reuse
+  char* first = nullptr, * last = nullptr; // free space in head
+  Finalizer* finalizers = nullptr; // destructors to run on Reset(), newest first
+  size_t chunkSize; // size of the next chunk to allocate
+  size_t used = 0; // bytes handed out since the last Reset()
+  size_t peak = 0; // high-water mark of used
+  size_t reserved = 0; // bytes currently held in chunks
+
+  static std::atomic<size_t>& TotalReserved() { static std::atomic<size_t> n(0); return n; } // all arenas, on any thread
+  static std::atomic<size_t>& TotalPeak() { static std::atomic<size_t> n(0); return n; }
+
+  void Grow(size_t, size_t);
+  void FreeChunks(Chunk*);
+
+public:
+  Arena(size_t _chunkSize = 64 * 1024) : chunkSize(_chunkSize) {}
+  ~Arena() { Reset(); FreeChunks(spare); }
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  void* Allocate(size_t, size_t);
+  void Reset(); // destroy everything allocated so far
+  void Swap(Arena&);
+
+  // Constructs a T in the arena
+  template<typename T, typename... Args>
+  T* Make(Args&&... args) {
+    void* p = Allocate(sizeof(T), alignof(T));
+    T* obj = new (p) T(std::forward<Args>(args)...);
+    if(!std::is_trivially_destructible<T>::value) {
+      Finalizer* f = new (Allocate(sizeof(Finalizer), alignof(Finalizer))) Finalizer;
+      f->destroy = [](void* o) { static_cast<T*>(o)->~T(); };
+      f->obj = obj;
+      f->next = finalizers;
+      finalizers = f;
+    }
+    return obj;
+  }
+
+  // Bytes Make<T> takes, besides alignment
+  template<typename T>
+  static constexpr size_t Bytes() { return sizeof(T) + (std::is_trivially_destructible<T>::value ? 0 : sizeof(Finalizer)); }
+
+  size_t Used() const { return used; }
+  size_t Peak() const { return peak; }
+  size_t Reserved() const { return reserved; }
+  static size_t AllReserved() { return TotalReserved(); } // held by all arenas
+  static size_t AllPeak() { return TotalPeak(); } // high-water mark of AllReserved
+};
+
+// Returns n bytes aligned to align, starting a new chunk when needed
+void* Arena::Allocate(size_t n, size_t align) {
+  char* p = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(first) + align - 1) & ~(uintptr_t)(align - 1));
+  if(!first || p + n > last) {
+    Grow(n, align);
+    p = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(first) + align - 1) & ~(uintptr_t)(align - 1));
+  }
+  first = p + n;
+  used += n;
+  if(used > peak)
+    peak = used;
+  return p;
+}
+
+// Starts a chunk with room for n bytes, reusing a spare one if possible
+void Arena::Grow(size_t n, size_t align) {
+  Chunk* c = nullptr;
+  if(spare && spare->size >= n + align) {
+    c = spare;
+    spare = spare->next;
+  }
+  else {
+    size_t size = chunkSize < n + align ? n + align : chunkSize;
+    c = static_cast<Chunk*>(std::malloc(sizeof(Chunk) + size));
+    if(!c)
+      throw std::bad_alloc();
+    c->size = size;
+    reserved += sizeof(Chunk) + size;
+    size_t total = TotalReserved() += sizeof(Chunk) + size;
+    for(size_t peak = TotalPeak(); total > peak && !TotalPeak().compare_exchange_weak(peak, total); )
+      ;
+    if(chunkSize < 1024 * 1024)
+      chunkSize *= 2; // fewer, larger chunks for arenas that keep growing
+  }
+  c->next = head;
+  head = c;
+  first = c->Data();
+  last = first + c->size;
+}
+
+void Arena::FreeChunks(Chunk* c) {
+  while(c) {
+    Chunk* next = c->next;
+    reserved -= sizeof(Chunk) + c->size;
+    TotalReserved() -= sizeof(Chunk) + c->size;
+    std::free(c);
+    c = next;
+  }
+}
+
+// Runs pending destructors and keeps the chunks around for the next use
+void Arena::Reset() {
+  for(Finalizer* f = finalizers; f; f = f->next)
+    f->destroy(f->obj);
+  finalizers = nullptr;
+
+  while(head) {
+    Chunk* next = head->next;
+    head->next = spare;
+    spare = head;
+    head = next;
+  }
+  first = last = nullptr;
+  used = 0;
+}
+
+// Exchanges contents with another arena, e.g. to replace an old region
+void Arena::Swap(Arena& other) {
+  std::swap(head, other.head);
+  std::swap(spare, other.spare);
+  std::swap(first, other.first);
+  std::swap(last, other.last);
+  std::swap(finalizers, other.finalizers);
+  std::swap(chunkSize, other.chunkSize);
+  std::swap(used, other.used);
+  std::swap(peak, other.peak);
+  std::swap(reserved, other.reserved);
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef ARITH_HPP
+#define ARITH_HPP
+
+#include <limits>
+
+// Checked integer arithmetic shared by every evaluation engine, so the tree
+// walker and the compiled backends report exactly the same errors.
+
+// Outcome of a checked operation
+enum Eval_Status {
+  Eval_Ok = 0,
+  Eval_Overflow, // "Integer overflow."
+  Eval_Undefined // "Undefined behavior."
+};
+
+inline Eval_Status Checked_Add(int a, int b, int& r) {
+  return __builtin_add_overflow(a, b, &r) ? Eval_Overflow : Eval_Ok;
+}
+
+inline Eval_Status Checked_Sub(int a, int b, int& r) {
+  return __builtin_sub_overflow(a, b, &r) ? Eval_Overflow : Eval_Ok;
+}
+
+inline Eval_Status Checked_Mul(int a, int b, int& r) {
+  return __builtin_mul_overflow(a, b, &r) ? Eval_Overflow : Eval_Ok;
+}
+
+// dividing any number by zero or the min will be undefined
+// dividing the minimum value of int by -1 will overflow
+inline bool Undefined_Division(int a, int b) {
+  return b == 0 || b == std::numeric_limits<int>::min() ||
+    (a == std::numeric_limits<int>::min() && b == -1);
+}
+
+inline Eval_Status Checked_Div(int a, int b, int& r) {
+  if(Undefined_Division(a, b))
+    return Eval_Undefined;
+  r = a / b;
+  return Eval_Ok;
+}
+
+inline Eval_Status Checked_Rem(int a, int b, int& r) {
+  if(Undefined_Division(a, b))
+    return Eval_Undefined;
+  r = a % b;
+  return Eval_Ok;
+}
+
+// attempting to invert the sign of the minimum value of int will overflow
+inline Eval_Status Checked_Neg(int a, int& r) {
+  if(a == std::numeric_limits<int>::min())
+    return Eval_Overflow;
+  r = -a;
+  return Eval_Ok;
+}
+
+#endif
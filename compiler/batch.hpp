@@ -0,0 +1,268 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include "expr.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__)
+#define BATCH_X86 1
+#include <immintrin.h>
+#endif
+
+// Evaluates one expression over many rows of variable bindings. The caller
+// declares the variables as usual (var int x = 0), parses the expression,
+// and binds a column of values to each variable; variables without a column
+// keep the value they had when the expression was parsed. Bools are 0/1.
+//
+// The expression is lowered to bytecode with each bound variable as an
+// Op_Load, and the bytecode is run a block of rows at a time with every
+// register holding a whole column, so each instruction is one AVX2 loop.
+// Each lane has an active mask: &&, || and ?: jump by moving lanes from
+// the active mask to the one waiting at the jump target, so operands are
+// only evaluated (and can only fail) where the tree walker would evaluate
+// them. A lane that overflows records its Eval_Status and drops out.
+struct Column_Batch {
+  static const size_t Block = 512; // rows per block; a block's registers stay in L1
+
+private:
+  Program prog;
+  std::unordered_map<const Decl*, int> slots; // column of each bound variable
+  const Type* type;
+
+  void Run(const int* const* columns, size_t first, size_t n, int* result, uint8_t* status,
+	   int32_t* regs, int32_t* masks) const;
+
+public:
+  Column_Batch(Expr* e, const std::vector<const Decl*>& vars);
+  const Type* ResultType() const { return type; }
+  bool Loads(int column) const; // whether the expression reads that column
+
+  // columns[k] holds the values of vars[k]; status[i] is Eval_Ok or the error of row i
+  void Evaluate(const int* const* columns, size_t rows, int* result, uint8_t* status) const;
+};
+
+Column_Batch::Column_Batch(Expr* e, const std::vector<const Decl*>& vars) : type(e->Check()) {
+  for(size_t k = 0; k < vars.size(); ++k)
+    slots.emplace(vars[k], int(k));
+  Compiler c(prog, &slots);
+  c.Emit(Op_Return, 0, e->Lower(c, 0));
+}
+
+bool Column_Batch::Loads(int column) const {
+  for(const Instr& i : prog.code)
+    if(i.op == Op_Load && i.a == column)
+      return true;
+  return false;
+}
+
+// Column kernels: dst = active ? op(a, b) : dst, for n lanes. Lanes whose
+// operation fails get their status and are cleared from active.
+
+template<typename F>
+void Scalar_Kernel(F op, const int* a, const int* b, int* dst, int32_t* active, uint8_t* status, size_t i, size_t n) {
+  for(; i < n; ++i)
+    if(active[i]) {
+      int r;
+      if(Eval_Status s = op(a[i], b[i], r)) {
+	status[i] = s;
+	active[i] = 0;
+      }
+      else
+	dst[i] = r;
+    }
+}
+
+// Scalar form of every opcode that computes a value
+Eval_Status Scalar_Op(Opcode op, int a, int b, int& r) {
+  switch(op) {
+  case Op_Add: return Checked_Add(a, b, r);
+  case Op_Sub: return Checked_Sub(a, b, r);
+  case Op_Mul: return Checked_Mul(a, b, r);
+  case Op_Div: return Checked_Div(a, b, r);
+  case Op_Rem: return Checked_Rem(a, b, r);
+  case Op_Neg: return Checked_Neg(a, r);
+  case Op_Not: r = !a; break;
+  case Op_Comp: r = ~a; break;
+  case Op_Bit_And: r = a & b; break;
+  case Op_Bit_Or: r = a | b; break;
+  case Op_Bit_Xor: r = a ^ b; break;
+  case Op_Equal: r = a == b; break;
+  case Op_Not_Equal: r = a != b; break;
+  case Op_Less: r = a < b; break;
+  case Op_Greater: r = a > b; break;
+  case Op_Less_Equal: r = a <= b; break;
+  case Op_Greater_Equal: r = a >= b; break;
+  default: r = a; break; // Op_Move, Op_Load
+  }
+  return Eval_Ok;
+}
+
+#ifdef BATCH_X86
+
+// Eight lanes of op; err gets the lanes that overflow. Division has no
+// vector form and is left to the scalar kernel.
+template<Opcode Op>
+__attribute__((target("avx2"))) inline __m256i Avx2_Op(__m256i x, __m256i y, __m256i& err) {
+  const __m256i one = _mm256_set1_epi32(1), zero = _mm256_setzero_si256();
+  __m256i r;
+  switch(Op) {
+  case Op_Add: // overflow when the result's sign differs from both operands'
+    r = _mm256_add_epi32(x, y);
+    err = _mm256_srai_epi32(_mm256_and_si256(_mm256_xor_si256(x, r), _mm256_xor_si256(y, r)), 31);
+    return r;
+  case Op_Sub: // overflow when the operands' signs differ and the result's differs from x's
+    r = _mm256_sub_epi32(x, y);
+    err = _mm256_srai_epi32(_mm256_and_si256(_mm256_xor_si256(x, y), _mm256_xor_si256(x, r)), 31);
+    return r;
+  case Op_Mul: { // overflow when the high half of the 64-bit product is not the low half's sign
+    __m256i even = _mm256_mul_epi32(x, y);
+    __m256i odd = _mm256_mul_epi32(_mm256_srli_epi64(x, 32), _mm256_srli_epi64(y, 32));
+    __m256i high = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+    r = _mm256_mullo_epi32(x, y);
+    err = _mm256_xor_si256(_mm256_cmpeq_epi32(high, _mm256_srai_epi32(r, 31)), _mm256_set1_epi32(-1));
+    return r;
+  }
+  case Op_Neg:
+    err = _mm256_cmpeq_epi32(x, _mm256_set1_epi32(std::numeric_limits<int>::min()));
+    return _mm256_sub_epi32(zero, x);
+  case Op_Not: return _mm256_and_si256(_mm256_cmpeq_epi32(x, zero), one);
+  case Op_Comp: return _mm256_xor_si256(x, _mm256_set1_epi32(-1));
+  case Op_Bit_And: return _mm256_and_si256(x, y);
+  case Op_Bit_Or: return _mm256_or_si256(x, y);
+  case Op_Bit_Xor: return _mm256_xor_si256(x, y);
+  case Op_Equal: return _mm256_and_si256(_mm256_cmpeq_epi32(x, y), one);
+  case Op_Not_Equal: return _mm256_andnot_si256(_mm256_cmpeq_epi32(x, y), one);
+  case Op_Less: return _mm256_and_si256(_mm256_cmpgt_epi32(y, x), one);
+  case Op_Greater: return _mm256_and_si256(_mm256_cmpgt_epi32(x, y), one);
+  case Op_Less_Equal: return _mm256_andnot_si256(_mm256_cmpgt_epi32(x, y), one);
+  case Op_Greater_Equal: return _mm256_andnot_si256(_mm256_cmpgt_epi32(y, x), one);
+  default: return x; // Op_Move, Op_Load
+  }
+}
+
+template<Opcode Op>
+__attribute__((target("avx2")))
+void Avx2_Kernel(const int* a, const int* b, int* dst, int32_t* active, uint8_t* status, size_t n) {
+  size_t i = 0;
+  for(; i + 8 <= n; i += 8) {
+    __m256i m = _mm256_loadu_si256((const __m256i*)(active + i));
+    if(_mm256_testz_si256(m, m))
+      continue; // no live lanes
+    __m256i err = _mm256_setzero_si256();
+    __m256i r = Avx2_Op<Op>(_mm256_loadu_si256((const __m256i*)(a + i)),
+			    _mm256_loadu_si256((const __m256i*)(b + i)), err);
+    err = _mm256_and_si256(err, m);
+    __m256i keep = _mm256_andnot_si256(err, m);
+    __m256i old = _mm256_loadu_si256((const __m256i*)(dst + i));
+    _mm256_storeu_si256((__m256i*)(dst + i), _mm256_blendv_epi8(old, r, keep));
+    _mm256_storeu_si256((__m256i*)(active + i), keep);
+    if(!_mm256_testz_si256(err, err)) { // rare: record which lanes failed
+      int bits = _mm256_movemask_ps(_mm256_castsi256_ps(err));
+      for(int k = 0; k < 8; ++k)
+	if(bits & (1 << k))
+	  status[i + k] = Eval_Overflow;
+    }
+  }
+  Scalar_Kernel([](int x, int y, int& r) { return Scalar_Op(Op, x, y, r); }, a, b, dst, active, status, i, n);
+}
+
+#endif // BATCH_X86
+
+// Runs one computing instruction over n lanes
+void Column_Kernel(Opcode op, const int* a, const int* b, int* dst, int32_t* active, uint8_t* status, size_t n) {
+#ifdef BATCH_X86
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  if(avx2) {
+    switch(op) {
+#define KERNEL(o) case o: return Avx2_Kernel<o>(a, b, dst, active, status, n)
+      KERNEL(Op_Move); KERNEL(Op_Load); KERNEL(Op_Add); KERNEL(Op_Sub); KERNEL(Op_Mul);
+      KERNEL(Op_Neg); KERNEL(Op_Not); KERNEL(Op_Comp);
+      KERNEL(Op_Bit_And); KERNEL(Op_Bit_Or); KERNEL(Op_Bit_Xor);
+      KERNEL(Op_Equal); KERNEL(Op_Not_Equal); KERNEL(Op_Less); KERNEL(Op_Greater);
+      KERNEL(Op_Less_Equal); KERNEL(Op_Greater_Equal);
+#undef KERNEL
+    default:
+      break; // Op_Div, Op_Rem
+    }
+  }
+#endif
+  Scalar_Kernel([op](int x, int y, int& r) { return Scalar_Op(op, x, y, r); }, a, b, dst, active, status, 0, n);
+}
+
+// Runs the program over rows [first, first + n). masks holds the active
+// mask followed by one waiting mask per instruction.
+void Column_Batch::Run(const int* const* columns, size_t first, size_t n, int* result, uint8_t* status,
+		       int32_t* regs, int32_t* masks) const {
+  const size_t nconst = prog.constants.size();
+  int* r = regs + nconst * Block; // r[k] is the column at r + k * Block; constants are below
+  auto Column = [&](int k) { return r + ptrdiff_t(k) * ptrdiff_t(Block); };
+
+  int32_t* active = masks;
+  std::fill(active, active + n, -1);
+  std::fill(masks + Block, masks + Block * (prog.code.size() + 1), 0);
+  std::vector<bool> waiting(prog.code.size() + 1); // some lanes wait at this instruction
+  memset(status, 0, n);
+
+  for(size_t pc = 0; pc < prog.code.size(); ++pc) {
+    const Instr& i = prog.code[pc];
+    int32_t* wait = masks + Block * (pc + 1);
+    if(waiting[pc])
+      for(size_t k = 0; k < n; ++k)
+	active[k] |= wait[k];
+
+    switch(i.op) {
+    case Op_Jump:
+      for(size_t k = 0; k < n; ++k) {
+	masks[Block * (i.b + 1) + k] |= active[k];
+	active[k] = 0;
+      }
+      waiting[i.b] = true;
+      break;
+    case Op_Jump_False: case Op_Jump_True: {
+      const int* cond = Column(i.a);
+      int32_t* target = masks + Block * (i.b + 1);
+      bool jump = i.op == Op_Jump_True;
+      for(size_t k = 0; k < n; ++k) {
+	int32_t moved = active[k] & -int32_t((cond[k] != 0) == jump);
+	target[k] |= moved;
+	active[k] &= ~moved;
+      }
+      waiting[i.b] = true;
+      break;
+    }
+    case Op_Load:
+      Column_Kernel(i.op, columns[i.a] + first, columns[i.a] + first, Column(i.dst), active, status, n);
+      break;
+    case Op_Return: {
+      const int* v = Column(i.a);
+      for(size_t k = 0; k < n; ++k)
+	result[k] = status[k] ? 0 : v[k];
+      break;
+    }
+    default:
+      Column_Kernel(i.op, Column(i.a), Column(i.b), Column(i.dst), active, status, n);
+      break;
+    }
+  }
+}
+
+void Column_Batch::Evaluate(const int* const* columns, size_t rows, int* result, uint8_t* status) const {
+  const size_t nconst = prog.constants.size();
+  std::vector<int32_t> regs((nconst + prog.registers) * Block);
+  std::vector<int32_t> masks((prog.code.size() + 2) * Block);
+
+  // constants are the same column in every block
+  for(size_t k = 0; k < nconst; ++k)
+    std::fill(regs.begin() + (nconst - 1 - k) * Block, regs.begin() + (nconst - k) * Block, prog.constants[k]);
+
+  for(size_t first = 0; first < rows; first += Block) {
+    size_t n = rows - first < Block ? rows - first : Block;
+    Run(columns, first, n, result + first, status + first, regs.data(), masks.data());
+  }
+}
+
+#endif
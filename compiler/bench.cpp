@@ -0,0 +1,758 @@
+#include "parser.hpp"
+#include "predicate.hpp"
+#include "frontend.hpp"
+#include "writer.hpp"
+#include "cache.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/stat.h>
+
+// Micro-benchmarks for the compiler. Build and run with
+//   g++ -std=c++17 -O2 bench.cpp -o bench
+//   ./bench            (all benchmarks)
+//   ./bench keywords   (one benchmark by name)
+
+// Seconds taken by f(), best of a few runs to keep noise down
+template<typename F>
+double Time(F f, int runs = 5) {
+  double best = 1e100;
+  for(int i = 0; i < runs; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    best = std::min(best, d.count());
+  }
+  return best;
+}
+
+// Keeps the optimizer from discarding a result
+template<typename T>
+void Keep(const T& value) { asm volatile("" : : "g"(&value) : "memory"); }
+
+// Generates one long statement made mostly of identifiers and keywords
+std::string Identifier_Input(size_t count) {
+  static const char* words[] = { "alpha", "beta", "x", "var", "counter_2", "int", "bool",
+				 "gamma_delta", "true", "false", "t", "value", "tmp1", "vars" };
+  std::string s;
+  for(size_t i = 0; i < count; ++i) {
+    s += words[(i * 7) % (sizeof(words) / sizeof(words[0]))];
+    s += ' ';
+  }
+  return s;
+}
+
+// Keyword lookup the way the lexer used to do it: a fresh map per identifier
+Token_Kind Map_Keyword_Kind(std::string_view s) {
+  std::unordered_map<std::string, Token_Kind> kws = {
+    {"true", True_KW}, {"false", False_KW}, {"var", Var_KW}, {"int", Int_KW}, {"bool", Bool_KW}
+  };
+  auto it = kws.find(std::string(s));
+  return it != kws.end() ? it->second : Id_Tok;
+}
+
+void Bench_Keywords() {
+  Context cxt('d');
+  std::string input = Identifier_Input(1000000);
+
+  // collect the identifier spans once so only the lookups are timed
+  std::vector<std::string_view> ids;
+  Lexer lexer(input, &cxt);
+  for(Token t = lexer.Next(); t.kind != Eof_Tok; t = lexer.Next())
+    ids.push_back(t.Print(input));
+
+  double map = Time([&] {
+    int n = 0;
+    for(std::string_view id : ids)
+      n += Map_Keyword_Kind(id);
+    Keep(n);
+  }, 1);
+  double hash = Time([&] {
+    int n = 0;
+    for(std::string_view id : ids)
+      n += Keyword_Kind(id);
+    Keep(n);
+  });
+  double lex = Time([&] {
+    Lexer l(input, &cxt);
+    int n = 0;
+    for(Token t = l.Next(); t.kind != Eof_Tok; t = l.Next())
+      n += t.kind;
+    Keep(n);
+  });
+
+  std::cout << "keywords: " << ids.size() << " identifiers\n"
+	    << "  per-call map:  " << map * 1e9 / ids.size() << " ns/identifier\n"
+	    << "  perfect hash:  " << hash * 1e9 / ids.size() << " ns/identifier\n"
+	    << "  full lexer:    " << input.size() / lex / 1e6 << " MB/s\n";
+}
+
+// Generates one long machine-generated line: long names, wide padding and
+// long literals, the case the vectorized scanners are meant for
+std::string Generated_Input(size_t bytes) {
+  std::string s;
+  for(size_t i = 0; s.size() < bytes; ++i) {
+    s += "generated_identifier_number_" + std::to_string(i) + "_with_a_long_suffix";
+    s += std::string(8 + i % 24, ' ');
+    s += i % 2 ? "+ 0x7fff00ff" : "* 0b1010101010101010";
+    s += std::string(4 + i % 40, ' ');
+    s += "- 1234567890\t\t";
+  }
+  return s;
+}
+
+void Bench_Scan() {
+  Context cxt('d');
+  std::string input = Generated_Input(8 << 20);
+
+  std::vector<Token> expected;
+  Lexer reference(input, &cxt, Scalar_Scanner);
+  for(Token t = reference.Next(); t.kind != Eof_Tok; t = reference.Next())
+    expected.push_back(t);
+
+  std::cout << "scan: " << input.size() << " bytes, " << expected.size() << " tokens\n";
+
+  const Scanner* scanners[] = {
+    &Scalar_Scanner,
+#ifdef SCAN_X86
+    &SSE2_Scanner, &AVX2_Scanner
+#endif
+  };
+  for(const Scanner* scanner : scanners) {
+    if(!Scanner_Supported(*scanner))
+      continue;
+
+    // the token stream must not depend on the scanner
+    Lexer check(input, &cxt, *scanner);
+    for(const Token& e : expected) {
+      Token t = check.Next();
+      if(t.kind != e.kind || t.offset != e.offset || t.length != e.length || t.value != e.value)
+	throw std::runtime_error(std::string("Scanner ") + scanner->name + " changed the token stream.");
+    }
+
+    double seconds = Time([&] {
+      Lexer l(input, &cxt, *scanner);
+      int n = 0;
+      for(Token t = l.Next(); t.kind != Eof_Tok; t = l.Next())
+	n += t.kind;
+      Keep(n);
+    });
+    std::cout << "  " << scanner->name << ": " << input.size() / seconds / 1e6 << " MB/s\n";
+  }
+}
+
+// Lexing a many-line input with Parallel_Lex as the thread count grows
+void Bench_Lex_Threads() {
+  Context cxt('d');
+  std::string input;
+  for(size_t i = 0; input.size() < (64u << 20); ++i)
+    input += "var int value_" + std::to_string(i) + " = (0x7fff_00ff + " + std::to_string(i) +
+      ") * 0b1010 - other_value_" + std::to_string(i % 97) + " # comment\n";
+
+  size_t expected = 0, lines = 0;
+  Parallel_Lex reference(input, &cxt, 1);
+  for(Lexed_Line l; reference.Next(l); ++lines)
+    expected += l.count;
+  std::cout << "lexthreads: " << input.size() << " bytes, " << lines << " lines, " << expected << " tokens\n";
+
+  unsigned cores = std::thread::hardware_concurrency();
+  for(unsigned threads = 1; threads <= 16; threads *= 2) {
+    size_t tokens = 0;
+    double seconds = Time([&] {
+      Parallel_Lex lexed(input, &cxt, threads);
+      tokens = 0;
+      for(Lexed_Line l; lexed.Next(l); )
+	tokens += l.count;
+    }, 3);
+    if(tokens != expected)
+      throw std::runtime_error("Parallel lexing changed the token stream.");
+    std::cout << "  " << threads << " thread" << (threads > 1 ? "s: " : ":  ") << input.size() / seconds / 1e6 << " MB/s"
+	      << (threads > cores ? " (more threads than cores)" : "") << "\n";
+  }
+}
+
+// Generates one long line of literals separated by operators
+std::string Literal_Input(size_t count) {
+  static const char* literals[] = { "2147483647", "0x7fff_ffff", "0b1010101010101010", "1_000_000",
+				    "42", "0xDEADBEE", "123456789", "0" };
+  std::string s;
+  for(size_t i = 0; i < count; ++i) {
+    s += literals[i % (sizeof(literals) / sizeof(literals[0]))];
+    s += " + ";
+  }
+  return s + "0";
+}
+
+// Literal conversion the way the lexer used to do it: collect, then std::stoi
+int Stoi_Literal(std::string_view s) {
+  std::string buffer;
+  for(char c : s)
+    if(c != '_')
+      buffer += c;
+  if(buffer.size() > 2 && buffer[1] == 'x')
+    return std::stoi(buffer, nullptr, 16);
+  if(buffer.size() > 2 && buffer[1] == 'b')
+    return std::stoi(buffer.substr(2), nullptr, 2);
+  return std::stoi(buffer);
+}
+
+void Bench_Literals() {
+  Context cxt('d');
+  std::string input = Literal_Input(1000000);
+
+  std::vector<std::string_view> literals;
+  Lexer lexer(input, &cxt);
+  for(Token t = lexer.Next(); t.kind != Eof_Tok; t = lexer.Next())
+    if(t.kind == Int_Tok)
+      literals.push_back(t.Print(input));
+
+  double stoi = Time([&] {
+    int n = 0;
+    for(std::string_view l : literals)
+      n += Stoi_Literal(l);
+    Keep(n);
+  });
+  double lex = Time([&] {
+    Lexer l(input, &cxt);
+    int n = 0;
+    for(Token t = l.Next(); t.kind != Eof_Tok; t = l.Next())
+      n += t.value;
+    Keep(n);
+  });
+
+  std::cout << "literals: " << literals.size() << " literals\n"
+	    << "  buffer + stoi:   " << stoi * 1e9 / literals.size() << " ns/literal (conversion only)\n"
+	    << "  lexer (in place): " << lex * 1e9 / literals.size() << " ns/literal (whole lexer), "
+	    << input.size() / lex / 1e6 << " MB/s\n";
+}
+
+// Parses one statement, best of a few runs, and reports throughput
+void Time_Parse(const char* name, const std::string& input, Context& cxt) {
+  double seconds = Time([&] {
+    Lexer lexer(input, &cxt);
+    Parser parser(lexer, &cxt);
+    Keep(parser.Parse());
+    cxt.scratch.Reset();
+  });
+  std::cout << "  " << name << ": " << input.size() / seconds / 1e6 << " MB/s\n";
+}
+
+void Bench_Parse() {
+  Context cxt('d');
+  const size_t n = 1000000;
+
+  // flat: long chains of mixed-precedence binary operators
+  std::string flat = "1";
+  static const char* ops[] = { " + ", " * ", " - ", " & ", " | ", " ^ " };
+  for(size_t i = 0; i < n; ++i)
+    flat += std::string(ops[i % 6]) + (i % 4 ? "1" : "(1)");
+
+  // nested: deep parentheses and unary operators, which used to take a
+  // dozen call frames per level and overflow the stack
+  std::string parens = std::string(n, '(') + "1" + std::string(n, ')');
+  std::string unary;
+  for(size_t i = 0; i < n; ++i)
+    unary += "- ~";
+  unary += "1";
+  std::string mixed;
+  for(size_t i = 0; i < n / 4; ++i)
+    mixed += "(1 + -(2 * ";
+  mixed += "3";
+  for(size_t i = 0; i < n / 4; ++i)
+    mixed += "))";
+
+  std::cout << "parse:\n";
+  Time_Parse("flat", flat, cxt);
+  Time_Parse("nested parentheses", parens, cxt);
+  Time_Parse("nested unary", unary, cxt);
+  Time_Parse("nested mixed", mixed, cxt);
+}
+
+// Parses an expression statement into cxt's scratch region
+Expr* Parse_Expr(const std::string& input, Context& cxt) {
+  Lexer lexer(input, &cxt);
+  Parser parser(lexer, &cxt);
+  return static_cast<Expr_Stmt*>(parser.Parse())->e;
+}
+
+// Balanced tree of depth levels over the binary operators
+std::string Balanced_Input(int levels, size_t& leaf) {
+  static const char* ops[] = { " + ", " * ", " - ", " & ", " | ", " ^ " };
+  if(levels == 0)
+    return std::to_string(++leaf % 100);
+  std::string left = Balanced_Input(levels - 1, leaf);
+  return "(" + left + ops[leaf % 6] + Balanced_Input(levels - 1, leaf) + ")";
+}
+
+// Echoing a large expression, as every Input: line does
+void Bench_Print() {
+  Context cxt('d');
+  size_t leaf = 0;
+  const std::string input = Balanced_Input(20, leaf);
+  Expr* e = Parse_Expr(input, cxt);
+
+  std::string text;
+  double seconds = Time([&] { text = e->Print(); });
+  std::cout << "print: " << e->Weight() << " nodes, " << text.size() << " bytes\n"
+	    << "  " << seconds * 1e9 / e->Weight() << " ns/node, " << text.size() / seconds / 1e6 << " MB/s\n";
+  cxt.scratch.Reset();
+}
+
+void Bench_Eval() {
+  Context cxt('d');
+  const int runs = 1000000;
+  const std::string input =
+    "(1 + 2 * 3 - 4 / 2 > 3 && !(7 % 3 == 2) || 5 <= 5) ? (100 * 3 - 7 ^ 12 | 3) & ~8 : -(2 + 2) * 9";
+  Expr* e = Parse_Expr(input, cxt);
+
+  Program p;
+  Compiler c(p);
+  c.Emit(Op_Return, 0, e->Lower(c, 0));
+
+  Jit_Code jit(p);
+
+  int expected = e->Eval(), result = 0;
+  if(Execute(p, result) != Eval_Ok || result != expected)
+    throw std::runtime_error("Engines disagree.");
+  if(jit.Ok() && (jit.Run(result) != Eval_Ok || result != expected))
+    throw std::runtime_error("Engines disagree.");
+
+  double tree = Time([&] {
+    int n = 0;
+    for(int i = 0; i < runs; ++i)
+      n += e->Eval();
+    Keep(n);
+  });
+  double vm = Time([&] {
+    int n = 0, r = 0;
+    for(int i = 0; i < runs; ++i) {
+      Execute(p, r);
+      n += r;
+    }
+    Keep(n);
+  });
+
+  std::cout << "eval: " << input.size() << " byte expression, " << p.code.size() << " instructions\n"
+	    << "  tree walker:  " << runs / tree / 1e6 << " M evals/s\n"
+	    << "  bytecode VM:  " << runs / vm / 1e6 << " M evals/s\n";
+
+  if(jit.Ok()) {
+    double native = Time([&] {
+      int n = 0, r = 0;
+      for(int i = 0; i < runs; ++i) {
+	jit.Run(r);
+	n += r;
+      }
+      Keep(n);
+    });
+    std::cout << "  native code:  " << runs / native / 1e6 << " M evals/s\n";
+  }
+  cxt.scratch.Reset();
+}
+
+// Balanced tree of depth levels whose value cannot overflow
+std::string Bitwise_Input(int levels, size_t& leaf) {
+  static const char* ops[] = { " + ", " & ", " | ", " ^ " };
+  if(levels == 0)
+    return std::to_string(++leaf % 100);
+  std::string left = Bitwise_Input(levels - 1, leaf);
+  return "(" + left + ops[leaf % 4] + Bitwise_Input(levels - 1, leaf) + ")";
+}
+
+// An object per node against a Node_Store, on a tree of millions of nodes
+void Bench_Store() {
+  size_t leaf = 0;
+  const std::string input = Bitwise_Input(21, leaf);
+  std::cout << "soa:\n";
+  for(char ast : { 't', 's' }) {
+    Context cxt('d');
+    cxt.ast = ast;
+    Expr* e = nullptr;
+    double parse = Time([&] { cxt.scratch.Reset(); e = Parse_Expr(input, cxt); }, 3);
+    const double bytes = double(cxt.scratch.Used()) / e->Weight();
+    int value = 0;
+    double eval = Time([&] { value = e->Eval(); });
+    std::string text;
+    double print = Time([&] { text = e->Print(); }, 3);
+    Keep(value);
+    std::cout << (ast == 't' ? "  objects: " : "  store:   ") << bytes << " bytes/node, "
+	      << "parse " << parse * 1e9 / e->Weight() << " ns/node, "
+	      << "eval " << eval * 1e9 / e->Weight() << " ns/node, "
+	      << "print " << print * 1e9 / e->Weight() << " ns/node (" << e->Weight() << " nodes, value " << value << ")\n";
+    cxt.scratch.Reset();
+  }
+}
+
+// Declares a variable the way an input line would
+void Declare(const std::string& line, Context& cxt) {
+  Lexer lexer(line, &cxt);
+  Parser parser(lexer, &cxt);
+  parser.Parse();
+}
+
+// Declaring many variables, then reading them back, as the front end does
+void Bench_Symbols() {
+  const int n = 200000;
+  std::vector<std::string> decls, reads;
+  for(int i = 0; i < n; ++i) {
+    decls.push_back("var int variable_" + std::to_string(i) + " = " + std::to_string(i));
+    reads.push_back("variable_" + std::to_string(i * 7919 % n) + " + 1");
+  }
+
+  double declare = 1e100, read = 1e100;
+  size_t bytes = 0, added = 0;
+  for(int run = 0; run < 3; ++run) { // a fresh table each time
+    Context cxt('d');
+    auto Heap = [] { struct mallinfo2 m = mallinfo2(); return m.uordblks + m.hblkhd; }; // bytes in use, mapped or not
+    const size_t heap = Heap();
+    declare = std::min(declare, Time([&] {
+      for(const std::string& line : decls) {
+	Declare(line, cxt);
+	cxt.scratch.Reset(); // as main does
+      }
+    }, 1));
+    bytes = Heap() - heap - cxt.scratch.Reserved(); // the variables, their names and the table
+    read = std::min(read, Time([&] {
+      for(const std::string& line : reads) {
+	Lexer lexer(line, &cxt);
+	Parser parser(lexer, &cxt);
+	Keep(parser.Parse());
+	cxt.scratch.Reset();
+      }
+    }, 1));
+    const size_t names = cxt.names->Size();
+    for(int i = 0; i < n; ++i) { // names never declared are not kept
+      try {
+	Declare("undeclared_" + std::to_string(i) + " + 1", cxt);
+      }
+      catch(std::runtime_error&) {}
+    }
+    added = cxt.names->Size() - names;
+  }
+  std::cout << "symbols: " << n << " variables\n"
+	    << "  declare:     " << declare * 1e9 / n << " ns/statement, " << bytes / n << " bytes/variable\n"
+	    << "  read:        " << read * 1e9 / n << " ns/statement\n"
+	    << "  undeclared:  " << n << " reads, " << added << " names kept\n";
+}
+
+// What-if branches: forks of a large base, each reassigning a few variables
+void Bench_Fork() {
+  const int n = 100000, branches = 10000;
+  Context base('d');
+  for(int i = 0; i < n; ++i)
+    Declare("var int variable_" + std::to_string(i) + " = " + std::to_string(i), base);
+  base.scratch.Reset();
+  const size_t shared = Symbol_Table::AllBytes();
+
+  std::vector<std::string> changes;
+  for(int i = 0; i < 3 * branches; ++i)
+    changes.push_back("variable_" + std::to_string(i * 7919 % n) + " = " + std::to_string(i));
+
+  std::vector<std::unique_ptr<Context>> forks;
+  double fork = Time([&] {
+    forks.clear();
+    for(int b = 0; b < branches; ++b)
+      forks.emplace_back(base.Fork());
+  }, 1);
+  double change = Time([&] {
+    for(int b = 0; b < branches; ++b)
+      for(int k = 0; k < 3; ++k) {
+	Declare(changes[3 * b + k], *forks[b]);
+	forks[b]->scratch.Reset();
+      }
+  }, 1);
+  const size_t added = Symbol_Table::AllBytes() - shared;
+
+  std::cout << "fork: " << branches << " branches of " << n << " variables, 3 changes each\n"
+	    << "  fork:        " << fork * 1e9 / branches << " ns/branch\n"
+	    << "  change:      " << change * 1e9 / (3 * branches) << " ns/change\n"
+	    << "  table nodes: " << shared / n << " bytes/variable shared, " << added / branches << " bytes/branch\n";
+}
+
+void Bench_Batch() {
+  Context cxt('d');
+  const size_t rows = 4 << 20;
+  Declare("var int x = 0", cxt);
+  Declare("var int y = 0", cxt);
+  Declare("var int z = 0", cxt);
+  const std::string input = "x * y + 3 < z";
+  Expr* e = Parse_Expr(input, cxt);
+  std::vector<const Decl*> vars = { cxt.FindSymbol("x"), cxt.FindSymbol("y"), cxt.FindSymbol("z") };
+
+  std::vector<int> x(rows), y(rows), z(rows), result(rows);
+  std::vector<uint8_t> status(rows);
+  for(size_t i = 0; i < rows; ++i) {
+    x[i] = int(i * 2654435761u) >> 16;
+    y[i] = int(i % 1000) - 500;
+    z[i] = int(i * 40503u) >> 8;
+  }
+  const int* columns[] = { x.data(), y.data(), z.data() };
+
+  // one VM run per row, variables loaded from slots
+  std::unordered_map<const Decl*, int> slots = { {vars[0], 0}, {vars[1], 1}, {vars[2], 2} };
+  Program p;
+  Compiler c(p, &slots);
+  c.Emit(Op_Return, 0, e->Lower(c, 0));
+  double vm = Time([&] {
+    for(size_t i = 0; i < rows; ++i) {
+      int row[] = { x[i], y[i], z[i] };
+      status[i] = Execute(p, result[i], row);
+    }
+  });
+  std::vector<int> expected = result;
+
+  Column_Batch batch(e, vars);
+  double columnar = Time([&] { batch.Evaluate(columns, rows, result.data(), status.data()); });
+  if(result != expected)
+    throw std::runtime_error("Batch result differs.");
+
+  // the same program as native code, as --rows --engine=jit runs it
+  Jit_Code jit(p);
+  double native = 0;
+  if(jit.Ok()) {
+    native = Time([&] {
+      for(size_t i = 0; i < rows; ++i) {
+	int row[] = { x[i], y[i], z[i] };
+	status[i] = jit.Run(result[i], row);
+      }
+    });
+    if(result != expected)
+      throw std::runtime_error("Native result differs.");
+  }
+
+  std::cout << "batch: " << input << " over " << rows << " rows\n"
+	    << "  VM per row:  " << rows / vm / 1e6 << " M rows/s\n";
+  if(jit.Ok())
+    std::cout << "  JIT per row: " << rows / native / 1e6 << " M rows/s\n";
+  std::cout << "  columnar:    " << rows / columnar / 1e6 << " M rows/s\n";
+  cxt.scratch.Reset();
+}
+
+// A selective filter: the first conjunct keeps about 1 row in 16
+void Bench_Filter() {
+  Context cxt('d');
+  const size_t rows = 4 << 20;
+  Declare("var int x = 0", cxt);
+  Declare("var int y = 0", cxt);
+  Declare("var int z = 0", cxt);
+  const std::string input = "x % 16 == 0 && (y * y > z || x / 7 < y) && !(z < 0)";
+  Expr* e = Parse_Expr(input, cxt);
+  std::vector<const Decl*> vars = { cxt.FindSymbol("x"), cxt.FindSymbol("y"), cxt.FindSymbol("z") };
+
+  std::vector<int> x(rows), y(rows), z(rows), result(rows);
+  std::vector<uint8_t> status(rows);
+  for(size_t i = 0; i < rows; ++i) {
+    x[i] = int(i * 2654435761u) >> 16;
+    y[i] = int(i % 1000) - 500;
+    z[i] = int(i * 40503u) >> 8;
+  }
+  const int* columns[] = { x.data(), y.data(), z.data() };
+
+  // a 0/1 int per row, then the indices of the ones
+  Column_Batch batch(e, vars);
+  std::vector<size_t> expected, matches;
+  double columnar = Time([&] {
+    expected.clear();
+    batch.Evaluate(columns, rows, result.data(), status.data());
+    for(size_t i = 0; i < rows; ++i)
+      if(result[i])
+	expected.push_back(i);
+  });
+
+  Predicate pred(e, vars);
+  double bitmap = Time([&] {
+    matches.clear();
+    pred.Select(columns, rows, matches);
+  });
+  if(matches != expected)
+    throw std::runtime_error("Filter result differs.");
+
+  std::cout << "filter: " << input << " over " << rows << " rows, " << matches.size() << " match\n"
+	    << "  columnar:    " << rows / columnar / 1e6 << " M rows/s\n"
+	    << "  bitmaps:     " << rows / bitmap / 1e6 << " M rows/s\n";
+  cxt.scratch.Reset();
+}
+
+// Formatting ints in each output format through the output writer, against
+// an ostream inserting decimal; the writer goes to /dev/null
+void Bench_Format() {
+  const size_t count = 4 << 20;
+  std::vector<int> values(count);
+  for(size_t i = 0; i < count; ++i)
+    values[i] = int(i * 2654435761u) >> (i % 32);
+
+  int null = open("/dev/null", O_WRONLY);
+  Fd_Buf writer(null);
+  std::ostream out(&writer);
+  double stream = Time([&] {
+    for(int v : values)
+      out << v << '\n';
+  });
+  std::cout << "format: " << count << " ints\n"
+	    << "  ostream <<:  " << stream * 1e9 / count << " ns/int (decimal)\n";
+
+  for(char format : { 'd', 'h', 'b' }) {
+    double seconds = Time([&] {
+      char buf[Int_Chars + 1];
+      for(int v : values) {
+	size_t n = Format_Int(buf, v, format);
+	buf[n] = '\n';
+	out.write(buf, n + 1);
+      }
+    });
+    std::cout << "  Format_Int " << format << ": " << seconds * 1e9 / count << " ns/int\n";
+  }
+  out.flush();
+  close(null);
+}
+
+// Restarting with the variables of an earlier run: replaying all of its
+// statements, against loading a snapshot and replaying a journal of the
+// changes made since
+void Bench_Restart() {
+  const int n = 200000, changes = 20000;
+  const char* snapshot = "/tmp/bench_restart.snap";
+  const char* journal = "/tmp/bench_restart.jrnl";
+  std::vector<std::string> history;
+  for(int i = 0; i < n; ++i)
+    history.push_back("var int variable_" + std::to_string(i) + " = " +
+		      (i ? "variable_" + std::to_string(i - 1) + " % 1000 * 3 + " : "") + std::to_string(i));
+  for(int i = 0; i < changes; ++i)
+    history.push_back("variable_" + std::to_string(i * 7919 % n) + " = variable_" + std::to_string(i) + " - 1");
+
+  unlink(snapshot);
+  unlink(journal);
+  {
+    Context cxt('d');
+    Journal saved(&cxt, snapshot, journal);
+    for(int i = 0; i < n; ++i) {
+      Declare(history[i], cxt);
+      cxt.scratch.Reset();
+    }
+    saved.Checkpoint();
+    for(int i = n; i < n + changes; ++i) {
+      Declare(history[i], cxt);
+      cxt.scratch.Reset();
+    }
+  }
+
+  int check[2];
+  double replay = Time([&] {
+    Context cxt('d');
+    for(auto& line : history) {
+      Declare(line, cxt);
+      cxt.scratch.Reset();
+    }
+    check[0] = dynamic_cast<Var_Decl*>(cxt.FindSymbol("variable_0"))->init->Eval();
+  }, 3);
+  double restore = Time([&] {
+    Context cxt('d');
+    Journal restored(&cxt, snapshot, journal);
+    check[1] = dynamic_cast<Var_Decl*>(cxt.FindSymbol("variable_0"))->init->Eval();
+  }, 3);
+  unlink(snapshot);
+  unlink(journal);
+  if(check[0] != check[1])
+    std::cout << "restart: snapshot and replay disagree\n";
+
+  std::cout << "restart: " << n << " declarations, then " << changes << " reassignments\n"
+	    << "  full replay:        " << replay * 1e3 << " ms\n"
+	    << "  snapshot + journal: " << restore * 1e3 << " ms\n";
+}
+
+// Running a script again: lexing and parsing every statement, against
+// taking the checked trees from a warm AST cache. Declarations still
+// reduce and store their values either way.
+void Time_Ast_Cache(const char* name, const std::vector<std::string>& script) {
+  const char* path = "/tmp/bench_ast_cache";
+  auto Run = [&](bool cached) {
+    Context cxt('d');
+    std::unique_ptr<Ast_Cache> cache(cached ? new Ast_Cache(&cxt, path) : nullptr);
+    for(auto& line : script) {
+      Stmt* s = cache ? cache->Find(line, cxt.scratch) : nullptr;
+      if(!s) {
+	Lexer lexer(line, &cxt);
+	Parser parser(lexer, &cxt);
+	s = parser.Parse();
+	if(cache)
+	  cache->Add(line, s);
+      }
+      Keep(s);
+      cxt.scratch.Reset();
+    }
+  };
+
+  double cold = Time([&] { unlink(path); Run(true); }, 1);
+  double parse = Time([&] { Run(false); }, 3);
+  double warm = Time([&] { Run(true); }, 3);
+  struct stat st;
+  stat(path, &st);
+  unlink(path);
+
+  size_t text = 0;
+  for(auto& line : script)
+    text += line.size() + 1;
+  const size_t n = script.size();
+  std::cout << "  " << name << ": " << n << " statements, " << text / n << " bytes each, cache " << st.st_size / n << " bytes each\n"
+	    << "    parse:              " << parse * 1e9 / n << " ns/statement\n"
+	    << "    parse & fill cache: " << cold * 1e9 / n << " ns/statement\n"
+	    << "    warm cache:         " << warm * 1e9 / n << " ns/statement\n";
+}
+
+void Bench_Ast_Cache() {
+  // short: three declarations to every expression
+  const int n = 100000;
+  std::vector<std::string> script;
+  for(int i = 0; i < n; ++i) {
+    const int last = i - 1 - (i % 4 == 0); // the latest declaration
+    const std::string p = "variable_" + std::to_string(last < 0 ? 0 : last);
+    if(i % 4 == 3)
+      script.push_back("(" + p + " + 3) * 7 - " + p + " / 2 == 11 || " + p + " % 5 > 2");
+    else if(i)
+      script.push_back("var int variable_" + std::to_string(i) + " = (" + p + " % 1000 * 3 + " + std::to_string(i) + ") ^ (" + p + " & 255) | 0x10");
+    else
+      script.push_back("var int variable_0 = 1");
+  }
+  std::cout << "astcache:\n";
+  Time_Ast_Cache("short", script);
+
+  // long: expressions of 64 leaves over a few variables
+  script.clear();
+  for(int i = 0; i < 8; ++i)
+    script.push_back("var int v" + std::to_string(i) + " = " + std::to_string(i + 1));
+  size_t leaf = 0;
+  for(int i = 0; i < n / 5; ++i)
+    script.push_back(Balanced_Input(6, leaf) + " == v" + std::to_string(i % 8) + " + " + std::to_string(i));
+  Time_Ast_Cache("long", script);
+}
+
+int main(int argc, char* argv[]) {
+  struct { const char* name; void (*run)(); } benches[] = {
+    { "keywords", Bench_Keywords },
+    { "scan", Bench_Scan },
+    { "lexthreads", Bench_Lex_Threads },
+    { "literals", Bench_Literals },
+    { "parse", Bench_Parse },
+    { "print", Bench_Print },
+    { "eval", Bench_Eval },
+    { "soa", Bench_Store },
+    { "symbols", Bench_Symbols },
+    { "fork", Bench_Fork },
+    { "batch", Bench_Batch },
+    { "filter", Bench_Filter },
+    { "format", Bench_Format },
+    { "restart", Bench_Restart },
+    { "astcache", Bench_Ast_Cache },
+  };
+
+  for(auto& b : benches)
+    if(argc < 2 || !strcmp(argv[1], b.name))
+      b.run();
+
+  return 0;
+}
@@ -0,0 +1,150 @@
+#ifndef BYTECODE_HPP
+#define BYTECODE_HPP
+
+#include "arith.hpp"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Linear bytecode for checked expression trees and the register VM that runs
+// it. Each node lowers itself into the register it is given (see
+// Expr::Lower), with its operands in the registers just above, so a tree
+// needs one register per level of depth. Literals are not loaded at all:
+// they live in constant registers below r[0] (r[-1], r[-2], ...) that are
+// filled when the program starts. &&, || and ?: become jumps.
+
+enum Opcode : uint8_t {
+  Op_Move, // r[dst] = r[a]
+  Op_Add, Op_Sub, Op_Mul, Op_Div, Op_Rem, // r[dst] = r[a] op r[b], checked
+  Op_Neg, // r[dst] = -r[a], checked
+  Op_Not, // r[dst] = !r[a]
+  Op_Comp, // r[dst] = ~r[a]
+  Op_Bit_And, Op_Bit_Or, Op_Bit_Xor,
+  Op_Equal, Op_Not_Equal, Op_Less, Op_Greater, Op_Less_Equal, Op_Greater_Equal,
+  Op_Jump, // goto b
+  Op_Jump_False, // if(!r[a]) goto b
+  Op_Jump_True, // if(r[a]) goto b
+  Op_Load, // r[dst] = variable slot a
+  Op_Return, // result is r[a]
+  Opcode_Count
+};
+
+struct Instr {
+  Opcode op;
+  int32_t dst, a, b; // registers, or a jump target as noted above
+};
+
+struct Program {
+  std::vector<Instr> code;
+  std::vector<int> constants; // constants[k] is register -1-k
+  int registers = 0; // number of registers from r[0] up
+};
+
+struct Decl;
+
+// Emits code into a program
+struct Compiler {
+  Program& prog;
+
+  const std::unordered_map<const Decl*, int>* slots; // slots of variables loaded at run time; others are constants
+
+  Compiler(Program& _prog, const std::unordered_map<const Decl*, int>* _slots = nullptr)
+    : prog(_prog), slots(_slots) {}
+  int Emit(Opcode op, int dst, int a = 0, int b = 0) { // returns the instruction's index
+    if(dst >= prog.registers)
+      prog.registers = dst + 1;
+    prog.code.push_back({op, dst, a, b});
+    return int(prog.code.size()) - 1;
+  }
+  int Constant(int value) { // returns the register holding value
+    prog.constants.push_back(value);
+    return -int(prog.constants.size());
+  }
+  int Variable(const Decl* var, int value, int dst) { // returns the register holding the variable
+    if(slots) {
+      auto it = slots->find(var);
+      if(it != slots->end()) {
+	Emit(Op_Load, dst, it->second);
+	return dst;
+      }
+    }
+    return Constant(value); // the value it had when parsed
+  }
+  void Move(int dst, int src) { if(src != dst) Emit(Op_Move, dst, src); }
+  int Here() const { return int(prog.code.size()); } // index of the next instruction
+  void Patch(int jump) { prog.code[jump].b = Here(); } // sends a jump to the next instruction
+};
+
+// Runs a program, leaving its value in result; Op_Load reads the given
+// variable slots. Dispatch is threaded with computed gotos: every handler
+// jumps straight to the next one.
+Eval_Status Execute(const Program& p, int& result, const int* slots = nullptr) {
+  static void* const labels[Opcode_Count] = {
+    &&L_Move, &&L_Add, &&L_Sub, &&L_Mul, &&L_Div, &&L_Rem, &&L_Neg, &&L_Not, &&L_Comp,
+    &&L_Bit_And, &&L_Bit_Or, &&L_Bit_Xor,
+    &&L_Equal, &&L_Not_Equal, &&L_Less, &&L_Greater, &&L_Less_Equal, &&L_Greater_Equal,
+    &&L_Jump, &&L_Jump_False, &&L_Jump_True, &&L_Load, &&L_Return
+  };
+
+  // register file: constants (reversed) followed by r[0], r[1], ...
+  const size_t nconst = p.constants.size();
+  int small[64];
+  std::vector<int> large;
+  int* file = small;
+  if(nconst + p.registers > 64) {
+    large.resize(nconst + p.registers);
+    file = large.data();
+  }
+  int* r = file + nconst;
+  for(size_t k = 0; k < nconst; ++k)
+    r[-1 - int(k)] = p.constants[k];
+
+  const Instr* code = p.code.data();
+  const Instr* ip = code;
+  Eval_Status status = Eval_Ok;
+
+#define DISPATCH() goto *labels[ip->op]
+#define NEXT() do { ++ip; DISPATCH(); } while(0)
+#define CHECKED(f) do { int x; if((status = f(r[ip->a], r[ip->b], x))) return status; r[ip->dst] = x; NEXT(); } while(0)
+
+  DISPATCH();
+
+ L_Move: r[ip->dst] = r[ip->a]; NEXT();
+ L_Add: CHECKED(Checked_Add);
+ L_Sub: CHECKED(Checked_Sub);
+ L_Mul: CHECKED(Checked_Mul);
+ L_Div: CHECKED(Checked_Div);
+ L_Rem: CHECKED(Checked_Rem);
+ L_Neg: {
+    int x;
+    if((status = Checked_Neg(r[ip->a], x)))
+      return status;
+    r[ip->dst] = x;
+    NEXT();
+  }
+ L_Not: r[ip->dst] = !r[ip->a]; NEXT();
+ L_Comp: r[ip->dst] = ~r[ip->a]; NEXT();
+ L_Bit_And: r[ip->dst] = r[ip->a] & r[ip->b]; NEXT();
+ L_Bit_Or: r[ip->dst] = r[ip->a] | r[ip->b]; NEXT();
+ L_Bit_Xor: r[ip->dst] = r[ip->a] ^ r[ip->b]; NEXT();
+ L_Equal: r[ip->dst] = r[ip->a] == r[ip->b]; NEXT();
+ L_Not_Equal: r[ip->dst] = r[ip->a] != r[ip->b]; NEXT();
+ L_Less: r[ip->dst] = r[ip->a] < r[ip->b]; NEXT();
+ L_Greater: r[ip->dst] = r[ip->a] > r[ip->b]; NEXT();
+ L_Less_Equal: r[ip->dst] = r[ip->a] <= r[ip->b]; NEXT();
+ L_Greater_Equal: r[ip->dst] = r[ip->a] >= r[ip->b]; NEXT();
+ L_Jump: ip = code + ip->b; DISPATCH();
+ L_Jump_False: ip = r[ip->a] ? ip + 1 : code + ip->b; DISPATCH();
+ L_Jump_True: ip = r[ip->a] ? code + ip->b : ip + 1; DISPATCH();
+ L_Load: r[ip->dst] = slots[ip->a]; NEXT();
+ L_Return:
+  result = r[ip->a];
+  return Eval_Ok;
+
+#undef CHECKED
+#undef NEXT
+#undef DISPATCH
+}
+
+#endif
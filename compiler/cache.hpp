@@ -0,0 +1,377 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include "parser.hpp"
+#include "writer.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Checked statements kept on disk, so an input that does not change need
+// not be lexed and parsed again (--ast-cache). Each entry holds one
+// statement's text, its tree as a Flat_Tree, and the state of every
+// variable the tree depends on: the value and type of each variable it
+// reads, and for a declaration that its name is free, or for a
+// reassignment the type of the variable it sets.
+//
+// Entries are found by a hash of the text and are used only when the text
+// is the same and every one of those variables is still as recorded, so a
+// variable that is redeclared or reassigned to another value sends the
+// statement back through the parser. The tree is then built straight from
+// the mapped entry and committed as the parser would have.
+//
+// The file is mapped once, and new entries are appended to it as they are
+// made. An entry cut short is dropped when the file is opened, and one
+// whose check fails is never used. Only statements that parsed are kept, and at most Max_Variants
+// entries for one text (one per state of its variables).
+struct Ast_Cache {
+  static const int Max_Variants = 8;
+
+  struct Entry { // followed by its variables, nodes, text and names
+    uint64_t hash; // of the text
+    uint32_t bytes; // the whole entry, a multiple of 8
+    uint32_t length; // of the text
+    uint32_t kind; // 'e' expression, 'd' declaration, 'a' reassignment
+    uint32_t target; // the variable declared or reassigned; ~0 for an expression
+    uint32_t vars;
+    uint32_t nodes;
+    uint32_t names; // bytes of names
+    uint32_t check; // of all but the text, taking this as 0
+  };
+  struct Var_Entry {
+    uint32_t name; // offset into the names
+    uint32_t length;
+    int32_t value; // what it must hold, if read
+    uint32_t type; // 0 bool, 1 int
+    uint32_t use; // 'r' read, 'n' must not exist, 't' must exist with this type
+  };
+
+private:
+  Context* cxt;
+  int fd = -1;
+  const char* map = nullptr; // the file as it was opened
+  size_t mapped = 0;
+  std::unique_ptr<Fd_Buf> out; // new entries, on their way to the end of the file
+  Arena added; // new entries, for lookups later in the same run
+
+  std::vector<uint32_t> heads; // newest entry for each hash, open-addressed and at most half full; ~0 if empty
+  std::vector<const Entry*> entries;
+  std::vector<uint32_t> next; // older entry with the same hash, or ~0
+  std::vector<char> checked; // the entry's check has passed in this run
+
+  Flat_Tree flat; // reused by Add
+  std::vector<Var_Entry> vars;
+  std::string names, buffer;
+  std::vector<Var_Decl*> resolved; // reused by Find
+  std::vector<Expr*> built;
+
+  static uint64_t Hash(std::string_view, uint64_t h = 0);
+  static uint32_t Check(const Entry*);
+  static bool Valid(const Entry*, size_t room);
+  uint32_t& Head(uint64_t hash); // the slot for hash, empty if it has no entries
+  void Index(const Entry*);
+  bool Resolve(const Entry*);
+  Expr* Build(const Entry*, Arena&);
+
+public:
+  Ast_Cache(Context*, const char* path);
+  ~Ast_Cache();
+  Ast_Cache(const Ast_Cache&) = delete;
+  Ast_Cache& operator=(const Ast_Cache&) = delete;
+
+  Stmt* Find(std::string_view text, Arena& scratch, Stmt_Target* = nullptr); // the statement, committed, or nullptr to parse it
+  void Add(std::string_view text, Stmt*); // a statement just parsed from text
+  size_t Size() const { return entries.size(); }
+};
+
+Ast_Cache::Ast_Cache(Context* _cxt, const char* path) : cxt(_cxt), added(64 * 1024) {
+  fd = open(path, O_RDWR | O_CREAT, 0644);
+  if(fd < 0)
+    throw std::runtime_error("Could not open AST cache.");
+  struct stat st;
+  if(fstat(fd, &st) != 0)
+    throw std::runtime_error("Could not open AST cache.");
+
+  size_t end = 8; // of the last whole entry
+  if(st.st_size == 0) {
+    if(write(fd, "CDAST001", 8) != 8)
+      throw std::runtime_error("Could not write AST cache.");
+  }
+  else {
+    mapped = st.st_size;
+    void* m = mmap(nullptr, mapped, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0); // read ahead, rather than a page at a time
+    if(m == MAP_FAILED)
+      throw std::runtime_error("Could not read AST cache.");
+    map = static_cast<const char*>(m);
+    if(mapped < 8 || memcmp(map, "CDAST001", 8))
+      throw std::runtime_error("Invalid AST cache.");
+    for(const Entry* e; mapped - end >= sizeof(Entry); end += e->bytes) {
+      e = reinterpret_cast<const Entry*>(map + end);
+      if(!Valid(e, mapped - end))
+	break;
+      Index(e);
+    }
+    if(end != mapped && ftruncate(fd, end) != 0) // drop an entry cut short, so new ones follow the last whole one
+      throw std::runtime_error("Could not write AST cache.");
+  }
+  lseek(fd, end, SEEK_SET);
+  out.reset(new Fd_Buf(fd));
+}
+
+Ast_Cache::~Ast_Cache() {
+  out->pubsync();
+  if(map)
+    munmap(const_cast<char*>(map), mapped);
+  close(fd);
+}
+
+// Eight bytes at a time; unlike std::hash, the same from one build to the next
+uint64_t Ast_Cache::Hash(std::string_view s, uint64_t h) {
+  const uint64_t mul = 0x9e3779b97f4a7c15ull;
+  const char* p = s.data();
+  size_t n = s.size();
+  for(; n >= 8; p += 8, n -= 8) {
+    uint64_t w;
+    memcpy(&w, p, 8);
+    h = (h ^ w) * mul;
+    h ^= h >> 29;
+  }
+  uint64_t w = uint64_t(s.size()) << 56;
+  memcpy(&w, p, n); // the last few bytes, below the length in the top byte
+  h = (h ^ w) * mul;
+  return h ^ (h >> 32);
+}
+
+// The text is left out: it is compared whole before an entry is used
+uint32_t Ast_Cache::Check(const Entry* e) {
+  Entry h = *e;
+  h.check = 0;
+  const char* body = reinterpret_cast<const char*>(e + 1);
+  const size_t tree = e->vars * sizeof(Var_Entry) + e->nodes * sizeof(Flat_Node);
+  uint64_t c = Hash(std::string_view(reinterpret_cast<const char*>(&h), sizeof h));
+  c = Hash(std::string_view(body, tree), c);
+  return uint32_t(Hash(std::string_view(body + tree + e->length, e->bytes - sizeof h - tree - e->length), c));
+}
+
+// The entry fits in room and its parts fit in the entry
+bool Ast_Cache::Valid(const Entry* e, size_t room) {
+  if(e->bytes < sizeof(Entry) || e->bytes > room || e->bytes % 8)
+    return false;
+  const uint64_t parts = uint64_t(e->vars) * sizeof(Var_Entry) + uint64_t(e->nodes) * sizeof(Flat_Node) + e->length + e->names;
+  const bool target = e->kind == 'e' ? e->target == ~0u : (e->kind == 'd' || e->kind == 'a') && e->target < e->vars;
+  return parts <= e->bytes - sizeof(Entry) && e->nodes && target;
+}
+
+uint32_t& Ast_Cache::Head(uint64_t hash) {
+  const size_t mask = heads.size() - 1;
+  for(size_t i = hash & mask; ; i = (i + 1) & mask)
+    if(heads[i] == ~0u || entries[heads[i]]->hash == hash)
+      return heads[i];
+}
+
+void Ast_Cache::Index(const Entry* e) {
+  if(2 * (entries.size() + 1) > heads.size()) { // grow, keeping only the newest of each hash
+    std::vector<uint32_t> old(std::max<size_t>(1024, 2 * heads.size()), ~0u);
+    old.swap(heads);
+    for(uint32_t k : old)
+      if(k != ~0u)
+	Head(entries[k]->hash) = k;
+  }
+  uint32_t& head = Head(e->hash);
+  next.push_back(head);
+  head = uint32_t(entries.size());
+  entries.push_back(e);
+  checked.push_back(false);
+}
+
+// Looks up the entry's variables; true if all are as it needs
+bool Ast_Cache::Resolve(const Entry* e) {
+  const Var_Entry* vars = reinterpret_cast<const Var_Entry*>(e + 1);
+  const char* names = reinterpret_cast<const char*>(vars + e->vars) + e->nodes * sizeof(Flat_Node) + e->length;
+  resolved.clear();
+  for(uint32_t k = 0; k < e->vars; ++k) {
+    const Var_Entry& v = vars[k];
+    if(v.name > e->names || v.length > e->names - v.name)
+      return false;
+    Decl* d = cxt->FindSymbol(std::string_view(names + v.name, v.length));
+    Var_Decl* var = dynamic_cast<Var_Decl*>(d);
+    const Type* type = v.type ? static_cast<const Type*>(&cxt->Int_) : &cxt->Bool_;
+    if(v.use == 'n') {
+      if(d)
+	return false;
+    }
+    else if(!var || var->type != type || (v.use == 'r' && var->init->Eval() != v.value))
+      return false;
+    resolved.push_back(var);
+  }
+  return true;
+}
+
+// Builds the entry's tree in the statement's region; nullptr if it is damaged
+Expr* Ast_Cache::Build(const Entry* e, Arena& a) {
+  const Var_Entry* vars = reinterpret_cast<const Var_Entry*>(e + 1);
+  const Flat_Node* nodes = reinterpret_cast<const Flat_Node*>(vars + e->vars);
+  built.resize(e->nodes);
+  try {
+    for(uint32_t k = 0; k < e->nodes; ++k) {
+      const Flat_Node& n = nodes[k];
+      if(n.kind >= Flat_Kind_Count || (n.kind > Flat_Var_Ref && (!k || n.a >= k)) ||
+	 (n.kind == Flat_Cond && uint32_t(n.value) >= k))
+	return nullptr;
+      // the operands, of the nodes that have them: x alone, x & y, or x, y & z
+      Expr* z = n.kind > Flat_Var_Ref ? built[k - 1] : nullptr;
+      Expr* x = n.kind > Flat_Neg ? built[n.a] : z;
+      Expr* y = n.kind == Flat_Cond ? built[n.value] : z;
+      Expr*& r = built[k];
+      switch(n.kind) {
+      case Flat_Bool: r = a.Make<Bool_Expr>(n.value != 0, cxt); break;
+      case Flat_Int: r = a.Make<Int_Expr>(n.value, cxt); break;
+      case Flat_Var_Ref:
+	if(uint32_t(n.value) >= e->vars || vars[n.value].use != 'r')
+	  return nullptr;
+	r = a.Make<Var_Ref>(resolved[n.value], vars[n.value].value, cxt);
+	break;
+      case Flat_Not: r = a.Make<Not_Expr>(x, cxt); break;
+      case Flat_Bit_Comp: r = a.Make<Bit_Comp_Expr>(x, cxt); break;
+      case Flat_Neg: r = a.Make<Neg_Expr>(x, cxt); break;
+      case Flat_And: r = a.Make<And_Expr>(x, y, cxt); break;
+      case Flat_Or: r = a.Make<Or_Expr>(x, y, cxt); break;
+      case Flat_Bit_And: r = a.Make<Bit_And_Expr>(x, y, cxt); break;
+      case Flat_Bit_Or: r = a.Make<Bit_Or_Expr>(x, y, cxt); break;
+      case Flat_Bit_Xor: r = a.Make<Bit_Xor_Expr>(x, y, cxt); break;
+      case Flat_Equal_Equal: r = a.Make<Equal_Equal_Expr>(x, y, cxt); break;
+      case Flat_Not_Equal: r = a.Make<Not_Equal_Expr>(x, y, cxt); break;
+      case Flat_Less_Than: r = a.Make<Less_Than_Expr>(x, y, cxt); break;
+      case Flat_Greater_Than: r = a.Make<Greater_Than_Expr>(x, y, cxt); break;
+      case Flat_Less_Than_Equal: r = a.Make<Less_Than_Equal_Expr>(x, y, cxt); break;
+      case Flat_Greater_Than_Equal: r = a.Make<Greater_Than_Equal_Expr>(x, y, cxt); break;
+      case Flat_Add: r = a.Make<Add_Expr>(x, y, cxt); break;
+      case Flat_Sub: r = a.Make<Sub_Expr>(x, y, cxt); break;
+      case Flat_Mult: r = a.Make<Mult_Expr>(x, y, cxt); break;
+      case Flat_Div: r = a.Make<Div_Expr>(x, y, cxt); break;
+      case Flat_Rem: r = a.Make<Rem_Expr>(x, y, cxt); break;
+      case Flat_Cond: r = a.Make<Cond_Expr>(x, y, z, cxt); break;
+      }
+    }
+  }
+  catch(std::runtime_error&) { // a type error: the entry does not match its text
+    return nullptr;
+  }
+  return built.back();
+}
+
+Stmt* Ast_Cache::Find(std::string_view text, Arena& scratch, Stmt_Target* target) {
+  if(heads.empty())
+    return nullptr;
+  for(uint32_t k = Head(Hash(text)); k != ~0u; k = next[k]) {
+    const Entry* e = entries[k];
+    const char* stored = reinterpret_cast<const char*>(e + 1) + e->vars * sizeof(Var_Entry) + e->nodes * sizeof(Flat_Node);
+    if(e->length != text.size() || memcmp(stored, text.data(), text.size()))
+      continue;
+    if(!checked[k]) { // damaged on disk
+      if(Check(e) != e->check)
+	continue;
+      checked[k] = true;
+    }
+    if(!Resolve(e))
+      continue;
+    Expr* root = Build(e, scratch);
+    if(!root)
+      continue;
+    if(e->kind == 'e')
+      return scratch.Make<Expr_Stmt>(root);
+
+    const Var_Entry& var = reinterpret_cast<const Var_Entry*>(e + 1)[e->target];
+    const Type* type = var.type ? static_cast<const Type*>(&cxt->Int_) : &cxt->Bool_;
+    if(root->Check() != type)
+      continue;
+    if(e->kind == 'd') {
+      const char* names = stored + e->length;
+      const std::string_view name(names + var.name, var.length);
+      if(target)
+	*target = {name, type};
+      return scratch.Make<Decl_Stmt>(Parser::Declare(cxt, name, type, root), root);
+    }
+    if(e->kind == 'a') {
+      if(target)
+	*target = {resolved[e->target]->name, type};
+      return scratch.Make<Decl_Stmt>(Parser::Assign(cxt, resolved[e->target], root), root, true);
+    }
+  }
+  return nullptr;
+}
+
+void Ast_Cache::Add(std::string_view text, Stmt* s) {
+  Entry h = {};
+  Expr* root = nullptr;
+  const Var_Decl* target = nullptr;
+  if(Expr_Stmt* exp = dynamic_cast<Expr_Stmt*>(s)) {
+    root = exp->e;
+    h.kind = 'e';
+  }
+  else if(Decl_Stmt* dec = dynamic_cast<Decl_Stmt*>(s)) {
+    root = dec->e;
+    target = dynamic_cast<const Var_Decl*>(dec->d);
+    h.kind = dec->assign ? 'a' : 'd';
+  }
+  if(!root || (h.kind != 'e' && !target))
+    return;
+
+  h.hash = Hash(text);
+  int variants = 0;
+  for(uint32_t k = heads.empty() ? ~0u : Head(h.hash); k != ~0u; k = next[k])
+    ++variants;
+  if(variants >= Max_Variants)
+    return;
+
+  if(size_t(root->Weight()) > Flat_Tree::Max_Nodes)
+    return;
+  flat.Clear();
+  root->Flatten(flat);
+  names.clear();
+  vars.clear();
+  for(const Flat_Tree::Var& v : flat.vars) {
+    vars.push_back({uint32_t(names.size()), uint32_t(v.var->name.size()), v.value, v.var->type == &cxt->Int_, 'r'});
+    names.append(v.var->name);
+  }
+  h.target = ~0u;
+  if(target) {
+    h.target = uint32_t(vars.size());
+    vars.push_back({uint32_t(names.size()), uint32_t(target->name.size()), 0, target->type == &cxt->Int_, uint32_t(h.kind == 'a' ? 't' : 'n')});
+    names.append(target->name);
+  }
+  h.length = uint32_t(text.size());
+  h.vars = uint32_t(vars.size());
+  h.nodes = uint32_t(flat.nodes.size());
+  h.names = uint32_t(names.size());
+  const size_t bytes = sizeof h + vars.size() * sizeof(Var_Entry) + flat.nodes.size() * sizeof(Flat_Node) + text.size() + names.size();
+  h.bytes = uint32_t((bytes + 7) & ~size_t(7));
+
+  buffer.assign(reinterpret_cast<const char*>(&h), sizeof h);
+  buffer.append(reinterpret_cast<const char*>(vars.data()), vars.size() * sizeof(Var_Entry));
+  buffer.append(reinterpret_cast<const char*>(flat.nodes.data()), flat.nodes.size() * sizeof(Flat_Node));
+  buffer.append(text);
+  buffer.append(names);
+  buffer.resize(h.bytes, '\0');
+  h.check = Check(reinterpret_cast<const Entry*>(buffer.data()));
+  memcpy(&buffer[offsetof(Entry, check)], &h.check, sizeof h.check);
+
+  char* copy = static_cast<char*>(added.Allocate(buffer.size(), alignof(Entry)));
+  memcpy(copy, buffer.data(), buffer.size());
+  Index(reinterpret_cast<const Entry*>(copy));
+  out->sputn(buffer.data(), buffer.size());
+}
+
+#endif
@@ -4,59 +4,87 @@
 #include "type.hpp"
 #include "token.hpp"
 #include "decl.hpp"
+#include "arena.hpp"
+#include "intern.hpp"
+#include "symbols.hpp"
 
-#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <string_view>
+
+struct Journal; // see snapshot.hpp
 
 struct Context {
 
-  const Bool_Type Bool_; // bool type
-  const Int_Type Int_; // int type
+  inline static const Bool_Type Bool_{}; // bool type, shared by every context so that forks agree on types
+  inline static const Int_Type Int_{}; // int type
   char outputFormat; // output format for integers
-  std::unordered_map<std::string, Decl*> SymTable; // symbol table
+  char engine; // evaluation engine: 't' tree walker, 'v' bytecode VM, 'j' native code for --rows
+  char outputMode; // 'i' input & result, 'r' results only, 'j' a JSON object per statement
+  char ast = 't'; // how parsed trees are kept: 't' an object per node, 's' in a Node_Store
+  std::shared_ptr<Interner> names; // identifiers seen by the lexer, numbered densely; shared with forks
+  Symbol_Table SymTable; // symbol table: the declaration of each name by its number
+  Arena scratch; // per-statement allocations; reset after every statement
+  std::mutex* symbols = nullptr; // guards SymTable while statements run on several threads (see Parallel_Run)
+  Journal* journal = nullptr; // records each declaration and reassignment, if set; forks have none
+
+  Context(char _outputFormat, char _engine = 't', char _outputMode = 'i', std::shared_ptr<Interner> _names = nullptr)
+    : outputFormat(_outputFormat), engine(_engine), outputMode(_outputMode),
+      names(_names ? _names : std::make_shared<Interner>()) {} // constructor
+  Context* Fork(); // a child starting from this context's symbols
+  void InsertSymbol(Decl*);
+  Decl * FindSymbol(int id);
+  Decl * FindSymbol(std::string_view name); // by spelling, for names that were never lexed
+  bool OwnsSymbol(int id); // no fork shares the declaration, so it may change in place
+  void UpdateSymbol(int id, Decl*);
 
-  Context(char _outputFormat) : outputFormat(_outputFormat) {} // constructor
-  Token * CheckKeyword(const std::string);
-  Token * InsertSymbol(Decl*);
-  Decl * FindSymbol(const std::string);
-  void UpdateSymbol(const std::string, Decl*);
+private:
+  std::unique_lock<std::mutex> Lock() { return symbols ? std::unique_lock<std::mutex>(*symbols) : std::unique_lock<std::mutex>(); }
 };
 
-// Find keyword in keyword table
-Token * Context::CheckKeyword(const std::string str) {
-  Keyword_Table kws;
-  auto it = kws.find(str);
-  if(it != kws.end()) {
-    Token * t = new Id_Token(str, it->second);
-    return t;
-  }
-  return nullptr;
+// Returns a child context in O(1): it starts with every symbol this one has,
+// sharing them, and from then on neither sees the other's declarations or
+// reassignments. A reassignment copies just the declaration it changes and
+// the few table nodes above it.
+Context* Context::Fork() {
+  Context* child = new Context(outputFormat, engine, outputMode, names);
+  child->ast = ast;
+  auto lock = Lock();
+  child->SymTable = SymTable;
+  return child;
 }
 
 // Add symbol to symbol table
-Token * Context::InsertSymbol(Decl* d) {
-  const std::string name = d->getName();
-  auto it = SymTable.find(name);
-  if(it == SymTable.end())
-    SymTable.insert({name, d}); // only add when not already existing
-  return new Id_Token(name);
+void Context::InsertSymbol(Decl* d) {
+  auto lock = Lock();
+  if(!SymTable.Find(d->id)) // only add when not already existing
+    SymTable.Set(d->id, d);
 }
 
 // Find symbol in symbol table
-Decl * Context::FindSymbol(const std::string str) {
-  auto it = SymTable.find(str);
-  if(it != SymTable.end())
-    return it->second;
+Decl * Context::FindSymbol(int id) {
+  if(id < 0)
+    return nullptr; // a name never declared
+  auto lock = Lock();
+  return SymTable.Find(id);
+}
+
+Decl * Context::FindSymbol(std::string_view name) {
+  return FindSymbol(names->Find(name));
+}
 
-  return nullptr;
+bool Context::OwnsSymbol(int id) {
+  auto lock = Lock();
+  return SymTable.Owns(id);
 }
 
 // Change symbol in symbol table
-void Context::UpdateSymbol(const std::string str, Decl* d) {
-  auto it = SymTable.find(str);
-  if(it == SymTable.end())
+void Context::UpdateSymbol(int id, Decl* d) {
+  auto lock = Lock();
+  if(!SymTable.Find(id))
     throw std::runtime_error("Symbol does not exist. Could not update symbol.");
 
-  SymTable[str] = d;
+  SymTable.Set(id, d);
   return;
 }
 
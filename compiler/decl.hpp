@@ -6,12 +6,20 @@
 
 //#include "context.hpp"
 
+#include "arena.hpp"
+
+#include <atomic>
+#include <string>
+#include <string_view>
+
 struct Expr;
 struct Type;
 struct Context;
 
 struct Decl {
   Context* cxt;
+  int id; // number of the name (see Interner)
+  std::atomic<int> refs{0}; // symbol tables holding it (see Symbol_Table)
   virtual ~Decl() = default;
   virtual const std::string getName() = 0;
 };
@@ -20,11 +28,13 @@ struct Var_Decl : Decl {
   const Type* type; // type of expression stored
   Expr* init; // precomputed, evaluated expression
   Expr* fullInit; // non-reduced expression used for printing
-  const std::string name;
-  Var_Decl(Context* _cxt, const std::string n, const Type* t) : type(t), name(n) {
+  Arena storage; // long-lived region holding init & fullInit, sized to fit them; replaced on reassignment
+  std::string_view name; // held by the context's Interner
+  Var_Decl(Context* _cxt, int _id, std::string_view n, const Type* t) : type(t), name(n) {
     cxt = _cxt;
+    id = _id;
   }
-  const std::string getName() { return name; }
+  const std::string getName() { return std::string(name); }
 };
 
 #endif
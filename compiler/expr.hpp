@@ -3,14 +3,20 @@
 
 #include "type.hpp"
 #include "context.hpp"
+#include "jit.hpp"
+#include "filter.hpp"
+#include "flat.hpp"
+#include "format.hpp"
 
 #include <exception>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <iostream>
 #include <stdio.h>
 #include <limits>
 #include <algorithm>
+#include <vector>
 
 // Global - defining constant type objects to use for comparison and checks
 // const Bool_Type Bool_;
@@ -19,9 +25,68 @@
 
 struct Context;
 
+// Binding power of each kind of node, lowest first; the binary operators
+// are numbered as the parser's Binary_Precedence has them
+enum Precedence {
+  Prec_Cond, Prec_Or, Prec_And, Prec_Bit_Or, Prec_Bit_Xor, Prec_Bit_And,
+  Prec_Equality, Prec_Relational, Prec_Additive, Prec_Multiplicative,
+  Prec_Unary, Prec_Atom
+};
+
+// Opcode of each binary operator, by its Flat_Kind
+static const Opcode Binary_Opcodes[Flat_Kind_Count] = {
+  Op_Return, Op_Return, Op_Return, Op_Return, Op_Return, Op_Return, Op_Return, Op_Return,
+  Op_Bit_And, Op_Bit_Or, Op_Bit_Xor, Op_Equal, Op_Not_Equal,
+  Op_Less, Op_Greater, Op_Less_Equal, Op_Greater_Equal,
+  Op_Add, Op_Sub, Op_Mul, Op_Div, Op_Rem, Op_Return
+};
+
+// Text of each operator, between or before its operands
+static const std::string_view Operator_Text[Flat_Kind_Count] = {
+  "", "", "", "!", "~", "-",
+  " && ", " || ", " & ", " | ", " ^ ",
+  " == ", " != ", " < ", " > ", " <= ", " >= ",
+  " + ", " - ", " * ", " / ", " % ",
+  " ? "
+};
+
+// Applies a binary operator other than && and || to its operands' values
+inline Eval_Status Apply_Binary(uint32_t kind, int x, int y, int& r) {
+  switch(kind) {
+  case Flat_Bit_And: r = x & y; break;
+  case Flat_Bit_Or: r = x | y; break;
+  case Flat_Bit_Xor: r = x ^ y; break;
+  case Flat_Equal_Equal: r = x == y; break;
+  case Flat_Not_Equal: r = x != y; break;
+  case Flat_Less_Than: r = x < y; break;
+  case Flat_Greater_Than: r = x > y; break;
+  case Flat_Less_Than_Equal: r = x <= y; break;
+  case Flat_Greater_Than_Equal: r = x >= y; break;
+  case Flat_Add: return Checked_Add(x, y, r);
+  case Flat_Sub: return Checked_Sub(x, y, r);
+  case Flat_Mult: return Checked_Mul(x, y, r);
+  case Flat_Div: return Checked_Div(x, y, r);
+  case Flat_Rem: return Checked_Rem(x, y, r);
+  }
+  return Eval_Ok;
+}
+
+// A node of a checked expression tree. Each kind of node has its operands
+// (Child) and can copy itself (Copy); the walks over a whole tree (Eval,
+// Print_To, Clone, Lower, Flatten, Filter) are written once, below, and keep the
+// nodes they are partway through on a stack of their own, so the depth of
+// a tree is bounded by memory rather than by the call stack. Leaves, and a
+// Store_Expr, which stands for a whole tree, do each walk themselves.
+// Evaluation and printing, which are on the hot path, recurse (Value,
+// Print_Shallow) within subtrees small enough for the call stack and use
+// the stack above them.
 struct Expr {
+  static const int Shallow = 1024; // the most nodes Value and Print_Shallow take on at once
   const Type* ExprType; // Type ptr used in derived expressions; will point to a global type object
   Context* cxt;
+  int size = 1; // nodes in the subtree, counted when it is built
+  unsigned char prec = Prec_Atom; // binding power of the node's operator
+  unsigned char kind = Flat_Kind_Count; // the operator, a Flat_Kind; Flat_Kind_Count for a Store_Expr
   
   const std::string& GetTypeError() {
     static std::string TypeError("Invalid expression type.");
@@ -39,19 +104,34 @@ struct Expr {
   }
   
   virtual ~Expr() = default; // virtual destructor
-  virtual int Weight() = 0; // Weight of expression + Weight of branch expressions
-  virtual int Eval() = 0; // Meaning of the expression; for Bool types return 0,1 for false,true
-  virtual std::string Print() = 0;
+  int Eval(); // Meaning of the expression; for Bool types return 0,1 for false,true
+  virtual int Value() = 0; // Eval by a call per node, for a tree of up to Shallow nodes
+  virtual void Print_To(std::string& out); // Appends the expression's text
+  virtual Expr* Copy(Arena&) = 0; // The node alone, with the operands of the original
+  virtual Expr*& Child(int); // Operand i of the node's Arity()
+  virtual int Lower(Compiler&, int); // Emits bytecode; returns the register holding the value
+  virtual int Filter(Filter_Plan&); // Adds a bool expression to a predicate; returns its node
+  virtual int Flatten(Flat_Tree&); // Adds the tree to a flat array, operands first; returns its node
+  Expr* Clone(Arena&); // Deep copy of the expression into the given region
+  void Print_Shallow(std::string& out); // Print_To by a call per node, for a tree of up to Shallow nodes
+  int Arity() const { return kind <= Flat_Var_Ref || kind == Flat_Kind_Count ? 0 : kind <= Flat_Neg ? 1 : kind == Flat_Cond ? 3 : 2; }
   const Type* Check() { return ExprType; } // Returns expression type
-  std::string Evaluate() {
+  int Weight() const { return size; } // Weight of expression + Weight of branch expressions
+  std::string Print() { std::string out; Print_To(out); return out; } // the whole text in one pass
+  void Evaluate(std::ostream& out) { Write_Value(Run(), out); } // writes the value, formatted without going through a string
+  void Write_Value(int value, std::ostream& out) {
     if(Check() == &(cxt->Bool_))
-      return Eval() ? "true" : "false";
-    else if(Check() == &(cxt->Int_))
-      return FormatInt(Eval());
+      out << (value ? "true" : "false");
+    else if(Check() == &(cxt->Int_)) {
+      char buf[Int_Chars];
+      out.write(buf, Format_Int(buf, value, cxt->outputFormat));
+    }
     else
       throw std::runtime_error(GetUndefBehavError());
   }
-  Expr* Precompute();
+  int Run(); // Eval using the engine selected in the context
+  int Checked(Eval_Status, int value); // the value, or the error as an exception
+  Expr* Precompute(Arena&);
   std::string FormatInt(int value);
 };
 
@@ -63,12 +143,16 @@ private:
 public:
   Bool_Expr(bool _value, Context* _cxt) : value(_value) {
     cxt = _cxt;
+    kind = Flat_Bool;
     ExprType = &(cxt->Bool_);
   } // initialize value & type
 
-  int Weight() { return 1; }
-  int Eval() { return value; } // returns value as int
-  std::string Print() { return value ? "true" : "false"; }
+  Expr* Copy(Arena& a) { return a.Make<Bool_Expr>(*this); }
+  int Flatten(Flat_Tree& f) { return f.Add(Flat_Bool, value); }
+  int Lower(Compiler& c, int) { return c.Constant(value); }
+  int Filter(Filter_Plan& p) { return p.Constant(value); }
+  int Value() { return value; } // returns value as int
+  void Print_To(std::string& out) { out += value ? "true" : "false"; }
 };
 
 struct Int_Expr : Expr {
@@ -79,13 +163,44 @@ private:
 public:
   Int_Expr(int _value, Context* _cxt) : value(_value) {
     cxt = _cxt;
+    kind = Flat_Int;
     ExprType = &(cxt->Int_);
   } // initialize value & type
 
-  int Weight() { return 1; }
-  int Eval() { return value; }
-  std::string Print() {
-    return FormatInt(value);
+  Expr* Copy(Arena& a) { return a.Make<Int_Expr>(*this); }
+  int Flatten(Flat_Tree& f) { return f.Add(Flat_Int, value); }
+  int Lower(Compiler& c, int) { return c.Constant(value); }
+  int Value() { return value; }
+  void Print_To(std::string& out) {
+    char buf[Int_Chars];
+    out.append(buf, Format_Int(buf, value, cxt->outputFormat));
+  }
+};
+
+struct Var_Ref : Expr {
+  // variable reference; holds the value the variable had when parsed
+private:
+  Var_Decl * var;
+  int value;
+
+public:
+  Var_Ref(Var_Decl* _var, int _value, Context* _cxt) : var(_var), value(_value) {
+    cxt = _cxt;
+    kind = Flat_Var_Ref;
+    ExprType = var->type;
+  } // initialize variable, value & type
+
+  Expr* Copy(Arena& a) { return a.Make<Var_Ref>(*this); }
+  int Flatten(Flat_Tree& f) { return f.Add(Flat_Var_Ref, f.Variable(var, var->id, value)); }
+  int Lower(Compiler& c, int dst) { return c.Variable(var, value, dst); }
+  int Value() { return value; }
+  void Print_To(std::string& out) {
+    if(ExprType == &(cxt->Bool_))
+      out += value ? "true" : "false";
+    else {
+      char buf[Int_Chars];
+      out.append(buf, Format_Int(buf, value, cxt->outputFormat));
+    }
   }
 };
 
@@ -97,19 +212,18 @@ private:
 public:
   And_Expr(Expr * _e1, Expr * _e2, Context* _cxt) : e1(_e1), e2(_e2) {
     cxt = _cxt;
+    size = 1 + e1->size + e2->size;
+    prec = Prec_And;
+    kind = Flat_And;
     if ((e1->Check() == &(cxt->Bool_)) && (e2->Check() == &(cxt->Bool_)))
       ExprType = &(cxt->Bool_); // Expression type of bool
     else
       throw std::runtime_error(GetTypeError());
   } // initialize args and confirm they are well-typed
   
-  int Weight() { return 1 + e1->Weight() + e2->Weight(); }
-  int Eval() { return e1->Eval() ?  e2->Eval() : false; }
-  std::string Print() {
-    return (e1->Weight() == 1 ? e1->Print() : ("(" + e1->Print() + ")"))
-      + " && " +
-      (e2->Weight() == 1 ? e2->Print() : ("(" + e2->Print() + ")"));
-  }
+  Expr* Copy(Arena& a) { return a.Make<And_Expr>(*this); }
+  Expr*& Child(int i) { return i ? e2 : e1; }
+  int Value() { return e1->Value() ?  e2->Value() : false; }
 };
 
 struct Or_Expr : Expr {
@@ -120,19 +234,18 @@ private:
 public:
   Or_Expr(Expr * _e1, Expr * _e2, Context* _cxt) : e1(_e1), e2(_e2) {
     cxt = _cxt;
+    size = 1 + e1->size + e2->size;
+    prec = Prec_Or;
+    kind = Flat_Or;
     if ((e1->Check() == &(cxt->Bool_)) && (e2->Check() == &(cxt->Bool_)))
       ExprType = &(cxt->Bool_); // Expression type of bool
     else
       throw std::runtime_error(GetTypeError());
   } // initialize args and confirm they are well-typed
 
-  int Weight() { return 1 + e1->Weight() + e2->Weight(); }
-  int Eval() { return e1->Eval() ? true : e2->Eval(); }
-  std::string Print() {
-    return (e1->Weight() == 1 ? e1->Print() : ("(" + e1->Print() + ")"))
-      + " || " +
-      (e2->Weight() == 1 ? e2->Print() : ("(" + e2->Print() + ")"));
-  }
+  Expr* Copy(Arena& a) { return a.Make<Or_Expr>(*this); }
+  Expr*& Child(int i) { return i ? e2 : e1; }
+  int Value() { return e1->Value() ? true : e2->Value(); }
 };
 
 
@@ -144,15 +257,18 @@ private:
 public:
   Not_Expr(Expr * _e, Context* _cxt) : e(_e) {
     cxt = _cxt;
+    size = 1 + e->size;
+    prec = Prec_Unary;
+    kind = Flat_Not;
     if(e->Check() == &(cxt->Bool_))
       ExprType = &(cxt->Bool_); // Expression type of bool
     else
       throw std::runtime_error(GetTypeError());
   } // initialize arg and confirm it is well-typed
 
-  int Weight() { return 1 + e->Weight(); }
-  int Eval() { return !(e->Eval()); }
-  std::string Print() { return "!" + (e->Weight() == 1 ? e->Print() : ("(" + e->Print() + ")")); }
+  Expr* Copy(Arena& a) { return a.Make<Not_Expr>(*this); }
+  Expr*& Child(int) { return e; }
+  int Value() { return !(e->Value()); }
 };
 
 struct Bit_And_Expr : Expr {
@@ -163,19 +279,18 @@ private:
 public:
   Bit_And_Expr(Expr * _e1, Expr *_e2, Context* _cxt) : e1(_e1), e2(_e2) {
     cxt = _cxt;
+    size = 1 + e1->size + e2->size;
+    prec = Prec_Bit_And;
+    kind = Flat_Bit_And;
     if(e1->Check() == e2->Check())
       ExprType = e1->Check(); // Expression type matching that of e1 & e2
     else
       throw std::runtime_error(GetTypeError());
   } // initialize args and confirm they are well-typed
 
-  int Weight() { return 1 + e1->Weight() + e2->Weight(); }
-  int Eval() { return e1->Eval() & e2->Eval(); }
-  std::string Print() {
-    return (e1->Weight() == 1 ? e1->Print() : ("(" + e1->Print() + ")"))
-      + " & " +
-      (e2->Weight() == 1 ? e2->Print() : ("(" + e2->Print() + ")"));
-  }
+  Expr* Copy(Arena& a) { return a.Make<Bit_And_Expr>(*this); }
+  Expr*& Child(int i) { return i ? e2 : e1; }
+  int Value() { return e1->Value() & e2->Value(); }
 };
 
 struct Bit_Or_Expr : Expr {
@@ -186,19 +301,18 @@ private:
 public:
   Bit_Or_Expr(Expr * _e1, Expr * _e2, Context* _cxt) : e1(_e1), e2(_e2) {
     cxt = _cxt;
+    size = 1 + e1->size + e2->size;
+    prec = Prec_Bit_Or;
+    kind = Flat_Bit_Or;
     if(e1->Check() == e2->Check())
       ExprType = e1->Check(); // Expression type matching that of e1 & e2
     else
       throw std::runtime_error(GetTypeError());
   } // initialize args and confirm they are well-typed
 
-  int Weight() { return 1 + e1->Weight() + e2->Weight(); }
-  int Eval() { return e1->Eval() | e2->Eval(); }
-  std::string Print() {
-    return (e1->Weight() == 1 ? e1->Print() : ("(" + e1->Print() + ")"))
-      + " | " +
-      (e2->Weight() == 1 ? e2->Print() : ("(" + e2->Print() + ")"));
-  }
+  Expr* Copy(Arena& a) { return a.Make<Bit_Or_Expr>(*this); }
+  Expr*& Child(int i) { return i ? e2 : e1; }
+  int Value() { return e1->Value() | e2->Value(); }
 };
 
 struct Bit_Xor_Expr : Expr {
@@ -209,19 +323,18 @@ private:
 public:
   Bit_Xor_Expr(Expr * _e1, Expr * _e2, Context* _cxt) : e1(_e1), e2(_e2) {
     cxt = _cxt;
+    size = 1 + e1->size + e2->size;
+    prec = Prec_Bit_Xor;
+    kind = Flat_Bit_Xor;
     if(e1->Check() == e2->Check())
       ExprType = e1->Check(); // Expression type matching that of e1 & e2
     else
       throw std::runtime_error(GetTypeError());
   } // initialize args and confirm they are well-typed
   
-  int Weight() { return 1 + e1->Weight() + e2->Weight(); }
-  int Eval() { return e1->Eval() ^ e2->Eval(); }
-  std::string Print() {
-    return (e1->Weight() == 1 ? e1->Print() : ("(" + e1->Print() + ")"))
-      + " ^ " +
-      (e2->Weight() == 1 ? e2->Print() : ("(" + e2->Print() + ")"));
-  }
+  Expr* Copy(Arena& a) { return a.Make<Bit_Xor_Expr>(*this); }
+  Expr*& Child(int i) { return i ? e2 : e1; }
+  int Value() { return e1->Value() ^ e2->Value(); }
 };
 
 struct Bit_Comp_Expr : Expr {
@@ -232,12 +345,15 @@ private:
 public:
   Bit_Comp_Expr(Expr * _e, Context* _cxt) : e(_e) {
     cxt = _cxt;
+    size = 1 + e->size;
+    prec = Prec_Unary;
+    kind = Flat_Bit_Comp;
     ExprType = e->Check(); // Expression type matching that of e
   }
 
-  int Weight() { return 1 + e->Weight(); }
-  int Eval() { return ExprType == &(cxt->Bool_) ? (e->Eval() ? 0 : 1) : ~(e->Eval()); }
-  std::string Print() { return "~" + (e->Weight() == 1 ? e->Print() : ("(" + e->Print() + ")")); }
+  Expr* Copy(Arena& a) { return a.Make<Bit_Comp_Expr>(*this); }
+  Expr*& Child(int) { return e; }
+  int Value() { return ExprType == &(cxt->Bool_) ? (e->Value() ? 0 : 1) : ~(e->Value()); }
 };
 
 struct Cond_Expr : Expr {
@@ -248,21 +364,18 @@ private:
 public:
   Cond_Expr(Expr * _e1, Expr * _e2, Expr * _e3, Context* _cxt) : e1(_e1), e2(_e2), e3(_e3) {
     cxt = _cxt;
+    size = 1 + e1->size + e2->size + e3->size;
+    prec = Prec_Cond;
+    kind = Flat_Cond;
     if((e1->Check() == &(cxt->Bool_)) && (e2->Check() == e3->Check()))
       ExprType = e2->Check(); // Expression type matching that of e2 & e3
     else
       throw std::runtime_error(GetTypeError());
   } // initialize args and confirm they are well-typed
 
-  int Weight() { return 1 + e1->Weight() + e2->Weight() + e3->Weight(); }
-  int Eval() { return e1->Eval() ? e2->Eval() : e3->Eval(); }
-  std::string Print() {
-    return (e1->Weight() == 1 ? e1->Print() : ("(" + e1->Print() + ")"))
-      + " ? " +
-      (e2->Weight() == 1 ? e2->Print() : ("(" + e2->Print() + ")"))
-      + " : " +
-      (e3->Weight() == 1 ? e3->Print() : ("(" + e3->Print() + ")"));
-  }
+  Expr* Copy(Arena& a) { return a.Make<Cond_Expr>(*this); }
+  Expr*& Child(int i) { return i == 0 ? e1 : i == 1 ? e2 : e3; }
+  int Value() { return e1->Value() ? e2->Value() : e3->Value(); }
 };
 
 struct Equal_Equal_Expr : Expr {
@@ -273,19 +386,18 @@ private:
 public:
   Equal_Equal_Expr(Expr* _e1, Expr* _e2, Context* _cxt) : e1(_e1), e2(_e2) {
     cxt = _cxt;
+    size = 1 + e1->size + e2->size;
+    prec = Prec_Equality;
+    kind = Flat_Equal_Equal;
     if(e1->Check() == e2->Check())
       ExprType = &(cxt->Bool_); // Expression type of bool
     else
       throw std::runtime_error(GetTypeError());
   } // initialize args and confirm they are well-typed
 
-  int Weight() { return 1 + e1->Weight() + e2->Weight(); }
-  int Eval() { return e1->Eval() == e2->Eval(); }
-  std::string Print() {
-    return (e1->Weight() == 1 ? e1->Print() : ("(" + e1->Print() + ")"))
-      + " == " +
-      (e2->Weight() == 1 ? e2->Print() : ("(" + e2->Print() + ")"));
-  }
+  Expr* Copy(Arena& a) { return a.Make<Equal_Equal_Expr>(*this); }
+  Expr*& Child(int i) { return i ? e2 : e1; }
+  int Value() { return e1->Value() == e2->Value(); }
 };
 
 struct Not_Equal_Expr : Expr {
@@ -296,19 +408,18 @@ private:
 public:
   Not_Equal_Expr(Expr* _e1, Expr* _e2, Context* _cxt) : e1(_e1), e2(_e2) {
     cxt = _cxt;
+    size = 1 + e1->size + e2->size;
+    prec = Prec_Equality;
+    kind = Flat_Not_Equal;
     if(e1->Check() == e2->Check())
       ExprType = &(cxt->Bool_); // Expression type of bool
     else
       throw std::runtime_error(GetTypeError());
   } // initialize args and confirm they are well-typed
 
-  int Weight() { return 1 + e1->Weight() + e2->Weight(); }
-  int Eval() { return e1->Eval() != e2->Eval(); }
-  std::string Print() {
-    return (e1->Weight() == 1 ? e1->Print() : ("(" + e1->Print() + ")"))
-      + " != " +
-      (e2->Weight() == 1 ? e2->Print() : ("(" + e2->Print() + ")"));
-  }
+  Expr* Copy(Arena& a) { return a.Make<Not_Equal_Expr>(*this); }
+  Expr*& Child(int i) { return i ? e2 : e1; }
+  int Value() { return e1->Value() != e2->Value(); }
 };
 
 struct Less_Than_Expr : Expr {
@@ -319,19 +430,18 @@ private:
 public:
   Less_Than_Expr(Expr* _e1, Expr* _e2, Context* _cxt) : e1(_e1), e2(_e2) {
     cxt = _cxt;
+    size = 1 + e1->size + e2->size;
+    prec = Prec_Relational;
+    kind = Flat_Less_Than;
     if((e1->Check() == &(cxt->Int_)) && (e2->Check() == &(cxt->Int_)))
       ExprType = &(cxt->Bool_); // Expression type of bool
     else
       throw std::runtime_error(GetTypeError());
   } // initialize args and confirm they are well-typed
 
-  int Weight() { return 1 + e1->Weight() + e2->Weight(); }
-  int Eval() { return e1->Eval() < e2->Eval(); }
-  std::string Print() {
-    return (e1->Weight() == 1 ? e1->Print() : ("(" + e1->Print() + ")"))
-      + " < " +
-      (e2->Weight() == 1 ? e2->Print() : ("(" + e2->Print() + ")"));
-  }
+  Expr* Copy(Arena& a) { return a.Make<Less_Than_Expr>(*this); }
+  Expr*& Child(int i) { return i ? e2 : e1; }
+  int Value() { return e1->Value() < e2->Value(); }
 };
 
 struct Greater_Than_Expr : Expr {
@@ -342,19 +452,18 @@ private:
 public:
   Greater_Than_Expr(Expr* _e1, Expr* _e2, Context* _cxt) : e1(_e1), e2(_e2) {
     cxt = _cxt;
+    size = 1 + e1->size + e2->size;
+    prec = Prec_Relational;
+    kind = Flat_Greater_Than;
     if((e1->Check() == &(cxt->Int_)) && (e2->Check() == &(cxt->Int_)))
       ExprType = &(cxt->Bool_); // Expression type of bool
     else
       throw std::runtime_error(GetTypeError());
   } // initialize args and confirm they are well-typed
 
-  int Weight() { return 1 + e1->Weight() + e2->Weight(); }
-  int Eval() { return e1->Eval() > e2->Eval(); }
-  std::string Print() {
-    return (e1->Weight() == 1 ? e1->Print() : ("(" + e1->Print() + ")"))
-      + " > " +
-      (e2->Weight() == 1 ? e2->Print() : ("(" + e2->Print() + ")"));
-  }
+  Expr* Copy(Arena& a) { return a.Make<Greater_Than_Expr>(*this); }
+  Expr*& Child(int i) { return i ? e2 : e1; }
+  int Value() { return e1->Value() > e2->Value(); }
 };
 
 struct Less_Than_Equal_Expr : Expr {
@@ -365,19 +474,18 @@ private:
 public:
   Less_Than_Equal_Expr(Expr* _e1, Expr* _e2, Context* _cxt) : e1(_e1), e2(_e2) {
     cxt = _cxt;
+    size = 1 + e1->size + e2->size;
+    prec = Prec_Relational;
+    kind = Flat_Less_Than_Equal;
     if((e1->Check() == &(cxt->Int_)) && (e2->Check() == &(cxt->Int_)))
       ExprType = &(cxt->Bool_); // Expression type of bool
     else
       throw std::runtime_error(GetTypeError());
   } // initialize args and confirm they are well-typed
 
-  int Weight() { return 1 + e1->Weight() + e2->Weight(); }
-  int Eval() { return e1->Eval() <= e2->Eval(); }
-  std::string Print() {
-    return (e1->Weight() == 1 ? e1->Print() : ("(" + e1->Print() + ")"))
-      + " <= " +
-      (e2->Weight() == 1 ? e2->Print() : ("(" + e2->Print() + ")"));
-  }
+  Expr* Copy(Arena& a) { return a.Make<Less_Than_Equal_Expr>(*this); }
+  Expr*& Child(int i) { return i ? e2 : e1; }
+  int Value() { return e1->Value() <= e2->Value(); }
 };
 
 struct Greater_Than_Equal_Expr : Expr {
@@ -388,19 +496,18 @@ private:
 public:
   Greater_Than_Equal_Expr(Expr* _e1, Expr* _e2, Context* _cxt) : e1(_e1), e2(_e2) {
     cxt = _cxt;
+    size = 1 + e1->size + e2->size;
+    prec = Prec_Relational;
+    kind = Flat_Greater_Than_Equal;
     if((e1->Check() == &(cxt->Int_)) && (e2->Check() == &(cxt->Int_)))
       ExprType = &(cxt->Bool_); // Expression type of bool
     else
       throw std::runtime_error(GetTypeError());
   } // initialize args and confirm they are well-typed
 
-  int Weight() { return 1 + e1->Weight() + e2->Weight(); }
-  int Eval() { return e1->Eval() >= e2->Eval(); }
-  std::string Print() {
-    return (e1->Weight() == 1 ? e1->Print() : ("(" + e1->Print() + ")"))
-      + " >= " +
-      (e2->Weight() == 1 ? e2->Print() : ("(" + e2->Print() + ")"));
-  }
+  Expr* Copy(Arena& a) { return a.Make<Greater_Than_Equal_Expr>(*this); }
+  Expr*& Child(int i) { return i ? e2 : e1; }
+  int Value() { return e1->Value() >= e2->Value(); }
 };
 
 struct Add_Expr : Expr {
@@ -411,33 +518,26 @@ private:
 public:
   Add_Expr(Expr* _e1, Expr* _e2, Context* _cxt) : e1(_e1), e2(_e2) {
     cxt = _cxt;
+    size = 1 + e1->size + e2->size;
+    prec = Prec_Additive;
+    kind = Flat_Add;
     if((e1->Check() == &(cxt->Int_)) && (e2->Check() == &(cxt->Int_)))
       ExprType = &(cxt->Int_); // Expression type of int
     else
       throw std::runtime_error(GetTypeError());    
   } // initialize args and confirm they are well-typed
 
-  int Weight() { return 1 + e1->Weight() + e2->Weight(); }
-  int Eval() {
-    int _e1 = e1->Eval();
-    int _e2 = e2->Eval();
-
-    // e1 & e2 positive; sum could exceed maximum value of int
-    if ((_e1 > 0 && _e2 > 0) && (std::numeric_limits<int>::max() - _e2 < _e1))
-      throw std::runtime_error(GetOverflowIntError());
-
-    // e1 & e2 negative; sum could exceed minimum value of int
-    if ((_e1 < 0 && _e2 < 0) && (std::numeric_limits<int>::min() - _e2 > _e1))
+  Expr* Copy(Arena& a) { return a.Make<Add_Expr>(*this); }
+  Expr*& Child(int i) { return i ? e2 : e1; }
+  int Value() {
+    int _e1 = e1->Value();
+    int _e2 = e2->Value(); // e1 is always evaluated first
+    int r;
+    if(Checked_Add(_e1, _e2, r))
       throw std::runtime_error(GetOverflowIntError());
-    
-    return _e1 + _e2;
+    return r;
   }
 
-  std::string Print() {
-    return (e1->Weight() == 1 ? e1->Print() : ("(" + e1->Print() + ")"))
-      + " + " +
-      (e2->Weight() == 1 ? e2->Print() : ("(" + e2->Print() + ")"));
-  }
 };
 
 struct Sub_Expr : Expr {
@@ -448,33 +548,26 @@ private:
 public:
   Sub_Expr(Expr* _e1, Expr* _e2, Context* _cxt) : e1(_e1), e2(_e2) {
     cxt = _cxt;
+    size = 1 + e1->size + e2->size;
+    prec = Prec_Additive;
+    kind = Flat_Sub;
     if((e1->Check() == &(cxt->Int_)) && (e2->Check() == &(cxt->Int_)))
       ExprType = &(cxt->Int_); // Expression type of int
     else
       throw std::runtime_error(GetTypeError());
   } // initialize args and confirm they are well-typed
 
-  int Weight() { return 1 + e1->Weight() + e2->Weight(); }
-  int Eval() {
-    int _e1 = e1->Eval();
-    int _e2 = e2->Eval();
-    
-    // e1 negative, e2 positive; diff could exceed minimum value of int
-    if ((_e1 < 0 && _e2 > 0) && (std::numeric_limits<int>::min() + _e2 > _e1))
-      throw std::runtime_error(GetOverflowIntError()); 
-
-    // e1 positive, e2 negative; diff could exceed maximum value of int
-    if ((_e1 > 0 && _e2 < 0) && (std::numeric_limits<int>::max() + _e2 < _e1))
+  Expr* Copy(Arena& a) { return a.Make<Sub_Expr>(*this); }
+  Expr*& Child(int i) { return i ? e2 : e1; }
+  int Value() {
+    int _e1 = e1->Value();
+    int _e2 = e2->Value(); // e1 is always evaluated first
+    int r;
+    if(Checked_Sub(_e1, _e2, r))
       throw std::runtime_error(GetOverflowIntError());
-
-    return _e1 - _e2;
+    return r;
   }
 
-  std::string Print() {
-    return (e1->Weight() == 1 ? e1->Print() : ("(" + e1->Print() + ")"))
-      + " - " +
-      (e2->Weight() == 1 ? e2->Print() : ("(" + e2->Print() + ")"));
-  }
 };
 
 struct Mult_Expr : Expr {
@@ -485,41 +578,24 @@ private:
 public:
   Mult_Expr(Expr* _e1, Expr* _e2, Context* _cxt) : e1(_e1), e2(_e2) {
     cxt = _cxt;
+    size = 1 + e1->size + e2->size;
+    prec = Prec_Multiplicative;
+    kind = Flat_Mult;
     if((e1->Check() == &(cxt->Int_)) && (e2->Check() == &(cxt->Int_)))
       ExprType = &(cxt->Int_);
     else
       throw std::runtime_error(GetTypeError());
   } // initialize args and confirm they are well-typed
 
-  int Weight() { return 1 + e1->Weight() + e2->Weight(); }
-  int Eval() {
-    int _e1 = e1->Eval();
-    int _e2 = e2->Eval();
-
-    // these three checks allow testing for overflow using division
-    if (_e1 == 0 || _e2 == 0)
-      return 0;
-    if (_e1 == -1)
-      return -_e2;
-    if (_e2 == -1)
-      return -_e1;
-
-    // e1 & e2 are the same sign; product could exceed maximum value of int
-    if (((_e1 > 0 && _e2 > 0) || (_e1 < 0 && _e2 < 0))
-	&& (std::numeric_limits<int>::max() /  _e2 < _e1))
-      throw std::runtime_error(GetOverflowIntError());
-
-    // e1 & e2 are different signs; product could exceed minimum value of int
-    if (((_e1 < 0 && _e2 > 0) && (std::numeric_limits<int>::min() / _e2 > _e1)) ||
-	((_e1 > 0 && _e2 < 0) && (std::numeric_limits<int>::min() / _e1 > _e2)))
+  Expr* Copy(Arena& a) { return a.Make<Mult_Expr>(*this); }
+  Expr*& Child(int i) { return i ? e2 : e1; }
+  int Value() {
+    int _e1 = e1->Value();
+    int _e2 = e2->Value(); // e1 is always evaluated first
+    int r;
+    if(Checked_Mul(_e1, _e2, r))
       throw std::runtime_error(GetOverflowIntError());
-    
-    return _e1 * _e2;
-  }
-  std::string Print() {
-    return (e1->Weight() == 1 ? e1->Print() : ("(" + e1->Print() + ")"))
-      + " * " +
-      (e2->Weight() == 1 ? e2->Print() : ("(" + e2->Print() + ")"));
+    return r;
   }
 };
 
@@ -531,29 +607,24 @@ private:
 public:
   Div_Expr(Expr* _e1, Expr* _e2, Context* _cxt) : e1(_e1), e2(_e2) {
     cxt = _cxt;
+    size = 1 + e1->size + e2->size;
+    prec = Prec_Multiplicative;
+    kind = Flat_Div;
     if((e1->Check() == &(cxt->Int_)) && (e2->Check() == &(cxt->Int_)))
       ExprType = &(cxt->Int_); // Expression type of int
     else
       throw std::runtime_error(GetTypeError());
   } // initialize args and confirm they are well-typed
 
-  int Weight() { return 1 + e1->Weight() + e2->Weight(); }
-  int Eval() {
-    int _e1 = e1->Eval();
-    int _e2 = e2->Eval();
-
-    // dividing any number by zero or the min will be undefined
-    // dividing the minimum value of int by -1 will overflow
-    if (_e2 == 0 || _e2 == std::numeric_limits<int>::min() ||
-	(_e1 == std::numeric_limits<int>::min() && _e2 == -1))
+  Expr* Copy(Arena& a) { return a.Make<Div_Expr>(*this); }
+  Expr*& Child(int i) { return i ? e2 : e1; }
+  int Value() {
+    int _e1 = e1->Value();
+    int _e2 = e2->Value(); // e1 is always evaluated first
+    int r;
+    if(Checked_Div(_e1, _e2, r))
       throw std::runtime_error(GetUndefBehavError());
-    
-    return _e1 / _e2;
-  }
-  std::string Print() {
-    return (e1->Weight() == 1 ? e1->Print() : ("(" + e1->Print() + ")"))
-      + " / " +
-      (e2->Weight() == 1 ? e2->Print() : ("(" + e2->Print() + ")"));
+    return r;
   }
 };
 
@@ -565,29 +636,24 @@ private:
 public:
   Rem_Expr(Expr* _e1, Expr* _e2, Context* _cxt) : e1(_e1), e2(_e2) {
     cxt = _cxt;
+    size = 1 + e1->size + e2->size;
+    prec = Prec_Multiplicative;
+    kind = Flat_Rem;
     if((e1->Check() == &(cxt->Int_)) && (e2->Check() == &(cxt->Int_)))
       ExprType = &(cxt->Int_); // Expression type of int
     else
       throw std::runtime_error(GetTypeError());
   } // initialize args and confirm they are well-typed
 
-  int Weight() { return 1 + e1->Weight() + e2->Weight(); }
-  int Eval() {
-    int _e1 = e1->Eval();
-    int _e2 = e2->Eval();
-
-    // dividing any number by zero or the min will be undefined
-    // dividing the minimum value of int by -1 will overflow
-    if (_e2 == 0 || _e2 == std::numeric_limits<int>::min() ||
-	(_e1 == std::numeric_limits<int>::min() && _e2 == -1))
+  Expr* Copy(Arena& a) { return a.Make<Rem_Expr>(*this); }
+  Expr*& Child(int i) { return i ? e2 : e1; }
+  int Value() {
+    int _e1 = e1->Value();
+    int _e2 = e2->Value(); // e1 is always evaluated first
+    int r;
+    if(Checked_Rem(_e1, _e2, r))
       throw std::runtime_error(GetUndefBehavError());
-    
-    return _e1 % _e2;
-  }
-  std::string Print() {
-    return (e1->Weight() == 1 ? e1->Print() : ("(" + e1->Print() + ")"))
-      + " % " +
-      (e2->Weight() == 1 ? e2->Print() : ("(" + e2->Print() + ")"));
+    return r;
   }
 };
 
@@ -599,61 +665,444 @@ private:
 public:
   Neg_Expr(Expr* _e, Context* _cxt) : e(_e) {
     cxt = _cxt;
+    size = 1 + e->size;
+    prec = Prec_Unary;
+    kind = Flat_Neg;
     if(e->Check() == &(cxt->Int_))
       ExprType = &(cxt->Int_); // Expression type of int
     else
       throw std::runtime_error(GetTypeError());
   } // initialize arg and confirm it is well-typed
 
-  int Weight() { return 1 + e->Weight(); }
-  int Eval() {
-    int _e = e->Eval();
-
-    // attempting to invert the sign of the minimum value of int will overflow
-    if (_e == std::numeric_limits<int>::min())
+  Expr* Copy(Arena& a) { return a.Make<Neg_Expr>(*this); }
+  Expr*& Child(int) { return e; }
+  int Value() {
+    int r;
+    if(Checked_Neg(e->Value(), r))
       throw std::runtime_error(GetOverflowIntError());
-    
-    return -_e;
+    return r;
   }
-  std::string Print() { return "-" + (e->Weight() == 1 ? e->Print() : ("(" + e->Print() + ")")); }
 };
 
 std::string Expr::FormatInt(int value) {
-  switch(cxt->outputFormat) {
-  case 'd':
-    return std::to_string(value);
-  case 'h': {
-    std::stringstream ss;
-    ss << (value < 0 ? "-" : "") << "0x" << std::hex << (value < 0 ? -value : value);
-    return ss.str();
+  return Format_Int(value, cxt->outputFormat);
+}
+
+// Operand i of a node; leaves have none
+Expr*& Expr::Child(int) {
+  throw std::logic_error("A leaf has no operands.");
+}
+
+// Evaluates the tree as Value would, in the same order, taking only the
+// side of &&, || and ?: that is needed and stopping at the first error.
+// Above Shallow nodes, each entry on the stack is a node partway through:
+// stage counts the operands it has had, and saved holds the value of the
+// first. The value of the node or subtree finished last is in ret.
+int Expr::Eval() {
+  if(size <= Shallow || !Arity())
+    return Value();
+
+  struct Item {
+    Expr* e;
+    int stage;
+    int saved;
+  };
+  static thread_local std::vector<Item> items; // reused, as this runs for every row of --rows
+  std::vector<Item>& stack = items;
+  const size_t base = stack.size();
+  int ret = 0;
+  Eval_Status status = Eval_Ok;
+
+  stack.push_back({this, 0, 0});
+  try {
+    while(stack.size() > base && !status) {
+      Item& it = stack.back();
+      Expr* const e = it.e;
+      const int stage = it.stage++;
+      Expr* next = nullptr; // an operand to evaluate before coming back to e
+      switch(e->kind) {
+      case Flat_Not:
+      case Flat_Bit_Comp:
+      case Flat_Neg:
+	if(stage == 0)
+	  next = e->Child(0);
+	else if(e->kind == Flat_Neg)
+	  status = Checked_Neg(ret, ret);
+	else if(e->kind == Flat_Bit_Comp && e->ExprType == &(cxt->Int_))
+	  ret = ~ret;
+	else
+	  ret = !ret;
+	break;
+      case Flat_And: // false && e2 is false
+	if(stage == 0 || (stage == 1 && ret))
+	  next = e->Child(stage);
+	break;
+      case Flat_Or: // true || e2 is true
+	if(stage == 0 || (stage == 1 && !ret))
+	  next = e->Child(stage);
+	else if(stage == 1)
+	  ret = true;
+	break;
+      case Flat_Cond:
+	if(stage == 0)
+	  next = e->Child(0);
+	else if(stage == 1)
+	  next = e->Child(ret ? 1 : 2);
+	break;
+      default: // e1 is always evaluated first
+	if(stage == 0)
+	  next = e->Child(0);
+	else if(stage == 1) {
+	  it.saved = ret;
+	  next = e->Child(1);
+	}
+	else
+	  status = Apply_Binary(e->kind, it.saved, ret, ret);
+	break;
+      }
+      if(!next)
+	stack.pop_back();
+      else if(next->size > Shallow && next->Arity())
+	stack.push_back({next, 0, 0});
+      else
+	ret = next->Value();
+    }
+  }
+  catch(std::runtime_error&) {
+    stack.resize(base);
+    throw;
+  }
+  stack.resize(base);
+  return Checked(status, ret);
+}
+
+// Appends the text of the tree as Print_To does, with a call per node; for
+// a tree of up to Shallow nodes. Only atoms go bare: an operand with an
+// operator of its own is parenthesized whatever its precedence, as the
+// printed text always has been.
+void Expr::Print_Shallow(std::string& out) {
+  const int n = Arity();
+  if(!n) {
+    Print_To(out);
+    return;
+  }
+  if(n == 1)
+    out += Operator_Text[kind];
+  for(int i = 0; i < n; ++i) {
+    if(i == 1)
+      out += Operator_Text[kind];
+    else if(i == 2)
+      out += " : ";
+    Expr* next = Child(i);
+    if(next->prec == Prec_Atom)
+      next->Print_To(out);
+    else {
+      out += '(';
+      next->Print_Shallow(out);
+      out += ')';
+    }
+  }
+}
+
+// Appends the text of the tree. Above Shallow nodes, each entry on the
+// stack is a node partway through, with the number of operands it has
+// printed; each one below the root was opened with a parenthesis.
+void Expr::Print_To(std::string& out) {
+  if(size <= Shallow) {
+    Print_Shallow(out);
+    return;
   }
-  case 'b': {
-    std::stringstream ss;
-    
-    int n = value < 0 ? -value : value;
-    while(n != 0) {
-      ss << (n & 1);
-      n >>= 1;
+
+  struct Item {
+    Expr* e;
+    int stage;
+  };
+  std::vector<Item> stack;
+
+  stack.push_back({this, 0});
+  while(!stack.empty()) {
+    Item& it = stack.back();
+    Expr* const e = it.e;
+    const int stage = it.stage++;
+    const int n = e->Arity();
+    if(stage == n) {
+      stack.pop_back();
+      if(!stack.empty())
+	out += ')';
+      continue;
+    }
+    if(n == 1 || stage == 1)
+      out += Operator_Text[e->kind];
+    else if(stage == 2)
+      out += " : ";
+    Expr* next = e->Child(stage);
+    if(next->prec == Prec_Atom)
+      next->Print_To(out);
+    else if(next->size > Shallow && next->Arity()) {
+      out += '(';
+      stack.push_back({next, 0});
+    }
+    else {
+      out += '(';
+      next->Print_Shallow(out);
+      out += ')';
     }
-    
-    ss << "b0" << (value < 0 ? "-" : "");
-    
-    std::string str = ss.str();
-    std::reverse(str.begin(), str.end());
-    return str;
   }
+}
+
+// Copies the tree into the region: each node is copied once its operands
+// have been, and its copy takes their copies as operands
+Expr* Expr::Clone(Arena& a) {
+  struct Item {
+    Expr* e;
+    int stage; // operands copied so far
+  };
+  std::vector<Item> stack;
+  std::vector<Expr*> copies; // of the operands of the nodes on the stack
+
+  stack.push_back({this, 0});
+  while(!stack.empty()) {
+    Item& it = stack.back();
+    Expr* const e = it.e;
+    const int n = e->Arity();
+    if(it.stage < n) {
+      stack.push_back({e->Child(it.stage++), 0});
+      continue;
+    }
+    Expr* copy = e->Copy(a);
+    for(int i = n - 1; i >= 0; --i) {
+      copy->Child(i) = copies.back();
+      copies.pop_back();
+    }
+    copies.push_back(copy);
+    stack.pop_back();
+  }
+  return copies.back();
+}
+
+// Emits the tree as each kind of node would, operands in order, with a
+// stack of its own. Each entry is a node partway through: stage counts the
+// operands it has had lowered, and saved holds a register or jump it still
+// needs. The register of the node finished last is in ret; leaves are not
+// pushed.
+int Expr::Lower(Compiler& c, int rootDst) {
+  struct Item {
+    Expr* e;
+    int dst;
+    int stage;
+    int saved;
+  };
+  std::vector<Item> stack;
+  int ret = 0;
+
+  stack.push_back({this, rootDst, 0, 0});
+  while(!stack.empty()) {
+    Item& it = stack.back();
+    Expr* const e = it.e;
+    const int dst = it.dst, stage = it.stage++;
+    Expr* next = nullptr; // an operand to lower before coming back to e
+    int nextDst = dst;
+    switch(e->kind) {
+    case Flat_Not:
+    case Flat_Bit_Comp:
+    case Flat_Neg:
+      if(stage == 0)
+	next = e->Child(0);
+      else {
+	c.Emit(e->kind == Flat_Neg ? Op_Neg : e->kind == Flat_Bit_Comp && e->ExprType == &(cxt->Int_) ? Op_Comp : Op_Not,
+	       dst, ret);
+	ret = dst;
+      }
+      break;
+    case Flat_And:
+    case Flat_Or:
+      if(stage == 0)
+	next = e->Child(0);
+      else if(stage == 1) {
+	c.Move(dst, ret);
+	// false && e2 is false, true || e2 is true
+	it.saved = c.Emit(e->kind == Flat_And ? Op_Jump_False : Op_Jump_True, dst, dst);
+	next = e->Child(1);
+      }
+      else {
+	c.Move(dst, ret);
+	c.Patch(it.saved);
+	ret = dst;
+      }
+      break;
+    case Flat_Cond:
+      if(stage == 0)
+	next = e->Child(0);
+      else if(stage == 1) {
+	it.saved = c.Emit(Op_Jump_False, dst, ret); // to e3
+	next = e->Child(1);
+      }
+      else if(stage == 2) {
+	c.Move(dst, ret);
+	int done = c.Emit(Op_Jump, dst);
+	c.Patch(it.saved);
+	it.saved = done;
+	next = e->Child(2);
+      }
+      else {
+	c.Move(dst, ret);
+	c.Patch(it.saved);
+	ret = dst;
+      }
+      break;
+    default:
+      if(stage == 0)
+	next = e->Child(0);
+      else if(stage == 1) {
+	it.saved = ret;
+	next = e->Child(1);
+	nextDst = dst + 1;
+      }
+      else {
+	c.Emit(Binary_Opcodes[e->kind], dst, it.saved, ret);
+	ret = dst;
+      }
+      break;
+    }
+    if(!next)
+      stack.pop_back();
+    else if(next->Arity())
+      stack.push_back({next, nextDst, 0, 0});
+    else
+      ret = next->Lower(c, nextDst);
+  }
+  return ret;
+}
+
+// Adds the tree to a flat array, each node after its operands. Each entry
+// on the stack is a node partway through, with the indices of the operands
+// it has had so far; the index of the node added last is in ret.
+int Expr::Flatten(Flat_Tree& f) {
+  struct Item {
+    Expr* e;
+    int stage;
+    int a, b; // the first and middle operands
+  };
+  std::vector<Item> stack;
+  int ret = 0;
+
+  stack.push_back({this, 0, 0, 0});
+  while(!stack.empty()) {
+    Item& it = stack.back();
+    Expr* const e = it.e;
+    const int stage = it.stage++;
+    if(stage == 1)
+      it.a = ret;
+    else if(stage == 2)
+      it.b = ret;
+    if(stage < e->Arity()) {
+      Expr* next = e->Child(stage);
+      if(next->Arity())
+	stack.push_back({next, 0, 0, 0});
+      else
+	ret = next->Flatten(f);
+      continue;
+    }
+    const Flat_Kind kind = Flat_Kind(e->kind);
+    if(kind == Flat_Cond)
+      ret = f.Add(kind, it.b, it.a);
+    else if(kind <= Flat_Neg)
+      ret = f.Add(kind);
+    else
+      ret = f.Add(kind, 0, it.a);
+    stack.pop_back();
+  }
+  return ret;
+}
+
+// Adds the boolean skeleton of the tree to a predicate, each node after its
+// operands, as Flatten does. Anything that is not &&, ||, !, ~, a bitwise
+// operator or ?: is a leaf, whatever is below it.
+int Expr::Filter(Filter_Plan& p) {
+  static const signed char skeleton[Flat_Kind_Count] = { // the Filter_Node of each kind, or -1
+    -1, -1, -1, Filter_Node::Not, Filter_Node::Not, -1,
+    Filter_Node::And, Filter_Node::Or, Filter_Node::Bit_And, Filter_Node::Bit_Or, Filter_Node::Bit_Xor,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    Filter_Node::Cond
+  };
+  auto Skeleton = [](Expr* e) { return e->kind < Flat_Kind_Count && skeleton[e->kind] >= 0; };
+  if(!Skeleton(this))
+    return p.Leaf(this);
+
+  struct Item {
+    Expr* e;
+    int stage;
+    int a, b; // the first and middle operands
+  };
+  std::vector<Item> stack;
+  int ret = 0;
+
+  stack.push_back({this, 0, 0, 0});
+  while(!stack.empty()) {
+    Item& it = stack.back();
+    Expr* const e = it.e;
+    const int stage = it.stage++;
+    if(stage == 1)
+      it.a = ret;
+    else if(stage == 2)
+      it.b = ret;
+    if(stage < e->Arity()) {
+      Expr* next = e->Child(stage);
+      if(Skeleton(next))
+	stack.push_back({next, 0, 0, 0});
+      else
+	ret = next->kind == Flat_Bool ? next->Filter(p) : p.Leaf(next);
+      continue;
+    }
+    const Filter_Node::Kind kind = Filter_Node::Kind(skeleton[e->kind]);
+    if(e->Arity() == 1)
+      ret = p.Add(kind, ret);
+    else if(e->Arity() == 2)
+      ret = p.Add(kind, it.a, ret);
+    else
+      ret = p.Add(kind, it.a, it.b, ret);
+    stack.pop_back();
+  }
+  return ret;
+}
+
+int Expr::Checked(Eval_Status status, int value) {
+  switch(status) {
+  case Eval_Overflow:
+    throw std::runtime_error(GetOverflowIntError());
+  case Eval_Undefined:
+    throw std::runtime_error(GetUndefBehavError());
   default:
-    throw std::runtime_error("Invalid output type.");
+    return value;
   }
 }
 
-Expr* Expr::Precompute() {
+// Evaluates with the tree walker, or compiles to bytecode and runs that on
+// the VM. Every tree here is run exactly once, so under --engine=jit only
+// the --rows expression is native code (see Row_Eval), and the
+// declarations before it run on the VM: mapping, writing and protecting a
+// page of native code costs several times what it saves on one run.
+int Expr::Run() {
+  if(cxt->engine == 't')
+    return Eval();
+
+  Program p;
+  Compiler c(p);
+  c.Emit(Op_Return, 0, Lower(c, 0));
+
+  int result = 0;
+  Eval_Status status = Execute(p, result);
+  return Checked(status, result);
+}
+
+// Evaluates the expression into a single literal allocated in the given region
+Expr* Expr::Precompute(Arena& a) {
   Expr* e;
   
   if(Check() == &(cxt->Bool_))
-    e = new Bool_Expr(Eval(), cxt);
+    e = a.Make<Bool_Expr>(Run(), cxt);
   else if(Check() == &(cxt->Int_))
-    e = new Int_Expr(Eval(), cxt);
+    e = a.Make<Int_Expr>(Run(), cxt);
   else
     throw std::runtime_error(GetUndefBehavError());
   
@@ -0,0 +1,38 @@
+#ifndef FILTER_HPP
+#define FILTER_HPP
+
+#include <vector>
+
+// The boolean skeleton of a predicate: the &&, ||, !, ?: and bitwise nodes
+// over bools that a bitmap can compute a word at a time. Everything else
+// (comparisons, bool variables, ==, ...) is a leaf evaluated as a column
+// (see Predicate). Expr::Filter adds each bool node.
+
+struct Expr;
+
+struct Filter_Node {
+  enum Kind { Leaf, Constant, And, Or, Not, Bit_And, Bit_Or, Bit_Xor, Cond };
+  Kind kind;
+  int a, b, c; // operand nodes, or -1
+  Expr* leaf; // Leaf: the expression
+  bool value; // Constant: the value
+};
+
+struct Filter_Plan {
+  std::vector<Filter_Node> nodes; // operands come before the nodes using them
+
+  int Add(Filter_Node::Kind kind, int a = -1, int b = -1, int c = -1) { // returns the node's index
+    nodes.push_back({kind, a, b, c, nullptr, false});
+    return int(nodes.size()) - 1;
+  }
+  int Leaf(Expr* e) {
+    nodes.push_back({Filter_Node::Leaf, -1, -1, -1, e, false});
+    return int(nodes.size()) - 1;
+  }
+  int Constant(bool value) {
+    nodes.push_back({Filter_Node::Constant, -1, -1, -1, nullptr, value});
+    return int(nodes.size()) - 1;
+  }
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef FLAT_HPP
+#define FLAT_HPP
+
+#include <cstdint>
+#include <vector>
+
+// A checked expression tree as an array of nodes that refer to each other
+// by index, with no pointers, so it can be written to disk and mapped back
+// in (see Ast_Cache). Expr::Flatten adds each node after its operands, so
+// its last operand is always the node just before it and only the others
+// are stored; each node takes 8 bytes. A variable is a number into the
+// variables the tree reads, which are listed once each with the value they
+// had when it was parsed.
+
+struct Var_Decl;
+
+enum Flat_Kind : uint32_t {
+  Flat_Bool, Flat_Int, Flat_Var_Ref, // leaves
+  Flat_Not, Flat_Bit_Comp, Flat_Neg, // one operand
+  Flat_And, Flat_Or, Flat_Bit_And, Flat_Bit_Or, Flat_Bit_Xor,
+  Flat_Equal_Equal, Flat_Not_Equal, Flat_Less_Than, Flat_Greater_Than,
+  Flat_Less_Than_Equal, Flat_Greater_Than_Equal,
+  Flat_Add, Flat_Sub, Flat_Mult, Flat_Div, Flat_Rem, // two operands
+  Flat_Cond, // three operands
+  Flat_Kind_Count
+};
+
+struct Flat_Node {
+  uint32_t kind : 8; // a Flat_Kind
+  uint32_t a : 24; // first operand of a binary operator or ?:
+  int32_t value; // literal value, the variable's number, or the middle operand of ?:
+};
+
+struct Flat_Tree {
+  struct Var {
+    const Var_Decl* var;
+    int value;
+    int id; // name number
+  };
+  static const size_t Max_Nodes = 1 << 24; // the most a tree may have, as a holds an index
+
+  std::vector<Flat_Node> nodes; // operands come before the nodes using them
+  std::vector<Var> vars; // in order of first use
+  std::vector<uint32_t> numbers; // 1 + each variable's number in vars, by its name number; 0 if unread
+
+  int Add(Flat_Kind kind, int value = 0, int a = 0) { // returns the node's index
+    Flat_Node n;
+    n.kind = kind;
+    n.a = uint32_t(a);
+    n.value = value;
+    nodes.push_back(n);
+    return int(nodes.size()) - 1;
+  }
+  int Variable(const Var_Decl* var, int id, int value) { // id is the variable's name number; returns its number
+    if(size_t(id) >= numbers.size())
+      numbers.resize(id + 1);
+    uint32_t& number = numbers[id];
+    if(!number) {
+      vars.push_back({var, value, id});
+      number = uint32_t(vars.size());
+    }
+    return int(number) - 1;
+  }
+  void Clear() {
+    for(const Var& v : vars)
+      numbers[v.id] = 0;
+    nodes.clear();
+    vars.clear();
+  }
+};
+
+#endif
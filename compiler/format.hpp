@@ -0,0 +1,69 @@
+#ifndef FORMAT_HPP
+#define FORMAT_HPP
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+// Integer formatting for each output format:
+//  d  decimal
+//  h  [-]0x and the hex digits of the magnitude
+//  b  [-]0b and the binary digits of the magnitude (no digits for 0)
+// Digits go straight into the caller's buffer: decimal with std::to_chars,
+// hex a nibble per table lookup, and binary a whole byte (8 digits) per
+// lookup, so every format costs about the same per value.
+
+const size_t Int_Chars = 35; // longest result: -0b and 32 digits
+
+// The 8 binary digits of every byte
+struct Binary_Table {
+  char digits[256][8];
+  constexpr Binary_Table() : digits() {
+    for(int b = 0; b < 256; ++b)
+      for(int k = 0; k < 8; ++k)
+	digits[b][k] = (b >> (7 - k)) & 1 ? '1' : '0';
+  }
+};
+constexpr Binary_Table Binary_Digits;
+
+// Writes value to out (at least Int_Chars long); returns the length
+inline size_t Format_Int(char* out, int value, char format) {
+  if(format == 'd')
+    return std::to_chars(out, out + Int_Chars, value).ptr - out;
+  if(format != 'h' && format != 'b')
+    throw std::runtime_error("Invalid output type.");
+
+  char* p = out;
+  if(value < 0)
+    *p++ = '-';
+  uint32_t n = value < 0 ? 0u - uint32_t(value) : uint32_t(value); // the magnitude, even of INT_MIN
+  *p++ = '0';
+  *p++ = format == 'h' ? 'x' : 'b';
+
+  if(format == 'h') {
+    int digits = n ? (35 - __builtin_clz(n)) / 4 : 1;
+    for(int k = digits - 1; k >= 0; --k, n >>= 4)
+      p[k] = "0123456789abcdef"[n & 15];
+    return p + digits - out;
+  }
+
+  if(n) {
+    int bits = 32 - __builtin_clz(n);
+    int bytes = (bits + 7) / 8;
+    int lead = bits - 8 * (bytes - 1); // digits of the top byte
+    memcpy(p, Binary_Digits.digits[n >> 8 * (bytes - 1)] + 8 - lead, lead);
+    p += lead;
+    for(int k = bytes - 2; k >= 0; --k, p += 8)
+      memcpy(p, Binary_Digits.digits[(n >> 8 * k) & 255], 8);
+  }
+  return p - out;
+}
+
+inline std::string Format_Int(int value, char format) {
+  char buf[Int_Chars];
+  return std::string(buf, Format_Int(buf, value, format));
+}
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef FRONTEND_HPP
+#define FRONTEND_HPP
+
+#include "lexer.hpp"
+#include "source.hpp"
+
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Lexes a whole input on several threads before it is parsed (--lex-threads).
+// Lexing carries no state from one line to the next, so the input is cut at
+// newlines into one roughly equal part per thread, and each thread splits
+// its part into statements exactly as Source does and lexes them into a
+// token buffer of its own. The parts are then handed out in order, one
+// statement at a time, for the parser to replay (see Lexer(Lexed_Line)).
+struct Parallel_Lex {
+private:
+  struct Line {
+    std::string_view text;
+    size_t first, count; // tokens in the part's buffer
+    int error; // index into the part's errors, or -1
+  };
+  struct Part {
+    std::vector<Token> tokens;
+    std::vector<Line> lines;
+    std::vector<std::string> errors;
+  };
+
+  std::vector<Part> parts;
+  size_t part = 0, line = 0; // next statement to hand out
+
+  static void Lex(const char* first, const char* last, Context*, Part&);
+
+public:
+  Parallel_Lex(std::string_view input, Context*, unsigned threads);
+  bool Next(Lexed_Line&); // the next statement in input order
+};
+
+Parallel_Lex::Parallel_Lex(std::string_view input, Context* cxt, unsigned threads) {
+  if(threads < 1)
+    threads = 1;
+  parts.resize(threads);
+
+  // part boundaries just after a newline
+  std::vector<const char*> cuts = { input.data() };
+  const char* last = input.data() + input.size();
+  for(unsigned t = 1; t < threads; ++t) {
+    const char* at = input.data() + input.size() * t / threads;
+    if(at < cuts.back())
+      at = cuts.back();
+    const char* nl = static_cast<const char*>(memchr(at, '\n', last - at));
+    cuts.push_back(nl ? nl + 1 : last);
+  }
+  cuts.push_back(last);
+
+  std::vector<std::thread> pool;
+  for(unsigned t = 1; t < threads; ++t)
+    pool.emplace_back(Lex, cuts[t], cuts[t + 1], cxt, std::ref(parts[t]));
+  Lex(cuts[0], cuts[1], cxt, parts[0]);
+  for(std::thread& th : pool)
+    th.join();
+}
+
+// Lexes the statements of [first, last) into a part
+void Parallel_Lex::Lex(const char* first, const char* last, Context* cxt, Part& p) {
+  p.tokens.reserve((last - first) / 6); // about one token per 6 bytes of typical input
+  std::string_view text;
+  while(Source::Next_Line(first, last, text)) {
+    Line l = { text, p.tokens.size(), 0, -1 };
+    Lexer lexer(text, cxt);
+    try {
+      Token t;
+      do {
+	t = lexer.Next();
+	p.tokens.push_back(t);
+      } while(t.kind != Eof_Tok);
+    }
+    catch(std::runtime_error& ex) {
+      l.error = int(p.errors.size());
+      p.errors.push_back(ex.what());
+    }
+    l.count = p.tokens.size() - l.first;
+    p.lines.push_back(l);
+  }
+}
+
+bool Parallel_Lex::Next(Lexed_Line& out) {
+  while(part < parts.size() && line == parts[part].lines.size()) {
+    ++part;
+    line = 0;
+  }
+  if(part == parts.size())
+    return false;
+
+  const Part& p = parts[part];
+  const Line& l = p.lines[line++];
+  out.text = l.text;
+  out.tokens = p.tokens.data() + l.first;
+  out.count = l.count;
+  out.error = l.error >= 0 ? p.errors[l.error].c_str() : nullptr;
+  return true;
+}
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef INTERN_HPP
+#define INTERN_HPP
+
+#include "arena.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+// Numbers every declared identifier densely, from 0 in the order they are
+// declared, so symbols can live in flat vectors indexed by that number.
+// Spellings are copied once into an arena, each after its length, and are
+// listed by number in chunks that double in size, so none of them ever
+// moves. The index is an open-addressed table kept at most 3/4 full, whose
+// slots hold the hash, number and spelling of a name.
+//
+// Lexers only look names up (a name is added when a variable of that name
+// is declared), and names are found without taking a lock, so lexers on
+// several threads never wait on a declaration: a slot's number is published
+// last, and a table that has grown is kept until the interner goes, since
+// a reader may still be probing it (together the old tables are no bigger
+// than the current one).
+struct Interner {
+  static const int Chunks = 22; // enough for every int number
+  static const size_t First_Chunk = 1024;
+
+private:
+  struct Slot {
+    uint32_t hash = 0;
+    std::atomic<int> id{-1}; // -1 while empty
+    const char* text = nullptr; // as Spelling(id), saving a load when probing
+  };
+  struct Table {
+    size_t mask;
+    std::unique_ptr<Slot[]> slots;
+    Table(size_t size) : mask(size - 1), slots(new Slot[size]) {}
+  };
+
+  std::atomic<Table*> table;
+  std::vector<std::unique_ptr<Table>> tables; // the current one last
+  std::unique_ptr<const char*[]> chunks[Chunks]; // spellings by number; chunk k holds First_Chunk << k
+  std::atomic<int> count{0};
+  Arena text{16 * 1024};
+  std::mutex m; // held to add a name
+
+  static uint32_t Hash(std::string_view s) { return uint32_t(std::hash<std::string_view>()(s)); }
+  const char*& Spelling(int id) const; // the text, after its uint32_t length
+  int Find(const Table&, std::string_view, uint32_t hash, size_t& i) const;
+  void Grow();
+
+public:
+  Interner() {
+    tables.emplace_back(new Table(1024));
+    table = tables.back().get();
+  }
+  Interner(const Interner&) = delete;
+  Interner& operator=(const Interner&) = delete;
+
+  int Intern(std::string_view); // the name's number, adding the name if it is new
+  int Find(std::string_view) const; // -1 for a name never seen
+  std::string_view Name(int id) const;
+  size_t Size() const { return size_t(count.load(std::memory_order_acquire)); }
+};
+
+const char*& Interner::Spelling(int id) const {
+  const size_t n = size_t(id) / First_Chunk + 1;
+  const int k = 63 - __builtin_clzll(n); // chunk k starts at First_Chunk * (2^k - 1)
+  return chunks[k][size_t(id) - First_Chunk * ((size_t(1) << k) - 1)];
+}
+
+std::string_view Interner::Name(int id) const {
+  const char* p = Spelling(id);
+  uint32_t length;
+  memcpy(&length, p - sizeof length, sizeof length);
+  return std::string_view(p, length);
+}
+
+// The name's number, or -1 with i at the empty slot where it would go
+int Interner::Find(const Table& t, std::string_view s, uint32_t hash, size_t& i) const {
+  for(i = hash & t.mask; ; i = (i + 1) & t.mask) {
+    const Slot& slot = t.slots[i];
+    int id = slot.id.load(std::memory_order_acquire);
+    if(id < 0)
+      return -1;
+    if(slot.hash == hash) {
+      uint32_t length;
+      memcpy(&length, slot.text - sizeof length, sizeof length);
+      if(length == s.size() && !memcmp(slot.text, s.data(), s.size()))
+	return id;
+    }
+  }
+}
+
+void Interner::Grow() {
+  const Table& old = *tables.back();
+  Table* t = new Table(2 * (old.mask + 1));
+  for(size_t k = 0; k <= old.mask; ++k) {
+    const Slot& from = old.slots[k];
+    int id = from.id.load(std::memory_order_relaxed);
+    if(id >= 0) {
+      size_t i = from.hash & t->mask;
+      while(t->slots[i].id.load(std::memory_order_relaxed) >= 0)
+	i = (i + 1) & t->mask;
+      t->slots[i].hash = from.hash;
+      t->slots[i].text = from.text;
+      t->slots[i].id.store(id, std::memory_order_relaxed);
+    }
+  }
+  tables.emplace_back(t);
+  table.store(t, std::memory_order_release);
+}
+
+int Interner::Intern(std::string_view s) {
+  const uint32_t hash = Hash(s);
+  size_t i;
+  int id = Find(*table.load(std::memory_order_acquire), s, hash, i);
+  if(id >= 0)
+    return id;
+
+  std::lock_guard<std::mutex> lock(m);
+  Table& t = *tables.back();
+  id = Find(t, s, hash, i); // another thread may have added it since
+  if(id >= 0)
+    return id;
+
+  id = count.load(std::memory_order_relaxed);
+  const size_t n = size_t(id) / First_Chunk + 1;
+  const int k = 63 - __builtin_clzll(n);
+  if(!chunks[k])
+    chunks[k].reset(new const char*[First_Chunk << k]);
+  const uint32_t length = uint32_t(s.size());
+  char* copy = static_cast<char*>(text.Allocate(sizeof length + s.size(), alignof(uint32_t)));
+  memcpy(copy, &length, sizeof length);
+  memcpy(copy + sizeof length, s.data(), s.size());
+  Spelling(id) = copy + sizeof length;
+
+  t.slots[i].hash = hash;
+  t.slots[i].text = copy + sizeof length;
+  t.slots[i].id.store(id, std::memory_order_release);
+  count.store(id + 1, std::memory_order_release);
+  if(4 * size_t(id + 1) > 3 * (t.mask + 1))
+    Grow();
+  return id;
+}
+
+int Interner::Find(std::string_view s) const {
+  size_t i;
+  return Find(*table.load(std::memory_order_acquire), s, Hash(s), i);
+}
+
+#endif
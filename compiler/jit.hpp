@@ -0,0 +1,258 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include "bytecode.hpp"
+
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+#include <sys/mman.h>
+
+#if defined(__x86_64__)
+#define JIT_X86
+#endif
+
+// Native code for a bytecode program. Each instruction is translated to a
+// fixed x86-64 template: temporaries stay in the register file (rdi points
+// at r[0]), Op_Load reads the slots passed in (r8, moved from rdx, which
+// idiv takes), constants become immediates, overflow is caught with jo and the
+// division checks with explicit compares, and comparisons use setcc. The
+// generated function returns an Eval_Status, so errors are reported by the
+// caller exactly as for the other engines. Where no JIT is available Ok()
+// is false and callers fall back to Execute().
+struct Jit_Code {
+  typedef Eval_Status (*Entry)(int* r, int* result, const int* slots);
+
+private:
+  void* mem = MAP_FAILED; // executable mapping
+  size_t size = 0;
+  Entry entry = nullptr;
+  int registers = 0;
+
+public:
+  Jit_Code(const Program&);
+  ~Jit_Code() { if(mem != MAP_FAILED) munmap(mem, size); }
+  Jit_Code(const Jit_Code&) = delete;
+  Jit_Code& operator=(const Jit_Code&) = delete;
+
+  bool Ok() const { return entry != nullptr; }
+  Eval_Status Run(int& result, const int* slots = nullptr) const; // Op_Load reads the slots, as in Execute
+};
+
+#ifdef JIT_X86
+
+// Builds the machine code. Operand registers are x86 register numbers:
+// 0 eax, 1 ecx, 2 edx.
+struct X86_Emitter {
+  enum { To_Overflow = -1, To_Undefined = -2 }; // jump targets besides instructions
+  struct Fixup { size_t at; int target; }; // rel32 at 'at' jumps to 'target'
+
+  const Program& prog;
+  std::vector<uint8_t> code;
+  std::vector<Fixup> fixups;
+
+  X86_Emitter(const Program& _prog) : prog(_prog) {}
+
+  void Bytes(std::initializer_list<uint8_t> b) { code.insert(code.end(), b); }
+  void Imm32(int32_t v) {
+    uint8_t b[4];
+    memcpy(b, &v, 4);
+    code.insert(code.end(), b, b + 4);
+  }
+  void Jump(std::initializer_list<uint8_t> op, int target) { // jmp / jcc rel32
+    Bytes(op);
+    fixups.push_back({code.size(), target});
+    Imm32(0);
+  }
+  int Constant(int r) const { return prog.constants[-1 - r]; }
+
+  // ModRM for [rdi + 4r]
+  void Mem(uint8_t reg, int r) {
+    code.push_back(uint8_t(0x87 | reg << 3));
+    Imm32(r * 4);
+  }
+  void Load(uint8_t reg, int r) {
+    if(r < 0) { // mov reg, imm32
+      code.push_back(uint8_t(0xB8 + reg));
+      Imm32(Constant(r));
+    }
+    else { // mov reg, [rdi + 4r]
+      code.push_back(0x8B);
+      Mem(reg, r);
+    }
+  }
+  void Store(uint8_t reg, int r) { code.push_back(0x89); Mem(reg, r); }
+
+  // eax = eax op r, for ALU group add 0, or 1, and 4, sub 5, xor 6, cmp 7
+  void Alu(uint8_t group, int r) {
+    if(r < 0) {
+      Bytes({0x81, uint8_t(0xC0 | group << 3)});
+      Imm32(Constant(r));
+    }
+    else {
+      code.push_back(uint8_t(group << 3 | 3));
+      Mem(0, r);
+    }
+  }
+
+  void Binary(const Instr& i, uint8_t group, bool checked) {
+    Load(0, i.a);
+    Alu(group, i.b);
+    if(checked)
+      Jump({0x0F, 0x80}, To_Overflow); // jo
+    Store(0, i.dst);
+  }
+
+  void Multiply(const Instr& i) {
+    Load(0, i.a);
+    if(i.b < 0) { // imul eax, eax, imm32
+      Bytes({0x69, 0xC0});
+      Imm32(Constant(i.b));
+    }
+    else { // imul eax, [rdi + 4b]
+      Bytes({0x0F, 0xAF});
+      Mem(0, i.b);
+    }
+    Jump({0x0F, 0x80}, To_Overflow); // jo
+    Store(0, i.dst);
+  }
+
+  // Same checks as Undefined_Division, then idiv; quotient in eax, remainder in edx
+  void Divide(const Instr& i, uint8_t out) {
+    Load(1, i.b);
+    Load(0, i.a);
+    Bytes({0x85, 0xC9}); // test ecx, ecx
+    Jump({0x0F, 0x84}, To_Undefined); // jz
+    Bytes({0x81, 0xF9}); // cmp ecx, INT_MIN
+    Imm32(std::numeric_limits<int>::min());
+    Jump({0x0F, 0x84}, To_Undefined); // je
+    Bytes({0x83, 0xF9, 0xFF, 0x75, 0x0B}); // cmp ecx, -1; jne over the next two
+    Bytes({0x3D}); // cmp eax, INT_MIN
+    Imm32(std::numeric_limits<int>::min());
+    Jump({0x0F, 0x84}, To_Undefined); // je
+    Bytes({0x99, 0xF7, 0xF9}); // cdq; idiv ecx
+    Store(out, i.dst);
+  }
+
+  void Compare(const Instr& i, uint8_t setcc) {
+    Load(0, i.a);
+    Bytes({0x31, 0xC9}); // xor ecx, ecx
+    Alu(7, i.b); // cmp
+    Bytes({0x0F, setcc, 0xC1}); // setcc cl
+    Store(1, i.dst);
+  }
+
+  void Branch(const Instr& i, uint8_t jcc) {
+    Load(0, i.a);
+    Bytes({0x85, 0xC0}); // test eax, eax
+    Jump({0x0F, jcc}, i.b);
+  }
+
+  std::vector<uint8_t>& Translate();
+};
+
+std::vector<uint8_t>& X86_Emitter::Translate() {
+  std::vector<size_t> offsets; // start of each instruction's code
+  Bytes({0x49, 0x89, 0xD0}); // mov r8, rdx
+  for(const Instr& i : prog.code) {
+    offsets.push_back(code.size());
+    switch(i.op) {
+    case Op_Move: Load(0, i.a); Store(0, i.dst); break;
+    case Op_Add: Binary(i, 0, true); break;
+    case Op_Sub: Binary(i, 5, true); break;
+    case Op_Mul: Multiply(i); break;
+    case Op_Div: Divide(i, 0); break;
+    case Op_Rem: Divide(i, 2); break;
+    case Op_Neg:
+      Load(0, i.a);
+      Bytes({0xF7, 0xD8}); // neg eax
+      Jump({0x0F, 0x80}, To_Overflow); // jo
+      Store(0, i.dst);
+      break;
+    case Op_Not:
+      Load(0, i.a);
+      Bytes({0x31, 0xC9, 0x85, 0xC0, 0x0F, 0x94, 0xC1}); // xor ecx, ecx; test eax, eax; sete cl
+      Store(1, i.dst);
+      break;
+    case Op_Comp:
+      Load(0, i.a);
+      Bytes({0xF7, 0xD0}); // not eax
+      Store(0, i.dst);
+      break;
+    case Op_Bit_And: Binary(i, 4, false); break;
+    case Op_Bit_Or: Binary(i, 1, false); break;
+    case Op_Bit_Xor: Binary(i, 6, false); break;
+    case Op_Equal: Compare(i, 0x94); break; // sete
+    case Op_Not_Equal: Compare(i, 0x95); break; // setne
+    case Op_Less: Compare(i, 0x9C); break; // setl
+    case Op_Greater: Compare(i, 0x9F); break; // setg
+    case Op_Less_Equal: Compare(i, 0x9E); break; // setle
+    case Op_Greater_Equal: Compare(i, 0x9D); break; // setge
+    case Op_Load:
+      Bytes({0x41, 0x8B, 0x80}); // mov eax, [r8 + 4a]
+      Imm32(i.a * 4);
+      Store(0, i.dst);
+      break;
+    case Op_Jump: Jump({0xE9}, i.b); break;
+    case Op_Jump_False: Branch(i, 0x84); break; // je
+    case Op_Jump_True: Branch(i, 0x85); break; // jne
+    case Op_Return:
+      Load(0, i.a);
+      Bytes({0x89, 0x06, 0x31, 0xC0, 0xC3}); // mov [rsi], eax; xor eax, eax; ret
+      break;
+    default:
+      break;
+    }
+  }
+
+  size_t overflow = code.size();
+  code.push_back(0xB8); // mov eax, Eval_Overflow; ret
+  Imm32(Eval_Overflow);
+  code.push_back(0xC3);
+  size_t undefined = code.size();
+  code.push_back(0xB8); // mov eax, Eval_Undefined; ret
+  Imm32(Eval_Undefined);
+  code.push_back(0xC3);
+
+  for(const Fixup& f : fixups) {
+    size_t target = f.target == To_Overflow ? overflow : f.target == To_Undefined ? undefined : offsets[f.target];
+    int32_t rel = int32_t(target - (f.at + 4));
+    memcpy(&code[f.at], &rel, 4);
+  }
+  return code;
+}
+
+// Translates the program into a fresh mapping, then makes it executable
+Jit_Code::Jit_Code(const Program& p) : registers(p.registers) {
+  X86_Emitter x86(p);
+  std::vector<uint8_t>& code = x86.Translate();
+
+  size = code.size();
+  mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(mem == MAP_FAILED)
+    return;
+  memcpy(mem, code.data(), size);
+  if(mprotect(mem, size, PROT_READ | PROT_EXEC) == 0)
+    entry = reinterpret_cast<Entry>(mem);
+}
+
+#else
+
+Jit_Code::Jit_Code(const Program&) {} // no JIT for this target; Ok() is false
+
+#endif
+
+// Runs the native code with a register file of its own
+Eval_Status Jit_Code::Run(int& result, const int* slots) const {
+  int small[64];
+  std::vector<int> large;
+  int* r = small;
+  if(registers > 64) {
+    large.resize(registers);
+    r = large.data();
+  }
+  return entry(r, &result, slots);
+}
+
+#endif
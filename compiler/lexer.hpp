@@ -3,239 +3,265 @@
 
 #include "token.hpp"
 #include "context.hpp"
+#include "scan.hpp"
+#include "format.hpp"
 #include <iomanip>
 #include <algorithm>
 #include <stdexcept>
+#include <string_view>
+#include <limits>
+
+// A statement lexed ahead of time (see Parallel_Lex): its tokens through
+// the Eof_Tok, or up to the point where lexing threw error
+struct Lexed_Line {
+  std::string_view text;
+  const Token* tokens;
+  size_t count;
+  const char* error; // message, or nullptr
+};
 
 struct Lexer {
 private:
-  std::string::iterator first, last; // iterator used to step through the string
-  std::string buffer; // buffer while reading multi-digit numbers
-  std::string str; // input
+  const char* base; // start of the statement; token spans are relative to it
+  const char* first, * last; // pointers used to step through the input
+  const char* start; // first character of the token being lexed
+  const Scanner& scan; // routines that skip runs of whitespace, identifier & digit characters
   //char outputFormat; // b = binary, h = hex, d = decimal
   Context* cxt;
+  const Token* replay = nullptr, * replayEnd = nullptr; // tokens lexed ahead of time
+  const char* replayError = nullptr;
   
   const std::string& GetInvalidCharError() {
     static std::string InvalidCharError("Invalid character.");
     return InvalidCharError;
   } // message thrown in invalid character
+
+  const std::string& GetIntRangeError() {
+    static std::string IntRangeError("Integer literal out of range.");
+    return IntRangeError;
+  } // message thrown when a literal does not fit in an int
+
+  const std::string& GetIntLiteralError() {
+    static std::string IntLiteralError("Invalid integer literal.");
+    return IntLiteralError;
+  } // message thrown for a prefix with no digits
   
-  char LookAhead() const { return *first; } // look at current character
-  char LookAhead(int steps) const { return *(first + steps); }
+  char LookAhead() const { return Eof() ? 0 : *first; } // look at current character
+  char LookAhead(int steps) const { return first + steps < last ? *(first + steps) : 0; }
   void Consume() { ++first; } // step to next character
-  char Buffer(); // add lookahead to buffer
-  bool isHex(char); // checks if valid hex digit (0-9, a-f)
-  bool isBin(char); // checks if valid binary digit (0,1)
-  std::string dec2bin(int); // converts int to binary string for output
-  Token * Lex_Id();
+  Token Make(int kind, int value = 0) const { // token spanning start up to the current character
+    return Token{kind, uint32_t(start - base), uint32_t(first - start), value};
+  }
+  Token Lex_Id();
+  Token Lex_Int(int);
+  Token Replay();
   
 public:
   bool Eof() const { return first == last; } // checks if the string is at its end
-  Token * Next(); // returns the next token
-  std::string Print(Token *); // return the given token for printing
-  Lexer(std::string, Context*); // constructor, takes input text and output type for numbers
+  Token Next(); // returns the next token
+  std::string_view Text() const { return std::string_view(base, last - base); } // the text token spans refer to
+  std::string Print(const Token&); // return the given token for printing
+  Lexer(std::string_view, Context*, const Scanner& = Best_Scanner()); // constructor, takes input text and output type for numbers
+  Lexer(const Lexed_Line&, Context*); // hands out the tokens of a line lexed ahead of time
 };
 
-// Constructor, stores input, sets iterators and output format for numbers
-Lexer::Lexer(std::string _str, Context* _cxt) : str(_str), cxt(_cxt) {
-  first = str.begin();
-  last = str.end();
-}
-
-// adds the character to the buffer and returns the added character
-char Lexer::Buffer() {
-  if(Eof())
-    return 0;
-  buffer += LookAhead();
-  Consume();
-  return buffer.back();
+// Constructor, sets pointers over the input, which must outlive the lexer
+Lexer::Lexer(std::string_view str, Context* _cxt, const Scanner& _scan) : scan(_scan), cxt(_cxt) {
+  base = first = start = str.data();
+  last = str.data() + str.size();
 }
 
 // prints the given token with formatting
-std::string Lexer::Print(Token * token) {
+std::string Lexer::Print(const Token& token) {
   std::stringstream ss;
-  ss << token->EnumName(); // all tokens print their name
+  ss << token.EnumName(); // all tokens print their name
   
-  switch(token->kind) {
+  switch(token.kind) {
   case Int_Tok: { // ints print their value as decimal, hex, or binary
-    Int_Token * int_token = dynamic_cast<Int_Token*>(token);
-    ss << ": ";
-    switch(cxt->outputFormat) {
-    case 'd':
-      ss << int_token->value;
-      break;
-    case 'h':
-      ss << "0x" << std::hex << int_token->value;
-      break;
-    case 'b':
-      ss << "0b" << dec2bin(int_token->value);
-      break;
-    }
+    ss << ": " << Format_Int(token.value, cxt->outputFormat);
     break;
   }
-  case Bool_Tok: { // bools print their value
-    Bool_Token * bool_token = dynamic_cast<Bool_Token*>(token);
-    ss << ": " << std::boolalpha << bool_token->value;
+  case Bool_Tok: // bools print their value
+  case True_KW:
+  case False_KW:
+    ss << ": " << std::boolalpha << bool(token.value);
     break;
   }
-  }
   
   return ss.str();
 }
 
-// checks if the character is a valid hex digit
-bool Lexer::isHex(char c) {
-  return (isdigit(c) || c == 'A' || c == 'B' || c == 'C' || c == 'D' || c == 'E' || c == 'F'
-	  || c == 'a' || c == 'b' || c == 'c' || c == 'd' || c == 'e' || c == 'f');
-}
+Token Lexer::Lex_Id() {
+  first = scan.SkipId(first + 1, last); // letters, digits & underscores
 
-// checks if the character is a valid binary digit
-bool Lexer::isBin(char c) {
-  return (c == '1' || c == '0');
+  std::string_view text(start, first - start);
+  Token_Kind kind = Keyword_Kind(text);
+  if(kind == Id_Tok)
+    return Make(kind, cxt->names->Find(text)); // identifiers carry their number, or -1 if never declared
+  return Make(kind, kind == True_KW);
 }
 
-// converts the number to a binary string
-std::string Lexer::dec2bin(int n) {
-  std::stringstream ss;
+// Converts the integer literal digits at the lookahead straight from the
+// input. Digits may be grouped with '_' separators (1_000_000, 0xFFFF_FFFF).
+Token Lexer::Lex_Int(int base) {
+  const Char_Class digit = base == 16 ? Hex_Char : base == 2 ? Bin_Char : Digit_Char;
+  const char* digits = first;
+  uint64_t value = 0;
+
+  while(true) {
+    const char* end;
+    switch(base) {
+    case 16:
+      end = scan.SkipHex(first, last);
+      value = Accumulate_Hex(first, end, value);
+      break;
+    case 2:
+      end = scan.SkipBin(first, last);
+      value = Accumulate_Bin(first, end, value);
+      break;
+    default:
+      end = scan.SkipDigits(first, last);
+      value = Accumulate_Decimal(first, end, value);
+    }
+    first = end;
 
-  while(n != 0) {
-    ss << (n & 1);
-    n >>= 1;
+    // a separator must sit between two digits
+    if(first != digits && LookAhead() == '_' && Is_Class(LookAhead(1), digit))
+      Consume();
+    else
+      break;
   }
 
-  std::string str = ss.str();
-  std::reverse(str.begin(), str.end());
-  return str;
+  if(base == 2 && first == digits)
+    throw std::runtime_error(GetIntLiteralError()); // 0b needs at least one digit
+  if(value > uint64_t(std::numeric_limits<int>::max()))
+    throw std::runtime_error(GetIntRangeError());
+  return Make(Int_Tok, int(value));
 }
 
-Token * Lexer::Lex_Id() {
-  Buffer();
-  while (isalpha(LookAhead()) || isdigit(LookAhead()) || LookAhead() == '_')
-    Buffer();
+Lexer::Lexer(const Lexed_Line& line, Context* _cxt) : Lexer(line.text, _cxt) {
+  replay = line.tokens;
+  replayEnd = line.tokens + line.count;
+  replayError = line.error;
+}
 
-  const std::string str = buffer;
-  if(Token * kw = cxt->CheckKeyword(str))
-    return kw;
-  else
-    return new Id_Token(str);
+// Next token of a line lexed ahead of time, throwing where lexing threw
+Token Lexer::Replay() {
+  if(replay == replayEnd) {
+    if(replayError)
+      throw std::runtime_error(replayError);
+    return replayEnd[-1]; // the Eof_Tok, again
+  }
+  return *replay++;
 }
 
 // reads along the string and returns the next token
-Token * Lexer::Next() {
-  buffer.clear();
-  
+Token Lexer::Next() {
+  if(replay)
+    return Replay();
   while(!Eof()) {
+    start = first;
     switch(LookAhead()) {
     case ' ':
     case '\n':
     case '\t':
     case '\v':
-      Consume(); // skip white space
+      Consume(); // skip white space, a whole run at a time when there is more than one
+      if(Is_Class(LookAhead(), Space_Char))
+	first = scan.SkipSpace(first, last);
       continue;
     case '(':
       Consume();
-      return new Punc_Op_Token(LParen_Tok); // left paren
+      return Make(LParen_Tok); // left paren
     case ')':
       Consume();
-      return new Punc_Op_Token(RParen_Tok); // right paren
+      return Make(RParen_Tok); // right paren
     case '=':
       Consume();
       if(LookAhead() == '=') {
 	Consume();
-	return new Punc_Op_Token(EqualEqual_Tok); // ==
+	return Make(EqualEqual_Tok); // ==
       }
-      return new Punc_Op_Token(Equal_Tok); // =
+      return Make(Equal_Tok); // =
     case '!':
       Consume();
       if(LookAhead() == '=') {
 	Consume();
-	return new Punc_Op_Token(Not_Equal_Tok); // !=
+	return Make(Not_Equal_Tok); // !=
       }
-      return new Punc_Op_Token(Bang_Tok); // !
+      return Make(Bang_Tok); // !
     case '<':
       Consume();
       if(LookAhead() == '=') {
 	Consume();
-	return new Punc_Op_Token(LTE_Tok); // <=
+	return Make(LTE_Tok); // <=
       }
-      return new Punc_Op_Token(LT_Tok); // <
+      return Make(LT_Tok); // <
     case '>':
       Consume();
       if(LookAhead() == '=') {
 	Consume();
-	return new Punc_Op_Token(GTE_Tok); // >=
+	return Make(GTE_Tok); // >=
       }
-      return new Punc_Op_Token(GT_Tok); // >
+      return Make(GT_Tok); // >
     case '+':
       Consume();
-      return new Punc_Op_Token(Plus_Tok); // +
+      return Make(Plus_Tok); // +
     case '-':
       Consume();
-      return new Punc_Op_Token(Minus_Tok); // -
+      return Make(Minus_Tok); // -
     case '*':
       Consume();
-      return new Punc_Op_Token(Star_Tok); // *
+      return Make(Star_Tok); // *
     case '/':
       Consume();
-      return new Punc_Op_Token(Slash_Tok); // /
+      return Make(Slash_Tok); // /
     case '%':
       Consume();
-      return new Punc_Op_Token(Percent_Tok); // %
+      return Make(Percent_Tok); // %
     case '&':
       Consume();
       if(LookAhead() == '&') {
 	Consume();
-	return new Punc_Op_Token(AmpAmp_Tok); // &&
+	return Make(AmpAmp_Tok); // &&
       }
-      return new Punc_Op_Token(Amp_Tok); // &
+      return Make(Amp_Tok); // &
     case '|':
       Consume();
       if(LookAhead() == '|') {
 	Consume();
-	return new Punc_Op_Token(PipePipe_Tok); // ||
+	return Make(PipePipe_Tok); // ||
       }
-      return new Punc_Op_Token(Pipe_Tok); // |
+      return Make(Pipe_Tok); // |
     case '^':
       Consume();
-      return new Punc_Op_Token(Caret_Tok); // ^
+      return Make(Caret_Tok); // ^
     case '~':
       Consume();
-      return new Punc_Op_Token(Tilde_Tok); // ~
+      return Make(Tilde_Tok); // ~
     case '?':
       Consume();
-      return new Punc_Op_Token(Query_Tok); // ?
+      return Make(Query_Tok); // ?
     case ':':
       Consume();
-      return new Punc_Op_Token(Colon_Tok); // :
+      return Make(Colon_Tok); // :
     case ';':
       Consume();
-      return new Punc_Op_Token(Semicolon_Tok); // ;
+      return Make(Semicolon_Tok); // ;
     case '0':
-      Buffer();
       // Checks for hex declaration
-      if(LookAhead() == 'x' || LookAhead() == 'X') {
-	Buffer();
-	while(!Eof() && isHex(LookAhead()))
-	  Buffer();
-	return new Int_Token(std::stoi(buffer, nullptr, 16)); // converts hex string to int
+      if(LookAhead(1) == 'x' || LookAhead(1) == 'X') {
+	first += 2;
+	return Lex_Int(16); // a bare 0x is 0
       }
       // Checks for binary declaration
-      if(LookAhead() == 'b' || LookAhead() == 'B') {
-	Buffer();
-	buffer.clear(); // need to drop the 0b; hex can parse this part but not binary
-	while(!Eof() && isBin(LookAhead()))
-	  Buffer();
-	return new Int_Token(std::stoi(buffer, nullptr, 2)); // converts binary string to int
+      if(LookAhead(1) == 'b' || LookAhead(1) == 'B') {
+	first += 2;
+	return Lex_Int(2);
       }
-      // If not hex/binary, check for another digit.
-      //    If no other digit, return 0. Otherwise drop through into standard number loop.
-      if(Eof() || !isdigit(LookAhead()))
-	return new Int_Token(0);
+      // If not hex/binary, the 0 is just the first decimal digit
     case '1' ... '9':
-      Buffer();
-      while(!Eof() && std::isdigit(LookAhead()))
-	Buffer();
-      return new Int_Token(std::stoi(buffer)); // converts decimal string to int
+      return Lex_Int(10);
     case '_':
     case 'a' ... 'z':
     case 'A' ... 'Z': return Lex_Id();
@@ -243,7 +269,8 @@ Token * Lexer::Next() {
       throw std::runtime_error(GetInvalidCharError());
     }
   }
-  return new Punc_Op_Token(Eof_Tok);
+  start = first;
+  return Make(Eof_Tok);
 }
 
 #endif
@@ -1,7 +1,17 @@
 #include "parser.hpp"
+#include "source.hpp"
+#include "aot.hpp"
+#include "rows.hpp"
+#include "parallel.hpp"
+#include "frontend.hpp"
+#include "pipeline.hpp"
+#include "writer.hpp"
+#include "cache.hpp"
 
 #include <stdio.h>
 #include <sstream>
+#include <memory>
+#include <sys/resource.h>
 
 // See the GitHub README if instructions to use this program are required.
 // https://github.com/jac259/CompilerDesign/blob/master/README.md
@@ -9,48 +19,266 @@
 int main(int argc, char * argv[]) {
 
   char outputType = 'd';
-  std::string str;
+  char engine = 't';
+  char outputMode = 'i';
+  char ast = 't';
+  const char* inputFile = nullptr;
+  const char* rowFile = nullptr;
+  const char* rowExpr = nullptr;
+  const char* snapshotFile = nullptr;
+  const char* journalFile = nullptr;
+  const char* cacheFile = nullptr;
+  std::unique_ptr<std::vector<std::string>> fields; // names of binary row fields
+  std::vector<const char*> branchFiles; // each run on a fork of what the input leaves
+  bool memoryReport = false;
+  bool assembly = false;
+  bool parallel = false;
+  bool pipelined = false;
+  bool filter = false; // with --rows, list the rows where the expression is true
+  unsigned lexThreads = 0; // lex the whole input up front on this many threads
+  std::string_view str;
   std::stringstream output;
 
   // Input parameters
-  if(argv[1])
-    if((std::string)argv[1] == "-b")
+  for(int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if(arg == "-b")
       outputType = 'b';
-    else if((std::string)argv[1] == "-h")
+    else if(arg == "-h")
       outputType = 'h';
-    else if((std::string)argv[1] != "-d")
-      throw std::runtime_error("Invalid output type argument.");
+    else if(arg == "-d")
+      outputType = 'd';
+    else if(arg == "--engine=tree")
+      engine = 't';
+    else if(arg == "--engine=vm")
+      engine = 'v';
+    else if(arg == "--engine=jit")
+      engine = 'j';
+    else if(arg == "--ast=tree")
+      ast = 't';
+    else if(arg == "--ast=soa")
+      ast = 's';
+    else if(arg == "--results-only")
+      outputMode = 'r';
+    else if(arg == "--jsonl")
+      outputMode = 'j';
+    else if(arg == "-S")
+      assembly = true;
+    else if(arg == "--parallel")
+      parallel = true;
+    else if(arg == "--pipeline")
+      pipelined = true;
+    else if(arg == "--lex-threads" && i + 1 < argc && atoi(argv[i + 1]) > 0)
+      lexThreads = atoi(argv[++i]);
+    else if(arg == "-m")
+      memoryReport = true;
+    else if(arg == "-f" && i + 1 < argc)
+      inputFile = argv[++i];
+    else if(arg == "--rows" && i + 1 < argc)
+      rowFile = argv[++i];
+    else if(arg == "--expr" && i + 1 < argc)
+      rowExpr = argv[++i];
+    else if(arg == "--filter")
+      filter = true;
+    else if(arg == "--snapshot" && i + 1 < argc)
+      snapshotFile = argv[++i];
+    else if(arg == "--journal" && i + 1 < argc)
+      journalFile = argv[++i];
+    else if(arg == "--ast-cache" && i + 1 < argc)
+      cacheFile = argv[++i];
+    else if(arg == "--branch" && i + 1 < argc)
+      branchFiles.push_back(argv[++i]);
+    else if(arg == "--fields" && i + 1 < argc) {
+      fields.reset(new std::vector<std::string>);
+      std::stringstream names(argv[++i]);
+      for(std::string name; std::getline(names, name, ','); )
+	fields->push_back(name);
+    }
+    else
+      throw std::runtime_error("Invalid argument.");
+  }
+  if(!rowFile != !rowExpr || ((filter || engine == 'j') && !rowFile) || (parallel && (assembly || rowFile)) ||
+     (pipelined && (assembly || rowFile || parallel || lexThreads)) ||
+     (outputMode != 'i' && (assembly || rowFile)) ||
+     (cacheFile && (parallel || pipelined)) ||
+     (!branchFiles.empty() && (assembly || rowFile)))
+    throw std::runtime_error("Invalid argument.");
+
+  Context* cxt = new Context(outputType, engine, outputMode);
+  cxt->ast = ast;
 
-  Context* cxt = new Context(outputType);
+  // with --snapshot and --journal the variables of the last run are restored,
+  // and this run's changes are recorded as they are made
+  std::unique_ptr<Journal> journal;
+  try {
+    if(snapshotFile || journalFile)
+      journal.reset(new Journal(cxt, snapshotFile, journalFile));
+  }
+  catch (std::runtime_error ex) {
+    std::cerr << "Error: " << ex.what() << "\n";
+    return 1;
+  }
 
-  while (std::getline(std::cin, str)) {
+  // standard output goes through one large buffer, written out in big blocks
+  // (after every statement when someone is typing or watching at a terminal)
+  Fd_Buf writer(1);
+  std::streambuf* console = std::cout.rdbuf(&writer);
+  const bool interactive = isatty(0) || isatty(1);
+
+  // with --ast-cache statements seen before are taken from the cache instead of being parsed
+  std::unique_ptr<Ast_Cache> cache(cacheFile ? new Ast_Cache(cxt, cacheFile) : nullptr);
+
+  // map the input file if one was given, otherwise read standard input
+  // (which --pipeline reads from a descriptor of its own)
+  std::unique_ptr<Source> source;
+  std::vector<std::unique_ptr<Source>> branches;
+  int in = 0;
+  try {
+    source.reset(inputFile ? new Source(inputFile) : new Source());
+    for(const char* path : branchFiles)
+      branches.emplace_back(new Source(path));
+    if(pipelined && inputFile && (in = open(inputFile, O_RDONLY)) < 0)
+      throw std::runtime_error("Could not open input file.");
+  }
+  catch (std::runtime_error ex) {
+    std::cerr << "Error: " << ex.what() << "\n";
+    std::cout.rdbuf(console);
+    return 1;
+  }
+
+  // with --lex-threads the parser replays statements lexed ahead of time
+  std::unique_ptr<Parallel_Lex> lexed(lexThreads ? new Parallel_Lex(source->All(), cxt, lexThreads) : nullptr);
+  Lexed_Line line;
+  auto Next = [&] {
+    if(!lexed)
+      return source->Next(str);
+    if(!lexed->Next(line))
+      return false;
+    str = line.text;
+    return true;
+  };
+
+  // with -S the statements are compiled into an assembler file instead of being run
+  std::unique_ptr<Aot> aot(assembly ? new Aot(cxt) : nullptr);
+
+  // with --parallel all the statements are read first, then run on a pool
+  std::unique_ptr<Parallel_Run> pool(parallel ? new Parallel_Run(cxt) : nullptr);
+  if(pool) {
+    while(Next())
+      pool->Add(str);
+    unsigned threads = std::thread::hardware_concurrency();
+    pool->Run(std::cout, threads ? threads : 1);
+  }
+
+  // with --pipeline reading, parsing and evaluating each run on a thread of their own
+  std::unique_ptr<Pipeline> pipe(pipelined ? new Pipeline(cxt, in) : nullptr);
+  if(pipe)
+    pipe->Run(std::cout, interactive);
+
+  while (!pool && !pipe && Next()) {
+    Stmt_Target target; // named by an error with --jsonl
     try {
-      // skip empty & fully commented lines
-      if(str.empty() || str.front() == '#')
-	continue;
-
-      // trim off comments
-      size_t comment = str.find_first_of('#');
-      if(comment != std::string::npos)
-	str.erase(comment); 
-
-      
-      Lexer * lexer = new Lexer(str, cxt);
-      std::vector<Token*> * tokens = new std::vector<Token*>();
-      
-      // lex tokens
-      while(!lexer->Eof())
-	tokens->push_back(lexer->Next());
-
-      // parse tokens
-      Parser * parser = new Parser(*tokens, cxt);
-      parser->Print();
+      Stmt* stmt = cache ? cache->Find(str, cxt->scratch, &target) : nullptr;
+      if(!stmt) {
+	// the parser pulls tokens from the lexer as it goes
+	Lexer lexer = lexed ? Lexer(line, cxt) : Lexer(str, cxt);
+	Parser parser(lexer, cxt);
+	stmt = parser.Parse(&target);
+	if(cache)
+	  cache->Add(str, stmt);
+      }
+      if(aot)
+	aot->Statement(stmt, str);
+      else if(!rowFile) // with --rows only the declarations matter
+	Parser::Print(stmt, std::cout);
     }
     catch (std::runtime_error ex) {
-      std::cout << "Input: " << str << "\n"
+      if(aot)
+	aot->Error(str, ex.what());
+      else if(rowFile)
+	std::cerr << "Input: " << str << "\n"
+		  << "Error: " << ex.what() << "\n\n";
+      else
+	Parser::Print_Error(cxt, str, ex.what(), std::cout, &target);
+    }
+
+    // tokens & unreduced trees of this statement are no longer needed
+    cxt->scratch.Reset();
+    if(interactive)
+      std::cout.flush();
+  }
+
+  if(aot)
+    aot->Write(std::cout);
+
+  // with --branch each file is run on a fork of the variables the input
+  // left, so a branch sees neither another's changes nor is seen by them
+  for(std::unique_ptr<Source>& branch : branches) {
+    std::unique_ptr<Context> fork(cxt->Fork());
+    while(branch->Next(str)) {
+      Stmt_Target target;
+      try {
+	Lexer lexer(str, fork.get());
+	Parser parser(lexer, fork.get());
+	Parser::Print(parser.Parse(&target), std::cout);
+      }
+      catch (std::runtime_error ex) {
+	Parser::Print_Error(fork.get(), str, ex.what(), std::cout, &target);
+      }
+      fork->scratch.Reset();
+      if(interactive)
+	std::cout.flush();
+    }
+  }
+
+  // the variables as they stand become the next snapshot
+  try {
+    if(journal)
+      journal->Checkpoint();
+  }
+  catch (std::runtime_error ex) {
+    std::cerr << "Error: " << ex.what() << "\n";
+    std::cout.rdbuf(console);
+    return 1;
+  }
+
+  // with --rows the expression is evaluated for each row of the file
+  if(rowFile) {
+    try {
+      Lexer lexer(rowExpr, cxt);
+      Parser parser(lexer, cxt);
+      Expr_Stmt* exp = dynamic_cast<Expr_Stmt*>(parser.Parse());
+      if(!exp)
+	throw std::runtime_error("Invalid syntax.");
+      Row_Eval rows(cxt, exp->e, rowFile, fields.get(), filter);
+      unsigned threads = std::thread::hardware_concurrency();
+      rows.Run(std::cout, threads ? threads : 1);
+    }
+    catch (std::runtime_error ex) {
+      std::cerr << "Input: " << rowExpr << "\n"
 		<< "Error: " << ex.what() << "\n\n";
+      std::cout.rdbuf(console);
+      return 1;
     }
   }
 
+  std::cout.flush();
+  std::cout.rdbuf(console);
+  if(writer.Failed()) {
+    std::cerr << "Error: Could not write output.\n";
+    return 1;
+  }
+
+  // High-water marks, kept off standard output
+  if(memoryReport) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    std::cerr << "Statement arena peak: " << cxt->scratch.Peak() << " bytes\n"
+	      << "Arena memory peak: " << Arena::AllPeak() << " bytes\n"
+	      << "Arena memory at exit: " << Arena::AllReserved() << " bytes\n"
+	      << "Variables: " << cxt->SymTable.Size() << "\n"
+	      << "Peak RSS: " << usage.ru_maxrss << " kB\n";
+  }
+
   return 0;
 }
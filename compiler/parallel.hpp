@@ -0,0 +1,239 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include "parser.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Runs the statements of a whole input on several threads (--parallel),
+// with the same output as running them in order. All statements are read
+// and lexed up front to find the identifiers each one reads and the one it
+// declares or reassigns. A statement waits for the last earlier statement
+// writing a name it uses, and a write also waits for the reads of the old
+// value before it, so every lookup, declaration and reassignment sees the
+// symbol table exactly as it would in order. (Parsing binds variables to
+// their values, so it happens when the statement runs, not up front.)
+//
+// Statements whose dependencies are done are run by a work-stealing pool:
+// a worker takes its own earliest ready statement, so output can be written
+// while the rest run, or else steals the latest of another worker's. Each
+// statement's output is buffered and written in input order.
+struct Parallel_Run {
+private:
+  struct Statement {
+    std::string input;
+    std::vector<int> next; // statements waiting on this one
+    std::atomic<int> waiting{0}; // unfinished statements this one waits on
+    std::string output;
+    bool done = false;
+  };
+
+  struct Name_Use { // statements using a name so far
+    int writer = -1; // last one declaring or reassigning it
+    std::vector<int> readers; // readers since then
+  };
+
+  struct Queue { // ready statements of one worker
+    std::mutex m;
+    std::deque<int> ready;
+  };
+
+  Context* cxt;
+  std::deque<Statement> stmts; // stable addresses
+  std::vector<Name_Use> names; // by name number
+
+  // pool state while running
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::atomic<size_t> queued{0}, remaining{0};
+  std::mutex idle, finished;
+  std::mutex symbols; // the context's symbol table, while the workers share it
+  std::condition_variable wake, written;
+
+  void Push(unsigned worker, int s);
+  bool Pop(unsigned worker, int& s);
+  void Work(unsigned worker);
+  void Execute(Statement&, Arena&);
+
+public:
+  Parallel_Run(Context* _cxt) : cxt(_cxt) {}
+  void Add(std::string_view input);
+  void Run(std::ostream&, unsigned threads);
+};
+
+// Adds a statement to the graph. The names it writes are those a
+// declaration (var T x =) or reassignment (x =) would; every other
+// identifier is a read. A statement that does not lex is left with the
+// names before the bad character, as it will only report its error. Names
+// are numbered here even if they are never declared, as the whole input is
+// held anyway.
+void Parallel_Run::Add(std::string_view text) {
+  const int s = int(stmts.size());
+  stmts.emplace_back();
+  Statement& st = stmts.back();
+  st.input = std::string(text);
+
+  std::vector<Token> tokens;
+  Lexer lexer(st.input, cxt);
+  try {
+    for(Token t = lexer.Next(); t.kind != Eof_Tok; t = lexer.Next())
+      tokens.push_back(t);
+  }
+  catch(std::runtime_error&) {}
+
+  int written = -1; // token declared or reassigned
+  if(tokens.size() >= 3 && tokens[0].kind == Var_KW && tokens[2].kind == Id_Tok)
+    written = 2;
+  else if(tokens.size() >= 2 && tokens[0].kind == Id_Tok && tokens[1].kind == Equal_Tok)
+    written = 0;
+
+  auto Name = [&](const Token& t) { return cxt->names->Intern(t.Print(st.input)); };
+  std::vector<int> after; // statements this one waits on
+  std::vector<int> seen;
+  for(size_t k = 0; k < tokens.size(); ++k)
+    if(tokens[k].kind == Id_Tok && int(k) != written) {
+      int name = Name(tokens[k]);
+      if(std::find(seen.begin(), seen.end(), name) == seen.end())
+	seen.push_back(name);
+    }
+  const int wrote = written >= 0 ? Name(tokens[written]) : -1;
+  if(names.size() < cxt->names->Size())
+    names.resize(cxt->names->Size());
+  if(written >= 0) {
+    seen.erase(std::remove(seen.begin(), seen.end(), wrote), seen.end());
+    Name_Use& use = names[wrote];
+    if(use.writer >= 0)
+      after.push_back(use.writer);
+    after.insert(after.end(), use.readers.begin(), use.readers.end());
+    use.writer = s;
+    use.readers.clear();
+  }
+  for(int name : seen) {
+    Name_Use& use = names[name];
+    if(use.writer >= 0)
+      after.push_back(use.writer);
+    use.readers.push_back(s);
+  }
+
+  std::sort(after.begin(), after.end());
+  after.erase(std::unique(after.begin(), after.end()), after.end());
+  for(int a : after)
+    stmts[a].next.push_back(s);
+  st.waiting = int(after.size());
+}
+
+// Runs one statement as main would, into its own output
+void Parallel_Run::Execute(Statement& st, Arena& scratch) {
+  std::ostringstream out;
+  Stmt_Target target;
+  try {
+    Lexer lexer(st.input, cxt);
+    Parser parser(lexer, cxt, &scratch);
+    parser.Print(out, &target);
+  }
+  catch (std::runtime_error ex) {
+    Parser::Print_Error(cxt, st.input, ex.what(), out, &target);
+  }
+  scratch.Reset();
+  st.output = out.str();
+}
+
+void Parallel_Run::Push(unsigned worker, int s) {
+  {
+    std::lock_guard<std::mutex> lock(queues[worker]->m);
+    queues[worker]->ready.push_back(s);
+  }
+  ++queued;
+  std::lock_guard<std::mutex> lock(idle); // no worker misses the wakeup
+  wake.notify_one();
+}
+
+// Takes the earliest of this worker's statements, else steals another's latest
+bool Parallel_Run::Pop(unsigned worker, int& s) {
+  for(size_t k = 0; k < queues.size(); ++k) {
+    Queue& q = *queues[(worker + k) % queues.size()];
+    std::lock_guard<std::mutex> lock(q.m);
+    if(!q.ready.empty()) {
+      if(k == 0) {
+	s = q.ready.front();
+	q.ready.pop_front();
+      }
+      else {
+	s = q.ready.back();
+	q.ready.pop_back();
+      }
+      --queued;
+      return true;
+    }
+  }
+  return false;
+}
+
+void Parallel_Run::Work(unsigned worker) {
+  Arena scratch;
+  for(;;) {
+    int s;
+    if(!Pop(worker, s)) {
+      std::unique_lock<std::mutex> lock(idle);
+      wake.wait(lock, [&] { return queued > 0 || remaining == 0; });
+      if(remaining == 0)
+	return;
+      continue;
+    }
+
+    Statement& st = stmts[s];
+    Execute(st, scratch);
+    for(int n : st.next)
+      if(--stmts[n].waiting == 0)
+	Push(worker, n);
+    {
+      std::lock_guard<std::mutex> lock(finished);
+      st.done = true;
+    }
+    written.notify_all();
+    if(--remaining == 0) {
+      std::lock_guard<std::mutex> lock(idle);
+      wake.notify_all();
+    }
+  }
+}
+
+void Parallel_Run::Run(std::ostream& out, unsigned threads) {
+  queues.clear();
+  for(unsigned t = 0; t < threads; ++t)
+    queues.emplace_back(new Queue);
+  remaining = stmts.size();
+  queued = 0;
+  unsigned t = 0;
+  for(size_t s = 0; s < stmts.size(); ++s)
+    if(stmts[s].waiting == 0)
+      Push(t++ % threads, int(s));
+
+  cxt->symbols = &symbols;
+  std::vector<std::thread> pool;
+  for(unsigned w = 0; w < threads; ++w)
+    pool.emplace_back(&Parallel_Run::Work, this, w);
+
+  for(Statement& st : stmts) {
+    {
+      std::unique_lock<std::mutex> lock(finished);
+      written.wait(lock, [&] { return st.done; });
+    }
+    out << st.output;
+    std::string().swap(st.output);
+  }
+  for(std::thread& w : pool)
+    w.join();
+  cxt->symbols = nullptr;
+}
+
+#endif
@@ -4,12 +4,75 @@
 #include "lexer.hpp"
 #include "expr.hpp"
 #include "stmt.hpp"
+#include "snapshot.hpp"
+#include "store.hpp"
+
+#include <memory>
+#include <vector>
+
+// Binding power of each binary operator token (see Precedence); 0 for any other token
+struct Precedence_Table {
+  unsigned char prec[Token_Kind_Count] = {};
+  constexpr Precedence_Table() {
+    prec[PipePipe_Tok] = Prec_Or;
+    prec[AmpAmp_Tok] = Prec_And;
+    prec[Pipe_Tok] = Prec_Bit_Or;
+    prec[Caret_Tok] = Prec_Bit_Xor;
+    prec[Amp_Tok] = Prec_Bit_And;
+    prec[EqualEqual_Tok] = prec[Not_Equal_Tok] = Prec_Equality;
+    prec[LT_Tok] = prec[GT_Tok] = prec[LTE_Tok] = prec[GTE_Tok] = Prec_Relational;
+    prec[Plus_Tok] = prec[Minus_Tok] = Prec_Additive;
+    prec[Star_Tok] = prec[Slash_Tok] = prec[Percent_Tok] = Prec_Multiplicative;
+  }
+};
+constexpr Precedence_Table Binary_Precedence;
+
+// The variable a declaration or reassignment is for, once the parser knows
+// it; kept by the caller so that an error later in the statement can still
+// name it (see Print_Error)
+struct Stmt_Target {
+  std::string_view name;
+  const Type* type = nullptr;
+};
 
 struct Parser {
 private:
-  std::vector<Token*> tokens;
-  std::vector<Token*>::iterator it;
+  static const unsigned Ring_Size = 4; // lookahead window; must be a power of 2
+  Lexer& lexer; // tokens are pulled from the lexer only as the parser needs them
+  Token ring[Ring_Size]; // tokens lexed but not yet consumed
+  unsigned head; // ring index of the lookahead token
+  unsigned count; // number of tokens in the ring
+  bool lexFailed; // the lexer has thrown for this statement
   Context* cxt;
+  Arena& scratch; // region for the statement's nodes
+  Stmt_Target* target; // filled in for a declaration, if the caller asks
+
+  // Operator waiting on the expression parser's stack for its next operand
+  template<typename Node>
+  struct Frame {
+    enum Kind { Binary, Unary, Paren, Query, Colon } kind;
+    int op; // operator token kind
+    Node e1; // left operand, or condition of ?:
+    Node e2; // true branch of ?: once the colon is seen
+  };
+  // kept on the heap; nesting depth is not limited by the call stack
+  std::vector<Frame<Expr*>> frames;
+  std::vector<Frame<uint32_t>> storeFrames;
+  std::vector<Frame<Expr*>>& Frames(Expr*) { return frames; }
+  std::vector<Frame<uint32_t>>& Frames(uint32_t) { return storeFrames; }
+
+  // ParseExpr builds what it parses with a Tree_Builder, an object per node,
+  // or with --ast=soa a Store_Builder (see store.hpp)
+  struct Tree_Builder {
+    typedef Expr* Node;
+    Parser* p;
+    Node Int(int value) { return p->Make<Int_Expr>(value, p->cxt); }
+    Node Bool(bool value) { return p->Make<Bool_Expr>(value, p->cxt); }
+    Node Var(Var_Decl* var, int value) { return p->Make<Var_Ref>(var, value, p->cxt); }
+    Node Unary(int op, Node e) { return p->MakeUnary(op, e); }
+    Node Binary(int op, Node e1, Node e2) { return p->MakeBinary(op, e1, e2); }
+    Node Cond(Node e1, Node e2, Node e3) { return p->Make<Cond_Expr>(e1, e2, e3, p->cxt); }
+  };
   
   const std::string& GetSyntaxError() {
     static std::string SyntaxError("Invalid syntax.");
@@ -17,103 +80,224 @@ private:
   } // Error message for invalid syntax
 
   // Iteration & validation
-  bool Eof() { return it == tokens.end(); }
-  Token * LookAhead() { return (this->Eof() ? new Punc_Op_Token(Eof_Tok) : *it); }
-  Token * LookAhead(int);
-  void Consume() { ++it; }
-  Token * ConsumeThis();
-  bool Match_If(Token * t, Token_Kind k) { return t->kind == k; } // compares two token kinds
-  bool Match_If(Token_Kind k) { return LookAhead()->kind == k; }
-  Token * Match(Token_Kind k);
-  Token * Require(Token_Kind k);
+  void Fill(); // lexes one more token into the ring
+  void Drain(); // lexes the rest of the statement
+  bool Eof() { return LookAhead().kind == Eof_Tok; }
+  const Token& LookAhead() { if(!count) Fill(); return ring[head]; }
+  const Token& LookAhead(unsigned);
+  void Consume(); // never steps past the Eof_Tok
+  Token ConsumeThis();
+  bool Match_If(const Token& t, Token_Kind k) { return t.kind == k; } // compares two token kinds
+  bool Match_If(Token_Kind k) { return LookAhead().kind == k; }
+  bool Match(Token_Kind k);
+  Token Require(Token_Kind k);
+
+  // Allocates a node in the statement's region
+  template<typename T, typename... Args>
+  T * Make(Args&&... args) { return scratch.Make<T>(std::forward<Args>(args)...); }
+  static void Store(Context*, Var_Decl*, Expr*);
 
   // Parse functions
   Expr * ParseExpr();
-  Expr * ParseCond();
-  Expr * ParseOr();
-  Expr * ParseAnd();
-  Expr * ParseBitXor();
-  Expr * ParseBitOr();
-  Expr * ParseBitAnd();
-  Expr * ParseEqual();
-  Expr * ParseOrdering();
-  Expr * ParseAdd();
-  Expr * ParseMult();
-  Expr * ParseUnary();
-  Expr * ParsePrimary();
+  template<typename B> typename B::Node ParseExpr(B&);
+  template<typename B> typename B::Node ParsePrimary(B&);
+  Expr * MakeBinary(int, Expr*, Expr*);
+  Expr * MakeUnary(int, Expr*);
 
   Stmt * ParseStmt();
   Stmt * ParseDeclStmt();
   Stmt * ParseExprStmt();
   
-  Decl * ParseDecl();
-  Decl * ParseVarDecl();
-  Decl * ParseVarReDecl();
+  Decl_Stmt * ParseDecl();
+  Decl_Stmt * ParseVarDecl();
+  Decl_Stmt * ParseVarReDecl();
 
   const Type * ParseType();
-  const std::string ParseId();
+  Decl * Lookup(const Token&);
   
   
 public:
-  Stmt * Parse() { return ParseStmt(); }
-  void Print();
+  Stmt * Parse(Stmt_Target* = nullptr);
+  void Print(std::ostream& out = std::cout, Stmt_Target* target = nullptr) { Print(Parse(target), out); }
+  static void Print(Stmt*, std::ostream&); // evaluates a parsed statement & prints the result
+  static void Print_Error(Context*, std::string_view input, const char* message, std::ostream&,
+			  const Stmt_Target* = nullptr);
+
+  // Commit a checked expression to a variable as a declaration or a
+  // reassignment does; also used by Ast_Cache, which skips the parser
+  static Decl* Declare(Context*, std::string_view name, const Type*, Expr*);
+  static Decl* Assign(Context*, Var_Decl*, Expr*);
 
   // Constructor
-  Parser(std::vector<Token*> _tokens, Context* _cxt) : tokens(_tokens), cxt(_cxt) {
-    it = tokens.begin();
-  }
+  // nodes go in the context's scratch arena unless another is given (one per thread)
+  Parser(Lexer& _lexer, Context* _cxt, Arena* _scratch = nullptr)
+    : lexer(_lexer), head(0), count(0), lexFailed(false), cxt(_cxt), scratch(_scratch ? *_scratch : _cxt->scratch),
+      target(nullptr) {}
   ~Parser() {}
 };
 
-// Parses tokens and displays results
-void Parser::Print() {
-  Stmt * s = Parse(); // get statement
-  
-  if(Expr_Stmt* exp = dynamic_cast<Expr_Stmt*>(s)) { // Statement is an expressions
-    std::cout << "Input: " << exp->e->Print() << "\n"
-	      << "Result: " << exp->e->Evaluate() << "\n\n";
-  }
+// Displays the results of a statement. Outside the default mode nothing
+// is written until the value is known, so a statement that fails leaves
+// only its error.
+void Parser::Print(Stmt* s, std::ostream& out) {
+  Expr* e = nullptr; // the value to show
+  std::string_view name; // the variable, for declarations
+  if(Expr_Stmt* exp = dynamic_cast<Expr_Stmt*>(s)) // Statement is an expressions
+    e = exp->e;
   else if(Decl_Stmt* dec = dynamic_cast<Decl_Stmt*>(s)) { // Statement is a declaration
     if(Var_Decl* vd = dynamic_cast<Var_Decl*>(dec->d)) { // Declaration is a variable declaration
-      std::cout << "Input: " << vd->name << " = " << vd->fullInit->Print() << "\n"
-      		<< "Result: " << vd->name << " = " << vd->init->Evaluate() << "\n\n";
+      e = vd->init;
+      name = vd->name;
+      if(vd->fullInit) { // only kept for the default mode
+	out << "Input: " << name << " = " << vd->fullInit->Print() << "\n"
+	    << "Result: " << name << " = ";
+	e->Evaluate(out);
+	out << "\n\n";
+	return;
+      }
     }
   }
+  if(!e)
+    return;
+
+  switch(e->cxt->outputMode) {
+  case 'i': // only expressions reach here
+    out << "Input: " << e->Print() << "\n"
+	<< "Result: ";
+    e->Evaluate(out);
+    out << "\n\n";
+    break;
+  case 'r': { // the Result: line alone
+    int value = e->Run();
+    if(!name.empty())
+      out << name << " = ";
+    e->Write_Value(value, out);
+    out << "\n";
+    break;
+  }
+  case 'j': { // ints are numbers in decimal and strings in hex or binary
+    int value = e->Run();
+    const bool quote = e->Check() == &(e->cxt->Int_) && e->cxt->outputFormat != 'd';
+    out << "{\"name\":";
+    if(!name.empty())
+      out << "\"" << name << "\"";
+    else
+      out << "null";
+    out << ",\"type\":\"" << e->Check()->Print() << "\",\"value\":";
+    if(quote)
+      out << "\"";
+    e->Write_Value(value, out);
+    if(quote)
+      out << "\"";
+    out << ",\"error\":null}\n";
+    break;
+  }
+  }
 }
 
-// Peek a given number of tokens ahead
-Token * Parser::LookAhead(int count) {
-  if(this->Eof())
-    return new Punc_Op_Token(Eof_Tok);
+// Displays a statement that failed. With --jsonl the variable of a
+// declaration or reassignment is named as far as it was parsed. Names and
+// messages never need escaping in JSON: identifiers are letters, digits and
+// underscores.
+void Parser::Print_Error(Context* cxt, std::string_view input, const char* message, std::ostream& out,
+			 const Stmt_Target* target) {
+  switch(cxt->outputMode) {
+  case 'i':
+    out << "Input: " << input << "\n"
+	<< "Error: " << message << "\n\n";
+    break;
+  case 'r':
+    out << "Error: " << message << "\n";
+    break;
+  case 'j':
+    out << "{\"name\":";
+    if(target && !target->name.empty())
+      out << "\"" << target->name << "\"";
+    else
+      out << "null";
+    out << ",\"type\":";
+    if(target && target->type)
+      out << "\"" << target->type->Print() << "\"";
+    else
+      out << "null";
+    out << ",\"value\":null,\"error\":\"" << message << "\"}\n";
+    break;
+  }
+}
 
-  std::vector<Token*>::iterator temp = it;
-  
-  for(int i = 0; i < count; ++i) {
-    ++temp;
-    if(temp == tokens.end())
-      return nullptr;
+// Parses the statement. Since the lexer runs ahead of the parser only as
+// far as it needs to, the rest of the statement is lexed on the way out so
+// that an invalid character is reported wherever it is, as it was when
+// the whole statement was lexed first.
+Stmt * Parser::Parse(Stmt_Target* _target) {
+  target = _target;
+  try {
+    return ParseStmt();
+  }
+  catch(std::runtime_error&) {
+    Drain(); // a lexical error takes precedence over this one
+    throw;
+  }
+}
+
+// Lexes the next token into the ring
+void Parser::Fill() {
+  try {
+    ring[(head + count) & (Ring_Size - 1)] = lexer.Next();
+    ++count;
+  }
+  catch(std::runtime_error&) {
+    lexFailed = true;
+    throw;
   }
-  return *temp;
+}
+
+// Lexes (and drops) everything left in the statement, unless lexing failed already
+void Parser::Drain() {
+  if(lexFailed)
+    return;
+  while(!Eof())
+    Consume();
+}
+
+// Peek a given number of tokens ahead; past the end this is the Eof_Tok
+const Token& Parser::LookAhead(unsigned steps) {
+  while(count <= steps) {
+    if(count && ring[(head + count - 1) & (Ring_Size - 1)].kind == Eof_Tok)
+      return ring[(head + count - 1) & (Ring_Size - 1)];
+    Fill();
+  }
+  return ring[(head + steps) & (Ring_Size - 1)];
+}
+
+// Steps to the next token
+void Parser::Consume() {
+  if(Eof())
+    return;
+  head = (head + 1) & (Ring_Size - 1);
+  --count;
 }
 
 // Consumes and returns consumed token
-Token * Parser::ConsumeThis() {
-  Token * t = LookAhead();
+Token Parser::ConsumeThis() {
+  Token t = LookAhead();
   Consume();
   return t;
 }
 
-// Compares lookahead kind to passed token kind, consumes and returns token
-Token * Parser::Match(Token_Kind k) {
-  if(LookAhead()->kind == k)
-    return ConsumeThis();
+// Compares lookahead kind to passed token kind, consumes the token on a match
+bool Parser::Match(Token_Kind k) {
+  if(LookAhead().kind == k) {
+    Consume();
+    return true;
+  }
   else
-    return nullptr;
+    return false;
 }
 
 // Same as Match above but throws exception on a failure
-Token * Parser::Require(Token_Kind k) {
-  if(LookAhead()->kind == k)
+Token Parser::Require(Token_Kind k) {
+  if(LookAhead().kind == k)
     return ConsumeThis();
   else
     throw std::runtime_error("Missing expected symbol: " + Token_Names[k]);
@@ -121,11 +305,11 @@ Token * Parser::Require(Token_Kind k) {
 
 // Parses a statement
 Stmt * Parser::ParseStmt() {
-  switch (LookAhead()->kind) {
+  switch (LookAhead().kind) {
   case Var_KW:
     return ParseDeclStmt(); // var -> declaration
   case Id_Tok:
-    if(LookAhead(1) && Match_If(LookAhead(1), Equal_Tok))
+    if(Match_If(LookAhead(1), Equal_Tok))
       return ParseDeclStmt(); // 'id_token =' -> declaration
   default:
     return ParseExprStmt(); // otherwise expression
@@ -134,20 +318,20 @@ Stmt * Parser::ParseStmt() {
 
 // Parses a declaration statement
 Stmt * Parser::ParseDeclStmt() {
-  Decl* d = ParseDecl();
-  return new Decl_Stmt(d);
+  return ParseDecl();
 }
 
 // Parses an expression statement
 Stmt * Parser::ParseExprStmt() {
   Expr* e = ParseExpr();
   Match(Semicolon_Tok); // allow semicolon but don't require yet
-  return new Expr_Stmt(e);
+  Drain(); // the statement is printed only if all of it lexes
+  return Make<Expr_Stmt>(e);
 }
 
 // Parses a declaration
-Decl * Parser::ParseDecl() {
-  switch (LookAhead()->kind) {
+Decl_Stmt * Parser::ParseDecl() {
+  switch (LookAhead().kind) {
   case Var_KW:
     return ParseVarDecl();
   case Id_Tok:
@@ -159,15 +343,17 @@ Decl * Parser::ParseDecl() {
 }
 
 // Parses a variable declaration
-Decl * Parser::ParseVarDecl() {
+Decl_Stmt * Parser::ParseVarDecl() {
   Require(Var_KW); // require var
   const Type* t = ParseType(); // get type
-  const std::string n = ParseId(); // get identifier
+  const Token id = Require(Id_Tok); // get identifier
+  const std::string_view name = id.Print(lexer.Text());
+  if(target)
+    *target = {name, t};
 
-  if(cxt->FindSymbol(n)) // check for existing var
+  if(Lookup(id)) // check for existing var
     throw std::runtime_error("That variable name already exists.");
   
-  Var_Decl* var = new Var_Decl(cxt, n, t);
   Require(Equal_Tok); // require =
   
   Expr* e = ParseExpr();
@@ -175,20 +361,19 @@ Decl * Parser::ParseVarDecl() {
   if(e->Check() != t) // compare var type to expr type
     throw std::runtime_error("Expression type does not match variable type.");
 
-  var->fullInit = e; // store expanded expression for printing
-  var->init = e->Precompute(); // store compressed expression for calculations
-  
   Match(Semicolon_Tok); // allow semicolon
-  cxt->InsertSymbol(var); // add var to symbol table
-  
-  return var;
+  Drain(); // nothing is committed unless all of the statement lexes
+
+  return Make<Decl_Stmt>(Declare(cxt, name, t, e), e);
 }
 
 // Parses a variable reassignment
-Decl * Parser::ParseVarReDecl() {
-  Id_Token* t = dynamic_cast<Id_Token*>(Require(Id_Tok)); // get identifier
+Decl_Stmt * Parser::ParseVarReDecl() {
+  Token t = Require(Id_Tok); // get identifier
 
-  if(Var_Decl* var = dynamic_cast<Var_Decl*>(cxt->FindSymbol(t->name))) {
+  if(Var_Decl* var = dynamic_cast<Var_Decl*>(Lookup(t))) {
+    if(target)
+      *target = {var->name, var->type};
     Require(Equal_Tok); // require =
 
     Expr* e = ParseExpr();
@@ -196,22 +381,71 @@ Decl * Parser::ParseVarReDecl() {
     if(e->Check() != var->type) // compare var type to expr type
       throw std::runtime_error("Expression type does not match variable type.");
 
-    var->fullInit = e; // store expanded expression for printing
-    var->init = e->Precompute(); // store compressed expression for calculations
-
     Match(Semicolon_Tok); // allow semicolon
-    cxt->UpdateSymbol(var->getName(), var); // update var on symbol table
-    
-    return var;
+    Drain(); // nothing is committed unless all of the statement lexes
+
+    return Make<Decl_Stmt>(Assign(cxt, var, e), e, true);
   }
 
   throw std::runtime_error("Variable does not exist.");
   
 }
 
+// Declares a new variable holding e. Its name is numbered only now, so
+// names that are merely read, or whose declaration fails, are not kept.
+Decl * Parser::Declare(Context* cxt, std::string_view name, const Type* t, Expr* e) {
+  std::unique_ptr<Var_Decl> var(new Var_Decl(cxt, -1, name, t)); // freed if evaluation fails
+  Store(cxt, var.get(), e);
+  var->id = cxt->names->Intern(name);
+  var->name = cxt->names->Name(var->id);
+  
+  cxt->InsertSymbol(var.get()); // add var to symbol table
+  if(cxt->journal)
+    cxt->journal->Record(var.get());
+  
+  return var.release();
+}
+
+// Gives an existing variable the value of e
+Decl * Parser::Assign(Context* cxt, Var_Decl* var, Expr* e) {
+  std::unique_ptr<Var_Decl> copy; // freed if evaluation fails
+  if(!cxt->OwnsSymbol(var->id)) { // a fork shares it, so this context gets a copy of its own
+    copy.reset(new Var_Decl(cxt, var->id, var->name, var->type));
+    var = copy.get();
+  }
+
+  Store(cxt, var, e); // releases the previous value
+
+  cxt->UpdateSymbol(var->id, var); // update var on symbol table
+  copy.release();
+  if(cxt->journal)
+    cxt->journal->Record(var);
+    
+  return var;
+}
+
+// Moves a checked expression out of the statement's region into the
+// variable's own region, then drops whatever the variable held before
+void Parser::Store(Context* cxt, Var_Decl* var, Expr* e) {
+  // The expression is only kept for printing in the default mode, and a
+  // literal prints as its value does. The region is sized to fit, as an input
+  // may declare very many variables.
+  const bool copy = cxt->outputMode == 'i' && e->kind > Flat_Int;
+  size_t bytes = Arena::Bytes<Int_Expr>() + 16; // as big as a Bool_Expr; and padding between the parts
+  if(copy) {
+    Store_Expr* s = dynamic_cast<Store_Expr*>(e);
+    bytes += s ? s->Bytes() : e->size * Arena::Bytes<Cond_Expr>();
+  }
+  Arena storage(bytes);
+  Expr* init = e->Precompute(storage); // store compressed expression for calculations
+  var->fullInit = copy ? e->Clone(storage) : cxt->outputMode == 'i' ? init : nullptr; // store expanded expression for printing
+  var->init = init;
+  var->storage.Swap(storage); // old init & fullInit are freed with 'storage'
+}
+
 // Parses a type identifier
 const Type * Parser::ParseType() {
-  switch(LookAhead()->kind) {
+  switch(LookAhead().kind) {
   case Bool_KW:
     Consume();
     return &(cxt->Bool_);
@@ -222,229 +456,151 @@ const Type * Parser::ParseType() {
   throw std::runtime_error("Missing variable type definition.");
 }
 
-// Parses an identifier
-const std::string Parser::ParseId() {
-  return dynamic_cast<Id_Token*>(Require(Id_Tok))->name;
+// Parses an identifier into its number
+// The declaration an identifier names. One the lexer did not know may have
+// been declared since, if its line was lexed ahead (--lex-threads).
+Decl * Parser::Lookup(const Token& t) {
+  return t.value >= 0 ? cxt->FindSymbol(t.value) : cxt->FindSymbol(t.Print(lexer.Text()));
 }
 
-// Parse expression
+// Parses an expression into a tree of the kind the context asks for
 Expr * Parser::ParseExpr() {
-  return ParseCond();
-}
-
-// Parse conditional
-Expr * Parser::ParseCond() {
-  Expr * e = ParseOr();
-  while(true) {
-    if(Match_If(Query_Tok)) {
-      Consume();
-      Expr * e1 = ParseExpr();
-      if(Match_If(Colon_Tok)) {
-	Consume();
-	e = new Cond_Expr(e, e1, ParseExpr(), cxt);
-      }
-      else
-	throw std::runtime_error(GetSyntaxError());
-    }
-    else
-      return e;
+  if(cxt->ast == 's') {
+    Store_Builder b(scratch, cxt);
+    ParseExpr(b);
+    return b.Finish();
   }
+  Tree_Builder b = { this };
+  return ParseExpr(b);
 }
 
-// Parse logical OR
-Expr * Parser::ParseOr() {
-  Expr * e = ParseAnd();
+// Parses an expression. Rather than one recursive call per precedence
+// level, operators still waiting for their right operand are kept on an
+// explicit stack (frames), so nesting depth is bounded only by memory.
+// Binary operators are left associative and ?: is right associative.
+// Nodes are built in the same order the recursive grammar built them,
+// so the same type error is reported first.
+template<typename B>
+typename B::Node Parser::ParseExpr(B& b) {
+  typedef typename B::Node Node;
+  typedef Frame<Node> F;
+  std::vector<F>& frames = Frames(Node());
+  frames.clear();
   while(true) {
-    if(Match_If(PipePipe_Tok)) {
-      Consume();
-      e = new Or_Expr(e, ParseAnd(), cxt);
-    }
-    else
-      return e;
-  }
-}
-
-// Parse logical AND
-Expr * Parser::ParseAnd() {
-  Expr * e = ParseBitOr();
-  while(true) {
-    if(Match_If(AmpAmp_Tok)) {
+    // prefix operators & open parentheses
+    while(true) {
+      int k = LookAhead().kind;
+      if(k == Bang_Tok || k == Minus_Tok || k == Tilde_Tok)
+	frames.push_back({F::Unary, k, Node(), Node()});
+      else if(k == LParen_Tok)
+	frames.push_back({F::Paren, k, Node(), Node()});
+      else
+	break;
       Consume();
-      e = new And_Expr(e, ParseBitOr(), cxt);
     }
-    else
-      return e;
-  }
-}
 
-// Parse bitwise OR
-Expr * Parser::ParseBitOr() {
-  Expr * e = ParseBitXor();
-  while(true) {
-    if(Match_If(Pipe_Tok)) {
-      Consume();
-      e = new Bit_Or_Expr(e, ParseBitXor(), cxt);
-    }
-    else
-      return e;
-  }
-}
+    Node e = ParsePrimary(b);
 
-// Parse bitwise XOR
-Expr * Parser::ParseBitXor() {
-  Expr * e = ParseBitAnd();
-  while(true) {
-    if(Match_If(Caret_Tok)) {
-      Consume();
-      e = new Bit_Xor_Expr(e, ParseBitAnd(), cxt);
-    }
-    else
-      return e;
-  }
-}
+    // reduce until an operator needs another operand
+    while(true) {
+      while(!frames.empty() && frames.back().kind == F::Unary) {
+	e = b.Unary(frames.back().op, e);
+	frames.pop_back();
+      }
 
-// Parse bitwise AND
-Expr * Parser::ParseBitAnd() {
-  Expr * e = ParseEqual();
-  while(true) {
-    if(Match_If(Amp_Tok)) {
-      Consume();
-      e = new Bit_And_Expr(e, ParseEqual(), cxt);
-    }
-    else
-      return e;
-  }
-}
+      int k = LookAhead().kind;
+      int prec = Binary_Precedence.prec[k];
+      while(!frames.empty() && frames.back().kind == F::Binary
+	    && Binary_Precedence.prec[frames.back().op] >= prec) {
+	e = b.Binary(frames.back().op, frames.back().e1, e);
+	frames.pop_back();
+      }
 
-// Parse equality & inequality
-Expr * Parser::ParseEqual() {
-  Expr * e = ParseOrdering();
-  while(true) {
-    if(Match_If(EqualEqual_Tok)) {
-      Consume();
-      e = new Equal_Equal_Expr(e, ParseOrdering(), cxt);
-    }
-    else if(Match_If(Not_Equal_Tok)) {
-      Consume();
-      e = new Not_Equal_Expr(e, ParseOrdering(), cxt);
-    }
-    else
-      return e;
-  }
-}
+      if(prec || k == Query_Tok) { // operand of a binary operator or condition of ?:
+	frames.push_back({prec ? F::Binary : F::Query, k, e, Node()});
+	Consume();
+	break;
+      }
 
-// Parse <, >, <=, >=
-Expr * Parser::ParseOrdering() {
-  Expr * e = ParseAdd();
-  while(true) {
-    if(Match_If(LT_Tok)) {
-      Consume();
-      e = new Less_Than_Expr(e, ParseAdd(), cxt);
-    }
-    else if(Match_If(GT_Tok)) {
-      Consume();
-      e = new Greater_Than_Expr(e, ParseAdd(), cxt);
-    }
-    else if(Match_If(LTE_Tok)) {
-      Consume();
-      e = new Less_Than_Equal_Expr(e, ParseAdd(), cxt);
-    }
-    else if(Match_If(GTE_Tok)) {
-      Consume();
-      e = new Greater_Than_Equal_Expr(e, ParseAdd(), cxt);
-    }
-    else
-      return e;
-  }
-}
+      // anything else closes the innermost frame
+      if(frames.empty())
+	return e;
 
-// Parse addition & subtraction
-Expr * Parser::ParseAdd() {
-  Expr * e = ParseMult();
-  while(true) {
-    if(Match_If(Plus_Tok)) {
-      Consume();
-      e = new Add_Expr(e, ParseMult(), cxt);
-    }
-    else if(Match_If(Minus_Tok)) {
-      Consume();
-      e = new Sub_Expr(e, ParseMult(), cxt);
+      F& f = frames.back();
+      if(f.kind == F::Colon) {
+	e = b.Cond(f.e1, f.e2, e);
+	frames.pop_back();
+      }
+      else if(f.kind == F::Query && k == Colon_Tok) {
+	f.kind = F::Colon;
+	f.e2 = e;
+	Consume();
+	break;
+      }
+      else if(f.kind == F::Paren && k == RParen_Tok) {
+	frames.pop_back();
+	Consume();
+      }
+      else
+	throw std::runtime_error(GetSyntaxError());
     }
-    else
-      return e;
   }
 }
 
-// Parse multiplication, division, & modulo
-Expr * Parser::ParseMult() {
-  Expr * e = ParseUnary();
-  while(true) {
-    if(Match_If(Star_Tok)) {
-      Consume();
-      e = new Mult_Expr(e, ParseUnary(), cxt);
-    }
-    else if(Match_If(Slash_Tok)) {
-      Consume();
-      e = new Div_Expr(e, ParseUnary(), cxt);
-    }
-    else if(Match_If(Percent_Tok)) {
-      Consume();
-      e = new Rem_Expr(e, ParseUnary(), cxt);
-    }
-    else
-      return e;
+// Builds the node for a binary operator token
+Expr * Parser::MakeBinary(int op, Expr * e1, Expr * e2) {
+  switch(op) {
+  case PipePipe_Tok: return Make<Or_Expr>(e1, e2, cxt);
+  case AmpAmp_Tok: return Make<And_Expr>(e1, e2, cxt);
+  case Pipe_Tok: return Make<Bit_Or_Expr>(e1, e2, cxt);
+  case Caret_Tok: return Make<Bit_Xor_Expr>(e1, e2, cxt);
+  case Amp_Tok: return Make<Bit_And_Expr>(e1, e2, cxt);
+  case EqualEqual_Tok: return Make<Equal_Equal_Expr>(e1, e2, cxt);
+  case Not_Equal_Tok: return Make<Not_Equal_Expr>(e1, e2, cxt);
+  case LT_Tok: return Make<Less_Than_Expr>(e1, e2, cxt);
+  case GT_Tok: return Make<Greater_Than_Expr>(e1, e2, cxt);
+  case LTE_Tok: return Make<Less_Than_Equal_Expr>(e1, e2, cxt);
+  case GTE_Tok: return Make<Greater_Than_Equal_Expr>(e1, e2, cxt);
+  case Plus_Tok: return Make<Add_Expr>(e1, e2, cxt);
+  case Minus_Tok: return Make<Sub_Expr>(e1, e2, cxt);
+  case Star_Tok: return Make<Mult_Expr>(e1, e2, cxt);
+  case Slash_Tok: return Make<Div_Expr>(e1, e2, cxt);
+  case Percent_Tok: return Make<Rem_Expr>(e1, e2, cxt);
+  default: break;
   }
+  throw std::runtime_error(GetSyntaxError());
 }
 
-// Parse logical NOT, arithmetic negation, & bitwise complement
-Expr * Parser::ParseUnary() {
-  if(Match_If(Bang_Tok)) {
-    Consume();
-    return new Not_Expr(ParseUnary(), cxt);
+// Builds the node for logical NOT, arithmetic negation, or bitwise complement
+Expr * Parser::MakeUnary(int op, Expr * e) {
+  switch(op) {
+  case Bang_Tok: return Make<Not_Expr>(e, cxt);
+  case Minus_Tok: return Make<Neg_Expr>(e, cxt);
+  case Tilde_Tok: return Make<Bit_Comp_Expr>(e, cxt);
+  default: break;
   }
-  else if(Match_If(Minus_Tok)) {
-    Consume();
-    return new Neg_Expr(ParseUnary(), cxt);
-  }
-  else if(Match_If(Tilde_Tok)) {
-    Consume();
-    return new Bit_Comp_Expr(ParseUnary(), cxt);
-  }
-  else
-    return ParsePrimary();
+  throw std::runtime_error(GetSyntaxError());
 }
 
-// Parse integers, booleans, parenthesized expressions, & identifiers 
-Expr * Parser::ParsePrimary() {
+// Parse integers, booleans, & identifiers; ParseExpr handles parentheses 
+template<typename B>
+typename B::Node Parser::ParsePrimary(B& b) {
   if(Match_If(Int_Tok)) {
-    Token * t = LookAhead();
-    Consume();
-    return new Int_Expr(dynamic_cast<Int_Token*>(t)->value, cxt);
+    return b.Int(ConsumeThis().value);
   }
   else if(Match_If(True_KW)) {
     Consume();
-    return new Bool_Expr(true, cxt);
+    return b.Bool(true);
   }
   else if(Match_If(False_KW)) {
     Consume();
-    return new Bool_Expr(false, cxt);
-  }
-  else if(Match_If(LParen_Tok)) {
-    Consume();
-    Expr * e = ParseExpr();
-    if(Match_If(RParen_Tok)) {
-      Consume();
-      return e;
-    }
-    else
-      throw std::runtime_error(GetSyntaxError());
+    return b.Bool(false);
   }
   else if(Match_If(Id_Tok)) {
-    Token * t = LookAhead();
-    Consume();
+    Token t = ConsumeThis();
     
-    if(Var_Decl * vd = dynamic_cast<Var_Decl*>(cxt->FindSymbol(dynamic_cast<Id_Token*>(t)->name)))
-      return vd->init;
+    if(Var_Decl * vd = dynamic_cast<Var_Decl*>(Lookup(t)))
+      return b.Var(vd, vd->init->Eval());
     
     throw std::runtime_error("Undeclared variable.");       
   }
@@ -0,0 +1,246 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include "parser.hpp"
+#include "source.hpp"
+#include "writer.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+// Bounded single-producer single-consumer queue. The producer only writes
+// tail and the consumer only writes head, so neither side takes a lock; a
+// full or empty ring makes the waiting side wait, which is what holds a
+// fast stage back to the pace of a slow one. A waiting side yields for a
+// short while, then sleeps until the other side pushes or pops, so stages
+// held up by a read(2) that blocks take no CPU.
+template<typename T, size_t N>
+struct Spsc_Ring {
+  static_assert((N & (N - 1)) == 0, "ring size must be a power of 2");
+
+private:
+  T items[N];
+  alignas(64) std::atomic<size_t> head{0}; // next item to pop
+  alignas(64) std::atomic<size_t> tail{0}; // next free place
+  std::atomic<int> sleepers{0};
+  std::mutex m;
+  std::condition_variable ready;
+
+  static const int Spins = 64; // yields before sleeping
+
+  template<typename F> void Wait(F done);
+  void Wake();
+
+public:
+  bool Try_Push(const T& v) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if(t - head.load(std::memory_order_acquire) == N)
+      return false;
+    items[t & (N - 1)] = v;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+  bool Try_Pop(T& v) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if(h == tail.load(std::memory_order_acquire))
+      return false;
+    v = items[h & (N - 1)];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+  void Push(const T& v) { Wait([&] { return Try_Push(v); }); Wake(); }
+  T Pop() { T v; Wait([&] { return Try_Pop(v); }); Wake(); return v; }
+};
+
+// Retries done() until it succeeds. The fences pair with Wake's: either the
+// other side sees this one asleep, or this one sees what the other side did
+// before it went to sleep.
+template<typename T, size_t N>
+template<typename F>
+void Spsc_Ring<T, N>::Wait(F done) {
+  for(int i = 0; i < Spins; ++i) {
+    if(done())
+      return;
+    std::this_thread::yield();
+  }
+  std::unique_lock<std::mutex> lock(m);
+  sleepers.fetch_add(1);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  ready.wait(lock, done);
+  sleepers.fetch_sub(1);
+}
+
+template<typename T, size_t N>
+void Spsc_Ring<T, N>::Wake() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if(sleepers.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lock(m);
+    ready.notify_all();
+  }
+}
+
+// Runs the input through three threads (--pipeline) with the same output
+// as the sequential loop in main:
+//  - a reader fills fixed input blocks with read(2);
+//  - the front end splits blocks into statements (as Source does, carrying
+//    a partial line over to the next block), then lexes and parses them.
+//    Declarations take effect here, since later statements are parsed
+//    against them, so their output is formatted here too;
+//  - the back end evaluates expression statements and writes all output
+//    in order.
+// Stages pass block and statement numbers over Spsc_Rings, and used ones
+// go back the same way, so a slow stage stalls the others once the fixed
+// supply of blocks or statements runs out. Each statement has an arena of
+// its own, since its tree outlives the front end's turn with it.
+struct Pipeline {
+  static const size_t Block_Size = 256 << 10;
+  static const int Blocks = 8;
+  static const int Slots = 64; // statements in flight
+
+private:
+  struct Block_Ref {
+    int block;
+    size_t size; // 0 at the end of input
+  };
+  struct Slot {
+    Arena scratch{4096};
+    std::string input;
+    Stmt* stmt = nullptr; // an expression statement left to evaluate
+    std::string text; // else the statement's output
+  };
+
+  Context* cxt;
+  int in;
+  std::unique_ptr<char[]> blocks[Blocks];
+  Slot slots[Slots];
+  Spsc_Ring<Block_Ref, 16> filled;
+  Spsc_Ring<int, 16> emptied;
+  Spsc_Ring<int, 128> parsed; // -1 at the end of input
+  Spsc_Ring<int, 128> freed;
+
+  void Read();
+  void Front();
+  void Statements(const char* first, const char* last);
+  void Statement(std::string_view);
+  void Back(std::ostream&, bool flush);
+
+public:
+  Pipeline(Context* _cxt, int _in) : cxt(_cxt), in(_in) {
+    for(int b = 0; b < Blocks; ++b) {
+      blocks[b].reset(new char[Block_Size]);
+      emptied.Push(b);
+    }
+    for(int s = 0; s < Slots; ++s)
+      freed.Push(s);
+  }
+  void Run(std::ostream&, bool flush = false); // flush after every statement, as for a terminal
+};
+
+void Pipeline::Read() {
+  for(;;) {
+    int b = emptied.Pop();
+    ssize_t n;
+    do
+      n = read(in, blocks[b].get(), Block_Size);
+    while(n < 0 && errno == EINTR);
+    if(n <= 0) {
+      filled.Push({b, 0});
+      return;
+    }
+    filled.Push({b, size_t(n)});
+  }
+}
+
+void Pipeline::Front() {
+  std::string carry; // start of a line continued in the next block
+  for(;;) {
+    Block_Ref r = filled.Pop();
+    if(!r.size)
+      break;
+    const char* data = blocks[r.block].get();
+    const char* nl = static_cast<const char*>(memrchr(data, '\n', r.size));
+    if(!nl)
+      carry.append(data, r.size);
+    else if(carry.empty())
+      Statements(data, nl + 1);
+    else {
+      carry.append(data, nl + 1 - data);
+      Statements(carry.data(), carry.data() + carry.size());
+      carry.clear();
+    }
+    if(nl)
+      carry.append(nl + 1, data + r.size - (nl + 1));
+    emptied.Push(r.block);
+  }
+  Statements(carry.data(), carry.data() + carry.size());
+  parsed.Push(-1);
+}
+
+void Pipeline::Statements(const char* first, const char* last) {
+  std::string_view text;
+  while(Source::Next_Line(first, last, text))
+    Statement(text);
+}
+
+// Parses a statement into a free slot
+void Pipeline::Statement(std::string_view text) {
+  int k = freed.Pop();
+  Slot& s = slots[k];
+  s.input.assign(text.data(), text.size());
+  s.stmt = nullptr;
+  std::ostringstream out;
+  Stmt_Target target;
+  try {
+    Lexer lexer(s.input, cxt);
+    Parser parser(lexer, cxt, &s.scratch);
+    Stmt* stmt = parser.Parse(&target);
+    if(dynamic_cast<Expr_Stmt*>(stmt))
+      s.stmt = stmt;
+    else
+      Parser::Print(stmt, out);
+  }
+  catch (std::runtime_error ex) {
+    Parser::Print_Error(cxt, s.input, ex.what(), out, &target);
+  }
+  s.text = out.str();
+  parsed.Push(k);
+}
+
+void Pipeline::Back(std::ostream& out, bool flush) {
+  for(int k; (k = parsed.Pop()) >= 0; ) {
+    Slot& s = slots[k];
+    if(s.stmt) {
+      try {
+	Parser::Print(s.stmt, out);
+      }
+      catch (std::runtime_error ex) {
+	Parser::Print_Error(cxt, s.input, ex.what(), out);
+      }
+    }
+    else
+      out << s.text;
+    s.scratch.Reset();
+    freed.Push(k);
+    if(flush)
+      out.flush();
+  }
+}
+
+void Pipeline::Run(std::ostream& out, bool flush) {
+  std::thread reader(&Pipeline::Read, this);
+  std::thread front(&Pipeline::Front, this);
+  Back(out, flush);
+  front.join();
+  reader.join();
+}
+
+#endif
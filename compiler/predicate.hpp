@@ -0,0 +1,215 @@
+#ifndef PREDICATE_HPP
+#define PREDICATE_HPP
+
+#include "batch.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+// Evaluates a bool expression over many rows of variable bindings (bound as
+// for Column_Batch) and returns the rows where it is true. Results are
+// bitmaps of 64 rows per word, so the expression's boolean skeleton (see
+// Filter_Plan) is word-wide AND, OR and NOT. Every node runs on a selection
+// of the rows still live where the tree walker would evaluate it: the right
+// side of && only sees the rows where the left side was true, that of ||
+// the rows where it was false, and each arm of ?: the rows taking it, so
+// later conjuncts of a selective filter touch few rows. Leaves gather their
+// selected rows into dense columns and run through Column_Batch. A row whose
+// evaluation fails never matches and is reported with its Eval_Status.
+struct Predicate {
+  static const size_t Block = 4096; // rows per block
+  static const size_t Words = Block / 64;
+
+  struct Row_Error {
+    size_t row;
+    Eval_Status status;
+  };
+
+private:
+  struct Scratch;
+
+  Filter_Plan plan;
+  int root;
+  size_t vars;
+  std::vector<std::unique_ptr<Column_Batch>> leaves; // batch of each leaf node
+  std::vector<std::vector<int>> loads; // columns read by each leaf node
+
+  void Eval(int node, const uint64_t* sel, Scratch&) const;
+  void Leaf(int node, const uint64_t* sel, Scratch&) const;
+
+public:
+  Predicate(Expr* e, const std::vector<const Decl*>& vars);
+
+  // columns[k] holds the values of vars[k]; appends the matching rows to
+  // matches and, if given, the rows that failed to errors, both in order
+  void Select(const int* const* columns, size_t rows, std::vector<size_t>& matches,
+	      std::vector<Row_Error>* errors = nullptr) const;
+};
+
+// Per-block state: one bitmap of results and one of selection per node
+struct Predicate::Scratch {
+  const int* const* columns;
+  size_t first, n; // rows [first, first + n)
+  std::vector<uint64_t> bits, sel;
+  uint64_t failed[Words];
+  uint8_t status[Block];
+  std::vector<uint32_t> rows; // the selection vector of a leaf
+  std::vector<std::vector<int>> dense; // gathered columns
+  std::vector<const int*> pointers;
+  std::vector<int> result;
+  std::vector<uint8_t> results; // status of each gathered row
+};
+
+Predicate::Predicate(Expr* e, const std::vector<const Decl*>& _vars) : vars(_vars.size()) {
+  if(e->Check() != &(e->cxt->Bool_))
+    throw std::runtime_error(e->GetTypeError());
+  root = e->Filter(plan);
+  leaves.resize(plan.nodes.size());
+  loads.resize(plan.nodes.size());
+  for(size_t k = 0; k < plan.nodes.size(); ++k)
+    if(plan.nodes[k].kind == Filter_Node::Leaf) {
+      leaves[k].reset(new Column_Batch(plan.nodes[k].leaf, _vars));
+      for(size_t v = 0; v < vars; ++v)
+	if(leaves[k]->Loads(int(v)))
+	  loads[k].push_back(int(v));
+    }
+}
+
+// Leaves its result in s.bits for node, zero outside sel and on failed rows
+void Predicate::Eval(int node, const uint64_t* sel, Scratch& s) const {
+  const Filter_Node& f = plan.nodes[node];
+  uint64_t* out = s.bits.data() + node * Words;
+  uint64_t* next = s.sel.data() + node * Words; // selection of the later operands
+  auto Bits = [&](int k) { return k < 0 ? nullptr : s.bits.data() + k * Words; };
+  const uint64_t* a = Bits(f.a), * b = Bits(f.b), * c = Bits(f.c); // operand results
+
+  switch(f.kind) {
+  case Filter_Node::Leaf:
+    Leaf(node, sel, s);
+    break;
+  case Filter_Node::Constant:
+    for(size_t w = 0; w < Words; ++w)
+      out[w] = f.value ? sel[w] : 0;
+    break;
+  case Filter_Node::Not:
+    Eval(f.a, sel, s);
+    for(size_t w = 0; w < Words; ++w)
+      out[w] = sel[w] & ~a[w] & ~s.failed[w];
+    break;
+  case Filter_Node::And: // e2 runs where e1 is true
+    Eval(f.a, sel, s);
+    for(size_t w = 0; w < Words; ++w)
+      next[w] = a[w] & ~s.failed[w];
+    Eval(f.b, next, s);
+    for(size_t w = 0; w < Words; ++w)
+      out[w] = a[w] & b[w];
+    break;
+  case Filter_Node::Or: // e2 runs where e1 is false
+    Eval(f.a, sel, s);
+    for(size_t w = 0; w < Words; ++w)
+      next[w] = sel[w] & ~a[w] & ~s.failed[w];
+    Eval(f.b, next, s);
+    for(size_t w = 0; w < Words; ++w)
+      out[w] = a[w] | b[w];
+    break;
+  case Filter_Node::Bit_And: case Filter_Node::Bit_Or: case Filter_Node::Bit_Xor: // both sides run
+    Eval(f.a, sel, s);
+    for(size_t w = 0; w < Words; ++w)
+      next[w] = sel[w] & ~s.failed[w];
+    Eval(f.b, next, s);
+    for(size_t w = 0; w < Words; ++w) {
+      uint64_t r = f.kind == Filter_Node::Bit_And ? a[w] & b[w] : f.kind == Filter_Node::Bit_Or ? a[w] | b[w] : a[w] ^ b[w];
+      out[w] = r & next[w] & ~s.failed[w];
+    }
+    break;
+  case Filter_Node::Cond: // e2 runs where e1 is true, e3 where it is false
+    Eval(f.a, sel, s);
+    for(size_t w = 0; w < Words; ++w)
+      next[w] = a[w] & ~s.failed[w];
+    Eval(f.b, next, s);
+    for(size_t w = 0; w < Words; ++w)
+      next[w] = sel[w] & ~a[w] & ~s.failed[w];
+    Eval(f.c, next, s);
+    for(size_t w = 0; w < Words; ++w)
+      out[w] = b[w] | c[w];
+    break;
+  }
+}
+
+// Runs a leaf on the selected rows: all of them in place if the whole block
+// is selected, else gathered into dense columns first
+void Predicate::Leaf(int node, const uint64_t* sel, Scratch& s) const {
+  uint64_t* out = s.bits.data() + node * Words;
+  s.rows.clear();
+  for(size_t w = 0; w < Words; ++w) {
+    out[w] = 0;
+    for(uint64_t m = sel[w]; m; m &= m - 1)
+      s.rows.push_back(uint32_t(w * 64 + __builtin_ctzll(m)));
+  }
+  const size_t count = s.rows.size();
+  if(!count)
+    return;
+
+  if(count == s.n)
+    for(int v : loads[node])
+      s.pointers[v] = s.columns[v] + s.first;
+  else
+    for(int v : loads[node]) {
+      const int* column = s.columns[v] + s.first;
+      int* dense = s.dense[v].data();
+      for(size_t j = 0; j < count; ++j)
+	dense[j] = column[s.rows[j]];
+      s.pointers[v] = dense;
+    }
+  leaves[node]->Evaluate(s.pointers.data(), count, s.result.data(), s.results.data());
+
+  for(size_t j = 0; j < count; ++j) {
+    uint32_t r = s.rows[j];
+    uint64_t bit = uint64_t(1) << (r % 64);
+    if(s.results[j]) {
+      s.failed[r / 64] |= bit;
+      s.status[r] = s.results[j];
+    }
+    else if(s.result[j])
+      out[r / 64] |= bit;
+  }
+}
+
+void Predicate::Select(const int* const* columns, size_t rows, std::vector<size_t>& matches,
+		       std::vector<Row_Error>* errors) const {
+  Scratch s;
+  s.columns = columns;
+  s.bits.resize(plan.nodes.size() * Words);
+  s.sel.resize(plan.nodes.size() * Words);
+  s.rows.reserve(Block);
+  s.dense.assign(vars, std::vector<int>(Block));
+  s.pointers.assign(vars, nullptr);
+  s.result.resize(Block);
+  s.results.resize(Block);
+  uint64_t all[Words];
+
+  for(s.first = 0; s.first < rows; s.first += Block) {
+    s.n = rows - s.first < Block ? rows - s.first : Block;
+    for(size_t w = 0; w < Words; ++w) {
+      size_t live = s.n > w * 64 ? s.n - w * 64 : 0;
+      all[w] = live >= 64 ? ~uint64_t(0) : (uint64_t(1) << live) - 1;
+      s.failed[w] = 0;
+    }
+    Eval(root, all, s);
+
+    const uint64_t* out = s.bits.data() + root * Words;
+    for(size_t w = 0; w < Words; ++w)
+      for(uint64_t m = out[w]; m; m &= m - 1)
+	matches.push_back(s.first + w * 64 + __builtin_ctzll(m));
+    if(errors)
+      for(size_t w = 0; w < Words; ++w)
+	for(uint64_t m = s.failed[w]; m; m &= m - 1) {
+	  size_t r = w * 64 + __builtin_ctzll(m);
+	  errors->push_back({s.first + r, Eval_Status(s.status[r])});
+	}
+  }
+}
+
+#endif
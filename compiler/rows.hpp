@@ -0,0 +1,417 @@
+#ifndef ROWS_HPP
+#define ROWS_HPP
+
+#include "batch.hpp"
+#include "predicate.hpp"
+
+#include <charconv>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Evaluates one expression for every row of a file (--rows). Columns are
+// bound by name to variables declared as usual; other columns are ignored
+// and declared variables without a column keep their value. A row file is
+// either CSV with a header line of names, or fixed-width binary rows of
+// 32-bit ints named by --fields.
+//
+// The file is mapped and split into chunks at row boundaries. A pool of
+// workers parses each chunk into columns, runs them through Column_Batch,
+// and formats one line per row: the result, or the row's error. Chunks are
+// written in input order as they complete, and workers stay at most a few
+// chunks ahead of the writer.
+//
+// With --filter the expression must be a bool and runs through a Predicate
+// instead; the output is then the number of each row where it is true,
+// counting from 0, and rows that fail are reported on standard error.
+// Workers number the rows of their own chunk, and the writer adds the rows
+// of the chunks before it.
+//
+// With --engine=jit the expression is compiled to native code once and run
+// a row at a time instead, for either output.
+struct Row_Eval {
+  static const size_t Chunk_Size = 1 << 20; // bytes per chunk
+
+private:
+  struct Failure {
+    size_t row;
+    const std::string* message;
+  };
+  struct Chunk {
+    const char* first;
+    const char* last;
+    std::string text; // formatted results
+    bool done = false;
+    size_t rows = 0; // with --filter, the chunk's rows,
+    std::vector<size_t> matches; // those where the expression is true
+    std::vector<Failure> failures; // and those that fail, in order
+    Chunk(const char* _first = nullptr, const char* _last = nullptr) : first(_first), last(_last) {}
+  };
+
+  Expr* expr;
+  const char* data = nullptr; // the mapping, or "" for an empty file
+  size_t size = 0;
+  size_t header = 0; // bytes before the first row
+  size_t rowSize = 0; // binary rows; 0 for CSV
+  std::vector<const Decl*> vars; // bound variables; column k of a chunk holds vars[k]
+  std::vector<bool> bools; // vars[k] is a bool
+  std::vector<int> fields; // column of each field, or -1 if unbound
+  bool select; // --filter
+  std::unique_ptr<Jit_Code> native; // with --engine=jit; otherwise
+  std::unique_ptr<Column_Batch> batch; // or, with --filter,
+  std::unique_ptr<Predicate> filter;
+
+  void Bind(Context*, const std::string& name);
+  std::vector<Chunk> Split() const;
+  void Parse(const Chunk&, std::vector<std::vector<int>>& columns, std::vector<uint8_t>& bad) const;
+  bool Field(std::string_view, int field, std::vector<std::vector<int>>& columns) const;
+  void Evaluate(Chunk&) const;
+  void Native(const std::vector<const int*>& columns, size_t rows, int* result, uint8_t* status) const;
+  void Select(Chunk&, const std::vector<const int*>& columns, const std::vector<uint8_t>& bad) const;
+  void Select(Chunk&, const int* result, const uint8_t* status, const std::vector<uint8_t>& bad) const;
+
+public:
+  // fields names the fields of binary rows; without them the file is CSV.
+  // With select the rows where the expression is true are listed instead.
+  Row_Eval(Context*, Expr*, const char* path, const std::vector<std::string>* fields = nullptr, bool select = false);
+  ~Row_Eval() { if(size) munmap(const_cast<char*>(data), size); }
+  Row_Eval(const Row_Eval&) = delete;
+  Row_Eval& operator=(const Row_Eval&) = delete;
+
+  void Run(std::ostream&, unsigned threads, std::ostream& errors = std::cerr);
+};
+
+Row_Eval::Row_Eval(Context* cxt, Expr* e, const char* path, const std::vector<std::string>* names, bool _select) : expr(e), select(_select) {
+  int fd = open(path, O_RDONLY);
+  if(fd < 0)
+    throw std::runtime_error("Could not open row file.");
+  struct stat st;
+  if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+    void* map = st.st_size ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if(!st.st_size)
+      data = ""; // no rows, and nothing to map
+    else if(map != MAP_FAILED) {
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+      data = static_cast<const char*>(map);
+      size = st.st_size;
+    }
+  }
+  close(fd);
+  if(!data)
+    throw std::runtime_error("Could not map row file.");
+
+  if(names) { // binary: a 32-bit int per field
+    for(const std::string& name : *names)
+      Bind(cxt, name);
+    rowSize = 4 * names->size();
+  }
+  else { // CSV: the first line names the columns
+    const char* end = static_cast<const char*>(memchr(data, '\n', size));
+    header = end ? end - data + 1 : size;
+    std::string_view line(data, end ? end - data : size);
+    if(!line.empty() && line.back() == '\r')
+      line.remove_suffix(1);
+    for(size_t at = 0; at <= line.size(); ) {
+      size_t comma = std::min(line.find(',', at), line.size());
+      std::string_view name = line.substr(at, comma - at);
+      while(!name.empty() && name.front() == ' ')
+	name.remove_prefix(1);
+      while(!name.empty() && name.back() == ' ')
+	name.remove_suffix(1);
+      Bind(cxt, std::string(name));
+      at = comma + 1;
+    }
+  }
+  if(select && expr->Check() != &(cxt->Bool_))
+    throw std::runtime_error(expr->GetTypeError());
+  if(cxt->engine == 'j') { // bound variables are loaded from the row
+    std::unordered_map<const Decl*, int> slots;
+    for(size_t k = 0; k < vars.size(); ++k)
+      slots.emplace(vars[k], int(k));
+    Program p;
+    Compiler c(p, &slots);
+    c.Emit(Op_Return, 0, expr->Lower(c, 0));
+    native.reset(new Jit_Code(p));
+    if(native->Ok())
+      return;
+    native.reset(); // no JIT here
+  }
+  if(select)
+    filter.reset(new Predicate(expr, vars));
+  else
+    batch.reset(new Column_Batch(expr, vars));
+}
+
+// Adds the next field, bound to the variable of that name if there is one
+void Row_Eval::Bind(Context* cxt, const std::string& name) {
+  Var_Decl* var = dynamic_cast<Var_Decl*>(cxt->FindSymbol(name));
+  if(!var || std::find(vars.begin(), vars.end(), var) != vars.end()) {
+    fields.push_back(-1);
+    return;
+  }
+  fields.push_back(int(vars.size()));
+  vars.push_back(var);
+  bools.push_back(var->type == &(cxt->Bool_));
+}
+
+// Chunks of about Chunk_Size bytes that end at row boundaries
+std::vector<Row_Eval::Chunk> Row_Eval::Split() const {
+  std::vector<Chunk> chunks;
+  const char* first = data + header;
+  const char* last = data + size;
+  size_t step = rowSize ? std::max(Chunk_Size / rowSize, size_t(1)) * rowSize : Chunk_Size;
+  while(first != last) {
+    const char* end = last - first > ptrdiff_t(step) ? first + step : last;
+    if(!rowSize && end != last) {
+      const char* nl = static_cast<const char*>(memchr(end, '\n', last - end));
+      end = nl ? nl + 1 : last;
+    }
+    chunks.push_back(Chunk(first, end));
+    first = end;
+  }
+  return chunks;
+}
+
+// Parses one field into its column; false if it is not a value of the variable's type
+bool Row_Eval::Field(std::string_view s, int field, std::vector<std::vector<int>>& columns) const {
+  if(field >= int(fields.size()))
+    return false;
+  int k = fields[field];
+  if(k < 0)
+    return true; // unbound
+  while(!s.empty() && s.front() == ' ')
+    s.remove_prefix(1);
+  while(!s.empty() && s.back() == ' ')
+    s.remove_suffix(1);
+
+  int v;
+  if(bools[k]) {
+    if(s == "true" || s == "1")
+      v = 1;
+    else if(s == "false" || s == "0")
+      v = 0;
+    else
+      return false;
+  }
+  else {
+    auto r = std::from_chars(s.data(), s.data() + s.size(), v);
+    if(r.ec != std::errc() || r.ptr != s.data() + s.size() || s.empty())
+      return false;
+  }
+  columns[k].push_back(v);
+  return true;
+}
+
+// Reads the rows of a chunk into columns; bad[i] is set for rows that do not parse
+void Row_Eval::Parse(const Chunk& c, std::vector<std::vector<int>>& columns, std::vector<uint8_t>& bad) const {
+  if(rowSize) {
+    size_t rows = (c.last - c.first + rowSize - 1) / rowSize;
+    for(auto& column : columns)
+      column.resize(rows);
+    bad.assign(rows, 0);
+    for(size_t i = 0; i < rows; ++i) {
+      const char* row = c.first + i * rowSize;
+      if(c.last - row < ptrdiff_t(rowSize)) { // truncated last row
+	bad[i] = 1;
+	continue;
+      }
+      for(size_t f = 0; f < fields.size(); ++f)
+	if(fields[f] >= 0) {
+	  int v;
+	  memcpy(&v, row + 4 * f, 4);
+	  columns[fields[f]][i] = bools[fields[f]] ? v != 0 : v;
+	}
+    }
+    return;
+  }
+
+  for(const char* p = c.first; p != c.last; ) {
+    const char* end = static_cast<const char*>(memchr(p, '\n', c.last - p));
+    std::string_view line(p, (end ? end : c.last) - p);
+    p = end ? end + 1 : c.last;
+    if(!line.empty() && line.back() == '\r')
+      line.remove_suffix(1);
+    if(line.empty())
+      continue; // blank lines are not rows
+
+    size_t row = bad.size();
+    bool ok = true;
+    int field = 0;
+    for(size_t at = 0; ok && at <= line.size(); ++field) {
+      size_t comma = std::min(line.find(',', at), line.size());
+      ok = Field(line.substr(at, comma - at), field, columns);
+      at = comma + 1;
+    }
+    ok = ok && field == int(fields.size());
+    for(auto& column : columns) // pad the columns of a bad row
+      column.resize(row + 1);
+    bad.push_back(!ok);
+  }
+}
+
+// Parses, evaluates and formats a chunk
+void Row_Eval::Evaluate(Chunk& c) const {
+  std::vector<std::vector<int>> columns(vars.size());
+  std::vector<uint8_t> bad;
+  Parse(c, columns, bad);
+
+  const size_t rows = bad.size();
+  std::vector<const int*> pointers;
+  for(auto& column : columns)
+    pointers.push_back(column.data());
+  if(filter) {
+    Select(c, pointers, bad);
+    return;
+  }
+  std::vector<int> result(rows);
+  std::vector<uint8_t> status(rows);
+  if(native)
+    Native(pointers, rows, result.data(), status.data());
+  else
+    batch->Evaluate(pointers.data(), rows, result.data(), status.data());
+  if(select) {
+    Select(c, result.data(), status.data(), bad);
+    return;
+  }
+
+  const bool isBool = expr->Check() == &(expr->cxt->Bool_);
+  const char format = expr->cxt->outputFormat;
+  for(size_t i = 0; i < rows; ++i) {
+    if(bad[i])
+      c.text += "Error: Invalid row.\n";
+    else if(status[i] == Eval_Overflow)
+      c.text += "Error: " + expr->GetOverflowIntError() + "\n";
+    else if(status[i])
+      c.text += "Error: " + expr->GetUndefBehavError() + "\n";
+    else if(isBool)
+      c.text += result[i] ? "true\n" : "false\n";
+    else {
+      char buf[Int_Chars];
+      c.text.append(buf, Format_Int(buf, result[i], format));
+      c.text += '\n';
+    }
+  }
+}
+
+// Runs the native code on each row in turn
+void Row_Eval::Native(const std::vector<const int*>& columns, size_t rows, int* result, uint8_t* status) const {
+  std::vector<int> slots(columns.size());
+  for(size_t i = 0; i < rows; ++i) {
+    for(size_t k = 0; k < columns.size(); ++k)
+      slots[k] = columns[k][i];
+    status[i] = native->Run(result[i], slots.data());
+  }
+}
+
+// Lists the rows of a chunk where the expression is true, and those that
+// fail: the bad rows, and the rows where evaluation fails
+void Row_Eval::Select(Chunk& c, const std::vector<const int*>& columns, const std::vector<uint8_t>& bad) const {
+  std::vector<size_t> matches;
+  std::vector<Predicate::Row_Error> errors;
+  c.rows = bad.size();
+  filter->Select(columns.data(), c.rows, matches, &errors);
+  static const std::string invalid("Invalid row.");
+  size_t e = 0;
+  for(size_t i = 0; i < c.rows; ++i) {
+    while(e < errors.size() && errors[e].row < i)
+      ++e;
+    if(bad[i])
+      c.failures.push_back({i, &invalid});
+    else if(e < errors.size() && errors[e].row == i)
+      c.failures.push_back({i, errors[e].status == Eval_Overflow ? &expr->GetOverflowIntError() : &expr->GetUndefBehavError()});
+  }
+  for(size_t r : matches)
+    if(!bad[r]) // padded, never evaluated as a row
+      c.matches.push_back(r);
+}
+
+// The same, from a result and status per row
+void Row_Eval::Select(Chunk& c, const int* result, const uint8_t* status, const std::vector<uint8_t>& bad) const {
+  static const std::string invalid("Invalid row.");
+  c.rows = bad.size();
+  for(size_t i = 0; i < c.rows; ++i) {
+    if(bad[i])
+      c.failures.push_back({i, &invalid});
+    else if(status[i])
+      c.failures.push_back({i, status[i] == Eval_Overflow ? &expr->GetOverflowIntError() : &expr->GetUndefBehavError()});
+    else if(result[i])
+      c.matches.push_back(i);
+  }
+}
+
+// Evaluates the chunks on a pool of threads and writes them in order
+void Row_Eval::Run(std::ostream& out, unsigned threads, std::ostream& errors) {
+  std::vector<Chunk> chunks = Split();
+  const size_t window = 4 * size_t(threads); // chunks in flight ahead of the writer
+  std::mutex m;
+  std::condition_variable ready, space;
+  size_t next = 0, written = 0;
+
+  auto Worker = [&] {
+    for(;;) {
+      size_t k;
+      {
+	std::unique_lock<std::mutex> lock(m);
+	space.wait(lock, [&] { return next == chunks.size() || next < written + window; });
+	if(next == chunks.size())
+	  return;
+	k = next++;
+      }
+      Chunk c = chunks[k]; // formatted outside the lock
+      Evaluate(c);
+      {
+	std::lock_guard<std::mutex> lock(m);
+	chunks[k].text.swap(c.text);
+	chunks[k].rows = c.rows;
+	chunks[k].matches.swap(c.matches);
+	chunks[k].failures.swap(c.failures);
+	chunks[k].done = true;
+      }
+      ready.notify_all();
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for(unsigned t = 0; t < threads; ++t)
+    pool.emplace_back(Worker);
+
+  size_t base = 0; // rows in the chunks written so far
+  for(size_t k = 0; k < chunks.size(); ++k) {
+    std::string text;
+    Chunk c;
+    {
+      std::unique_lock<std::mutex> lock(m);
+      ready.wait(lock, [&] { return chunks[k].done; });
+      text.swap(chunks[k].text);
+      c.rows = chunks[k].rows;
+      c.matches.swap(chunks[k].matches);
+      c.failures.swap(chunks[k].failures);
+      written = k + 1;
+    }
+    space.notify_all();
+    char buf[24];
+    for(size_t r : c.matches) {
+      text.append(buf, std::to_chars(buf, buf + sizeof buf, base + r).ptr);
+      text += '\n';
+    }
+    for(const Failure& f : c.failures)
+      errors << "Row " << base + f.row << ": Error: " << *f.message << "\n";
+    base += c.rows;
+    out.write(text.data(), text.size());
+  }
+  for(std::thread& t : pool)
+    t.join();
+}
+
+#endif
@@ -0,0 +1,284 @@
+#ifndef SCAN_HPP
+#define SCAN_HPP
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+// Character classes used by the lexer, one bit each
+enum Char_Class : uint8_t {
+  Space_Char = 1,  // ' ', '\n', '\t', '\v'
+  Id_Char = 2,     // letters, digits and '_'
+  Digit_Char = 4,  // 0-9
+  Hex_Char = 8,    // 0-9, a-f, A-F
+  Bin_Char = 16    // 0, 1
+};
+
+struct Char_Table {
+  uint8_t bits[256];
+};
+
+constexpr Char_Table Make_Char_Table() {
+  Char_Table t = {};
+  t.bits[(unsigned char)' '] = t.bits[(unsigned char)'\n'] = Space_Char;
+  t.bits[(unsigned char)'\t'] = t.bits[(unsigned char)'\v'] = Space_Char;
+  for(int c = 'a'; c <= 'z'; ++c)
+    t.bits[c] |= Id_Char;
+  for(int c = 'A'; c <= 'Z'; ++c)
+    t.bits[c] |= Id_Char;
+  t.bits[(unsigned char)'_'] |= Id_Char;
+  for(int c = '0'; c <= '9'; ++c)
+    t.bits[c] |= Id_Char | Digit_Char | Hex_Char;
+  for(int c = 'a'; c <= 'f'; ++c)
+    t.bits[c] |= Hex_Char;
+  for(int c = 'A'; c <= 'F'; ++c)
+    t.bits[c] |= Hex_Char;
+  t.bits[(unsigned char)'0'] |= Bin_Char;
+  t.bits[(unsigned char)'1'] |= Bin_Char;
+  return t;
+}
+
+constexpr Char_Table Char_Classes = Make_Char_Table();
+
+constexpr bool Is_Class(char c, Char_Class k) { return Char_Classes.bits[(unsigned char)c] & k; }
+
+// A set of scanning routines. Each returns the first position in [p, end)
+// holding a character outside the class it skips, or end.
+struct Scanner {
+  const char* name;
+  const char* (*SkipSpace)(const char* p, const char* end);
+  const char* (*SkipId)(const char* p, const char* end);
+  const char* (*SkipDigits)(const char* p, const char* end);
+  const char* (*SkipHex)(const char* p, const char* end);
+  const char* (*SkipBin)(const char* p, const char* end);
+};
+
+// Scalar fallback: one table lookup per byte
+template<Char_Class K>
+const char* Scalar_Skip(const char* p, const char* end) {
+  while(p != end && Is_Class(*p, K))
+    ++p;
+  return p;
+}
+
+constexpr Scanner Scalar_Scanner = {
+  "scalar",
+  Scalar_Skip<Space_Char>, Scalar_Skip<Id_Char>, Scalar_Skip<Digit_Char>,
+  Scalar_Skip<Hex_Char>, Scalar_Skip<Bin_Char>
+};
+
+#ifdef SCAN_X86
+
+// SSE2: 16 bytes per step. Classes are tested with byte compares; bytes
+// >= 0x80 are negative as signed chars and so fall outside every range.
+namespace sse2 {
+
+inline __m128i InRange(__m128i v, char lo, char hi) {
+  return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)), _mm_cmpgt_epi8(_mm_set1_epi8(hi + 1), v));
+}
+
+template<Char_Class K>
+inline __m128i Classify(__m128i v) {
+  if constexpr(K == Space_Char)
+    return _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))),
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\v'))));
+  else if constexpr(K == Digit_Char)
+    return InRange(v, '0', '9');
+  else if constexpr(K == Bin_Char)
+    return InRange(v, '0', '1');
+  else {
+    __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20)); // folds A-Z onto a-z
+    if constexpr(K == Hex_Char)
+      return _mm_or_si128(InRange(v, '0', '9'), InRange(lower, 'a', 'f'));
+    else
+      return _mm_or_si128(_mm_or_si128(InRange(v, '0', '9'), InRange(lower, 'a', 'z')),
+			  _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+  }
+}
+
+template<Char_Class K>
+const char* Skip(const char* p, const char* end) {
+  while(end - p >= 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    unsigned miss = ~_mm_movemask_epi8(Classify<K>(v)) & 0xFFFF;
+    if(miss)
+      return p + __builtin_ctz(miss);
+    p += 16;
+  }
+  return Scalar_Skip<K>(p, end);
+}
+
+} // namespace sse2
+
+constexpr Scanner SSE2_Scanner = {
+  "sse2",
+  sse2::Skip<Space_Char>, sse2::Skip<Id_Char>, sse2::Skip<Digit_Char>,
+  sse2::Skip<Hex_Char>, sse2::Skip<Bin_Char>
+};
+
+// AVX2: 32 bytes per step. Identifier and hex characters are classified with
+// two 16-entry nibble tables (vpshufb): a byte is in the class when the
+// entries for its low and high nibble share a bit.
+namespace avx2 {
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+AVX2_TARGET inline __m256i Nibble_Classify(__m256i v, __m256i lo_table, __m256i hi_table) {
+  __m256i mask = _mm256_set1_epi8(0x0F);
+  __m256i lo = _mm256_shuffle_epi8(lo_table, _mm256_and_si256(v, mask));
+  __m256i hi = _mm256_shuffle_epi8(hi_table, _mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+  return _mm256_xor_si256(_mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), _mm256_setzero_si256()),
+			  _mm256_set1_epi8(-1));
+}
+
+AVX2_TARGET inline __m256i InRange(__m256i v, char lo, char hi) {
+  return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)),
+			  _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v));
+}
+
+template<Char_Class K>
+AVX2_TARGET inline __m256i Classify(__m256i v) {
+  if constexpr(K == Space_Char)
+    return _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+					   _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))),
+			   _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')),
+					   _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\v'))));
+  else if constexpr(K == Digit_Char)
+    return InRange(v, '0', '9');
+  else if constexpr(K == Bin_Char)
+    return InRange(v, '0', '1');
+  else if constexpr(K == Hex_Char) {
+    // high nibble 3 -> bit 0 (digits), 4 or 6 -> bit 1 (letters); low nibble 0-9 -> bit 0, 1-6 -> bit 1
+    const __m256i lo_table = _mm256_setr_epi8(1, 3, 3, 3, 3, 3, 3, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+					      1, 3, 3, 3, 3, 3, 3, 1, 1, 1, 0, 0, 0, 0, 0, 0);
+    const __m256i hi_table = _mm256_setr_epi8(0, 0, 0, 1, 2, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+					      0, 0, 0, 1, 2, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    return Nibble_Classify(v, lo_table, hi_table);
+  }
+  else {
+    // high nibble 3 -> bit 0 (0-9), 4/6 -> bit 1 (A-O, a-o), 5/7 -> bit 2 (P-Z, p-z), 5 -> bit 3 ('_')
+    const __m256i lo_table = _mm256_setr_epi8(5, 7, 7, 7, 7, 7, 7, 7, 7, 7, 6, 2, 2, 2, 2, 10,
+					      5, 7, 7, 7, 7, 7, 7, 7, 7, 7, 6, 2, 2, 2, 2, 10);
+    const __m256i hi_table = _mm256_setr_epi8(0, 0, 0, 1, 2, 12, 2, 4, 0, 0, 0, 0, 0, 0, 0, 0,
+					      0, 0, 0, 1, 2, 12, 2, 4, 0, 0, 0, 0, 0, 0, 0, 0);
+    return Nibble_Classify(v, lo_table, hi_table);
+  }
+}
+
+template<Char_Class K>
+AVX2_TARGET const char* Skip(const char* p, const char* end) {
+  while(end - p >= 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    unsigned miss = ~unsigned(_mm256_movemask_epi8(Classify<K>(v)));
+    if(miss)
+      return p + __builtin_ctz(miss);
+    p += 32;
+  }
+  return sse2::Skip<K>(p, end);
+}
+
+#undef AVX2_TARGET
+
+} // namespace avx2
+
+constexpr Scanner AVX2_Scanner = {
+  "avx2",
+  avx2::Skip<Space_Char>, avx2::Skip<Id_Char>, avx2::Skip<Digit_Char>,
+  avx2::Skip<Hex_Char>, avx2::Skip<Bin_Char>
+};
+
+#endif // SCAN_X86
+
+// Digit conversion. Each function adds the digits in [p, end), which must
+// all be valid for the base, onto value and returns the result; results
+// that no longer fit in 32 bits are clamped to Digit_Limit. On
+// little-endian targets eight digits are converted at a time with SWAR
+// (SIMD within a 64-bit register).
+constexpr uint64_t Digit_Limit = uint64_t(1) << 32;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define SCAN_SWAR 1
+
+inline uint64_t Load8(const char* p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+// "12345678" -> 12345678
+inline uint64_t Swar_Decimal8(const char* p) {
+  uint64_t v = Load8(p) - 0x3030303030303030;
+  v = (v * 10 + (v >> 8)) & 0x00FF00FF00FF00FF;
+  v = (v * 100 + (v >> 16)) & 0x0000FFFF0000FFFF;
+  return (v * 10000 + (v >> 32)) & 0xFFFFFFFF;
+}
+
+// "89abCDef" -> 0x89abcdef
+inline uint64_t Swar_Hex8(const char* p) {
+  uint64_t v = Load8(p);
+  v = (v & 0x0F0F0F0F0F0F0F0F) + ((v >> 6) & 0x0101010101010101) * 9; // letters have bit 6 set
+  v = ((v << 4) + (v >> 8)) & 0x00FF00FF00FF00FF;
+  v = ((v << 8) + (v >> 16)) & 0x0000FFFF0000FFFF;
+  return ((v << 16) + (v >> 32)) & 0xFFFFFFFF;
+}
+
+// "10110011" -> 0b10110011
+inline uint64_t Swar_Bin8(const char* p) {
+  return ((Load8(p) & 0x0101010101010101) * 0x8040201008040201) >> 56;
+}
+#endif
+
+inline uint64_t Accumulate_Decimal(const char* p, const char* end, uint64_t value) {
+#ifdef SCAN_SWAR
+  for(; end - p >= 8 && value < Digit_Limit; p += 8)
+    value = value * 100000000 + Swar_Decimal8(p);
+#endif
+  for(; p != end && value < Digit_Limit; ++p)
+    value = value * 10 + (*p - '0');
+  return value < Digit_Limit ? value : Digit_Limit;
+}
+
+inline uint64_t Accumulate_Hex(const char* p, const char* end, uint64_t value) {
+#ifdef SCAN_SWAR
+  for(; end - p >= 8 && value < Digit_Limit; p += 8)
+    value = value << 32 | Swar_Hex8(p);
+#endif
+  for(; p != end && value < Digit_Limit; ++p)
+    value = value << 4 | ((*p & 0x0F) + (*p >> 6) * 9);
+  return value < Digit_Limit ? value : Digit_Limit;
+}
+
+inline uint64_t Accumulate_Bin(const char* p, const char* end, uint64_t value) {
+#ifdef SCAN_SWAR
+  for(; end - p >= 8 && value < Digit_Limit; p += 8)
+    value = value << 8 | Swar_Bin8(p);
+#endif
+  for(; p != end && value < Digit_Limit; ++p)
+    value = value << 1 | (*p - '0');
+  return value < Digit_Limit ? value : Digit_Limit;
+}
+
+// Whether the running CPU can use the given scanner
+bool Scanner_Supported(const Scanner& s) {
+#ifdef SCAN_X86
+  if(&s == &AVX2_Scanner)
+    return __builtin_cpu_supports("avx2");
+#endif
+  return true;
+}
+
+// Fastest scanner the running CPU supports, picked once
+const Scanner& Best_Scanner() {
+#ifdef SCAN_X86
+  static const Scanner& best = Scanner_Supported(AVX2_Scanner) ? AVX2_Scanner : SSE2_Scanner;
+  return best;
+#else
+  return Scalar_Scanner;
+#endif
+}
+
+#endif
@@ -0,0 +1,303 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include "expr.hpp"
+#include "decl.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Saved variables, so a restart need not replay all of its input
+// (--snapshot, --journal). A snapshot holds every variable's name, type and
+// value: a header, then fixed-size records, then the names. It is mapped
+// and read straight from the page cache. The journal then lists each later
+// declaration and reassignment as one appended record; a record cut short
+// by a crash is ignored.
+//
+// Snapshots and journals carry a generation. Checkpoint() writes a new
+// snapshot under a new generation beside the old one and renames it into
+// place, then starts the journal over. The file beside it is opened up
+// front, so a snapshot that cannot be written is reported before any
+// input is run rather than only when it is saved. A journal is only replayed over the
+// snapshot of its own generation: an older one is left from a crash
+// between the two steps and is dropped, and a newer one needs a snapshot
+// that was not given, so it is refused.
+//
+// Only values are saved: the unreduced initializer is only ever printed
+// with the statement that declares it, so restored variables have none.
+struct Journal {
+  struct Snapshot_Header {
+    char magic[8];
+    uint64_t generation;
+    uint32_t count; // records
+    uint32_t names; // bytes of names after the records
+  };
+  struct Snapshot_Record {
+    uint32_t name; // offset into the names
+    uint32_t length;
+    int32_t value;
+    uint32_t type; // 0 bool, 1 int
+  };
+  struct Journal_Header {
+    char magic[8];
+    uint64_t generation;
+  };
+  struct Journal_Record { // followed by the name
+    uint32_t length;
+    int32_t value;
+    uint32_t type;
+  };
+
+private:
+  Context* cxt;
+  const char* snapshotPath; // either may be null
+  const char* journalPath;
+  uint64_t generation = 0;
+  int fd = -1; // journal, open for appending
+  int next = -1; // the next snapshot, written and renamed over the old one
+  std::string nextPath;
+  std::mutex m; // statements may run on several threads
+  std::string buffer; // a record being written
+
+  void Load();
+  void Replay();
+  void Start(bool fresh);
+  void Open();
+  void Restore(std::string_view name, uint32_t type, int value);
+  static bool Write(int fd, const char* p, size_t n);
+
+public:
+  // Loads the snapshot, replays the journal over it, and records from then on
+  Journal(Context*, const char* snapshot, const char* journal);
+  ~Journal();
+  Journal(const Journal&) = delete;
+  Journal& operator=(const Journal&) = delete;
+
+  void Record(const Var_Decl*); // a declaration or reassignment just made
+  void Checkpoint(); // saves every variable as a new snapshot and empties the journal
+};
+
+Journal::Journal(Context* _cxt, const char* snapshot, const char* journal)
+  : cxt(_cxt), snapshotPath(snapshot), journalPath(journal) {
+  if(snapshotPath)
+    Load();
+  if(journalPath) {
+    Replay();
+    Start(false);
+  }
+  if(snapshotPath)
+    Open();
+  cxt->journal = this;
+}
+
+Journal::~Journal() {
+  if(fd >= 0)
+    close(fd);
+  if(next >= 0) { // never saved
+    close(next);
+    unlink(nextPath.c_str());
+  }
+}
+
+// Opens the file the next snapshot is written to
+void Journal::Open() {
+  nextPath = std::string(snapshotPath) + ".tmp";
+  next = open(nextPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(next < 0) {
+    if(fd >= 0)
+      close(fd);
+    throw std::runtime_error("Could not write snapshot.");
+  }
+}
+
+bool Journal::Write(int fd, const char* p, size_t n) {
+  while(n) {
+    ssize_t w = write(fd, p, n);
+    if(w < 0 && errno == EINTR)
+      continue;
+    if(w <= 0)
+      return false;
+    p += w;
+    n -= w;
+  }
+  return true;
+}
+
+// Declares a variable with the given value, or gives an existing one the value
+void Journal::Restore(std::string_view name, uint32_t type, int value) {
+  const Type* t = type ? static_cast<const Type*>(&cxt->Int_) : &cxt->Bool_;
+  const int id = cxt->names->Intern(name);
+  Decl* old = cxt->FindSymbol(id);
+  Var_Decl* var = dynamic_cast<Var_Decl*>(old);
+  std::unique_ptr<Var_Decl> copy; // freed if the table cannot take it
+  if(!var || var->type != t || !cxt->OwnsSymbol(id)) {
+    copy.reset(new Var_Decl(cxt, id, cxt->names->Name(id), t));
+    var = copy.get();
+  }
+
+  Arena storage(Arena::Bytes<Int_Expr>());
+  var->init = type ? static_cast<Expr*>(storage.Make<Int_Expr>(value, cxt)) : storage.Make<Bool_Expr>(value != 0, cxt);
+  var->fullInit = nullptr;
+  var->storage.Swap(storage);
+
+  if(!old)
+    cxt->InsertSymbol(var);
+  else if(copy)
+    cxt->UpdateSymbol(id, var);
+  copy.release();
+}
+
+void Journal::Load() {
+  int in = open(snapshotPath, O_RDONLY);
+  if(in < 0)
+    return; // no snapshot yet
+  struct stat st;
+  const char* data = nullptr;
+  if(fstat(in, &st) == 0 && st.st_size >= off_t(sizeof(Snapshot_Header))) {
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, in, 0);
+    if(map != MAP_FAILED)
+      data = static_cast<const char*>(map);
+  }
+  close(in);
+  if(!data)
+    throw std::runtime_error("Could not read snapshot.");
+
+  Snapshot_Header h;
+  memcpy(&h, data, sizeof h);
+  const size_t size = st.st_size;
+  const size_t names = sizeof h + size_t(h.count) * sizeof(Snapshot_Record);
+  if(memcmp(h.magic, "CDSNAP01", 8) || names > size || size - names != h.names) {
+    munmap(const_cast<char*>(data), size);
+    throw std::runtime_error("Invalid snapshot.");
+  }
+  generation = h.generation;
+  for(uint32_t k = 0; k < h.count; ++k) {
+    Snapshot_Record r;
+    memcpy(&r, data + sizeof h + k * sizeof r, sizeof r);
+    if(r.name > h.names || r.length > h.names - r.name)
+      break;
+    Restore(std::string_view(data + names + r.name, r.length), r.type, r.value);
+  }
+  munmap(const_cast<char*>(data), size);
+}
+
+void Journal::Replay() {
+  int in = open(journalPath, O_RDONLY);
+  if(in < 0)
+    return;
+  struct stat st;
+  const char* data = nullptr;
+  if(fstat(in, &st) == 0 && st.st_size >= off_t(sizeof(Journal_Header))) {
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, in, 0);
+    if(map != MAP_FAILED)
+      data = static_cast<const char*>(map);
+  }
+  close(in);
+  if(!data)
+    return; // empty, or only part of a header
+
+  Journal_Header h;
+  memcpy(&h, data, sizeof h);
+  const size_t size = st.st_size;
+  if(!memcmp(h.magic, "CDJRNL01", 8) && h.generation > generation) {
+    munmap(const_cast<char*>(data), size);
+    throw std::runtime_error("Journal is newer than snapshot.");
+  }
+  if(!memcmp(h.magic, "CDJRNL01", 8) && h.generation == generation) {
+    for(size_t at = sizeof h; size - at >= sizeof(Journal_Record); ) {
+      Journal_Record r;
+      memcpy(&r, data + at, sizeof r);
+      at += sizeof r;
+      if(r.length > size - at)
+	break; // cut short
+      Restore(std::string_view(data + at, r.length), r.type, r.value);
+      at += r.length;
+    }
+  }
+  munmap(const_cast<char*>(data), size);
+}
+
+// Opens the journal for appending, first emptying it if fresh or if it
+// belongs to another generation
+void Journal::Start(bool fresh) {
+  if(fd >= 0)
+    close(fd);
+  fd = open(journalPath, O_RDWR | O_CREAT, 0644);
+  if(fd < 0)
+    throw std::runtime_error("Could not open journal.");
+  Journal_Header h;
+  struct stat st;
+  bool ok = !fresh && fstat(fd, &st) == 0 && st.st_size >= off_t(sizeof h) && pread(fd, &h, sizeof h, 0) == sizeof h
+    && !memcmp(h.magic, "CDJRNL01", 8) && h.generation == generation;
+  if(!ok) {
+    memcpy(h.magic, "CDJRNL01", 8);
+    h.generation = generation;
+    if(ftruncate(fd, 0) != 0 || !Write(fd, reinterpret_cast<const char*>(&h), sizeof h))
+      throw std::runtime_error("Could not write journal.");
+  }
+  lseek(fd, 0, SEEK_END);
+}
+
+void Journal::Record(const Var_Decl* var) {
+  if(!journalPath)
+    return;
+  Journal_Record r = { uint32_t(var->name.size()), var->init->Eval(), var->type == &cxt->Int_ };
+  std::lock_guard<std::mutex> lock(m);
+  buffer.assign(reinterpret_cast<const char*>(&r), sizeof r);
+  buffer.append(var->name.data(), var->name.size());
+  if(!Write(fd, buffer.data(), buffer.size())) // one write, so a record is never interleaved
+    throw std::runtime_error("Could not write journal.");
+}
+
+void Journal::Checkpoint() {
+  if(!snapshotPath)
+    return;
+  std::lock_guard<std::mutex> lock(m);
+  ++generation;
+
+  std::string records, names;
+  uint32_t count = 0;
+  cxt->SymTable.Each([&](Decl* d) {
+    const Var_Decl* var = dynamic_cast<const Var_Decl*>(d);
+    if(!var)
+      return;
+    Snapshot_Record r = { uint32_t(names.size()), uint32_t(var->name.size()), var->init->Eval(), var->type == &cxt->Int_ };
+    records.append(reinterpret_cast<const char*>(&r), sizeof r);
+    names.append(var->name.data(), var->name.size());
+    ++count;
+  });
+  Snapshot_Header h;
+  memcpy(h.magic, "CDSNAP01", 8);
+  h.generation = generation;
+  h.count = count;
+  h.names = uint32_t(names.size());
+
+  if(next < 0)
+    Open();
+  bool ok = Write(next, reinterpret_cast<const char*>(&h), sizeof h)
+    && Write(next, records.data(), records.size())
+    && Write(next, names.data(), names.size())
+    && fsync(next) == 0;
+  close(next);
+  next = -1;
+  if(!ok || rename(nextPath.c_str(), snapshotPath) != 0) {
+    unlink(nextPath.c_str());
+    throw std::runtime_error("Could not write snapshot.");
+  }
+
+  if(journalPath)
+    Start(true);
+}
+
+#endif
@@ -0,0 +1,137 @@
+#ifndef SOURCE_HPP
+#define SOURCE_HPP
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Supplies input to main one statement (line) at a time. Regular files given
+// with -f are memory-mapped and the lexer walks the mapped bytes directly;
+// standard input and anything that cannot be mapped (pipes, ttys) are read
+// line by line instead.
+struct Source {
+private:
+  const char* first = nullptr; // current position in the mapping
+  const char* last = nullptr; // end of the mapping
+  void* map = MAP_FAILED; // mapping base, MAP_FAILED when streaming
+  size_t mapSize = 0;
+  std::ifstream file; // used when -f names something that cannot be mapped
+  std::istream* in; // stream read in the fallback path
+  std::string str; // current line in the fallback path; the rest of the input after All()
+
+  bool NextMapped(std::string_view&);
+  bool NextStream(std::string_view&);
+
+public:
+  Source() : in(&std::cin) {} // read standard input
+  Source(const char*); // read the named file
+  ~Source();
+  Source(const Source&) = delete;
+  Source& operator=(const Source&) = delete;
+
+  bool Next(std::string_view& line) { // next non-empty line with comments trimmed
+    return map != MAP_FAILED ? NextMapped(line) : NextStream(line);
+  }
+  std::string_view All(); // the rest of the input at once, to be split with Next_Line
+  static bool Next_Line(const char*& first, const char* last, std::string_view& line);
+};
+
+// Maps the file when possible, otherwise falls back to reading it as a stream
+Source::Source(const char* path) : in(nullptr) {
+  int fd = open(path, O_RDONLY);
+  if(fd < 0)
+    throw std::runtime_error("Could not open input file.");
+
+  struct stat st;
+  if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    mapSize = st.st_size;
+    map = mmap(nullptr, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map != MAP_FAILED) {
+      madvise(map, mapSize, MADV_SEQUENTIAL);
+      first = static_cast<const char*>(map);
+      last = first + mapSize;
+    }
+  }
+  close(fd);
+
+  if(map == MAP_FAILED) { // empty, special, or unmappable file
+    file.open(path);
+    in = &file;
+  }
+}
+
+Source::~Source() {
+  if(map != MAP_FAILED)
+    munmap(map, mapSize);
+}
+
+bool Source::NextMapped(std::string_view& line) {
+  return Next_Line(first, last, line);
+}
+
+// Next non-empty line of the text [first, last), advancing first past it.
+// Splits at newlines and trims comments using memchr, which scans a word
+// (or vector register) at a time rather than byte by byte.
+bool Source::Next_Line(const char*& first, const char* last, std::string_view& line) {
+  while(first != last) {
+    const char* end = static_cast<const char*>(memchr(first, '\n', last - first));
+    if(!end)
+      end = last;
+    const char* start = first;
+    first = (end == last) ? last : end + 1;
+
+    // skip empty & fully commented lines
+    if(start == end || *start == '#')
+      continue;
+
+    // trim off comments
+    if(const char* comment = static_cast<const char*>(memchr(start, '#', end - start)))
+      end = comment;
+
+    line = std::string_view(start, end - start);
+    return true;
+  }
+  return false;
+}
+
+// The unread part of the mapping, or of the stream read into memory
+std::string_view Source::All() {
+  if(map != MAP_FAILED) {
+    std::string_view rest(first, last - first);
+    first = last;
+    return rest;
+  }
+  std::ostringstream ss;
+  ss << in->rdbuf();
+  str = ss.str();
+  return str;
+}
+
+// Same as above for input that has to be read through an istream
+bool Source::NextStream(std::string_view& line) {
+  while(std::getline(*in, str)) {
+    // skip empty & fully commented lines
+    if(str.empty() || str.front() == '#')
+      continue;
+
+    // trim off comments
+    size_t comment = str.find_first_of('#');
+    if(comment != std::string::npos)
+      str.erase(comment);
+
+    line = str;
+    return true;
+  }
+  return false;
+}
+
+#endif
@@ -16,8 +16,10 @@ struct Expr_Stmt : Stmt {
 
 // Declaration statement
 struct Decl_Stmt : Stmt {
-  Decl_Stmt(Decl* _d) : d(_d) {}
+  Decl_Stmt(Decl* _d, Expr* _e = nullptr, bool _assign = false) : d(_d), e(_e), assign(_assign) {}
   Decl* d;
+  Expr* e; // the expression as parsed, before it was reduced
+  bool assign; // a reassignment of an existing variable
 };
 
 #endif
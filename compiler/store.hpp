@@ -0,0 +1,479 @@
+#ifndef STORE_HPP
+#define STORE_HPP
+
+#include "expr.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// A checked expression tree kept field by field (--ast=soa): one array of
+// operators, one of types, one of operand indices and one of values, rather
+// than an object per node with a vtable, a Context* and a Type* in each.
+// Nodes are numbered as in a Flat_Tree, operands first, so the last operand
+// of a node is the node just before it and only the others are stored. A
+// node takes 10 bytes, where an Expr with two operands takes 48 and a
+// destructor record of 24 more, and evaluating or printing a tree reads the
+// arrays from front to back.
+struct Node_Store {
+  struct Var {
+    Var_Decl* var;
+    int value; // when the tree was parsed
+  };
+
+  uint8_t* op = nullptr; // a Flat_Kind
+  uint8_t* type = nullptr; // 0 bool, 1 int
+  uint32_t* a = nullptr; // first operand of a binary operator or ?:
+  int32_t* value = nullptr; // literal value, the variable's number, or the middle operand of ?:
+  Var* vars = nullptr; // each variable the tree reads, once
+  uint32_t count = 0;
+  uint32_t varCount = 0;
+
+  void Copy(const Node_Store&, Arena&); // into arrays of its own in the region
+};
+
+void Node_Store::Copy(const Node_Store& s, Arena& arena) {
+  count = s.count;
+  varCount = s.varCount;
+  op = static_cast<uint8_t*>(arena.Allocate(count, 1));
+  type = static_cast<uint8_t*>(arena.Allocate(count, 1));
+  a = static_cast<uint32_t*>(arena.Allocate(count * sizeof(uint32_t), alignof(uint32_t)));
+  value = static_cast<int32_t*>(arena.Allocate(count * sizeof(int32_t), alignof(int32_t)));
+  vars = static_cast<Var*>(arena.Allocate(varCount * sizeof(Var), alignof(Var)));
+  memcpy(op, s.op, count);
+  memcpy(type, s.type, count);
+  memcpy(a, s.a, count * sizeof(uint32_t));
+  memcpy(value, s.value, count * sizeof(int32_t));
+  if(varCount)
+    memcpy(vars, s.vars, varCount * sizeof(Var));
+}
+
+// A whole tree in a Node_Store, standing in for the root of an Expr tree
+struct Store_Expr : Expr {
+private:
+  Node_Store s; // the root is the last node
+
+  int Lower(Compiler&, uint32_t, int);
+
+public:
+  Store_Expr(const Node_Store&, Context*);
+
+  size_t Bytes() const { // what Copy takes, besides alignment
+    return Arena::Bytes<Store_Expr>() + s.count * (2 + sizeof(uint32_t) + sizeof(int32_t)) + s.varCount * sizeof(Node_Store::Var);
+  }
+  Expr* Copy(Arena& a) {
+    Node_Store copy;
+    copy.Copy(s, a);
+    return a.Make<Store_Expr>(copy, cxt);
+  }
+  int Flatten(Flat_Tree&);
+  int Lower(Compiler& c, int dst) { return Lower(c, s.count - 1, dst); }
+  int Value();
+  void Print_To(std::string&);
+};
+
+// Binding power of the operator at the root of a tree
+static const unsigned char Store_Precedence[Flat_Kind_Count] = {
+  Prec_Atom, Prec_Atom, Prec_Atom, Prec_Unary, Prec_Unary, Prec_Unary,
+  Prec_And, Prec_Or, Prec_Bit_And, Prec_Bit_Or, Prec_Bit_Xor,
+  Prec_Equality, Prec_Equality, Prec_Relational, Prec_Relational, Prec_Relational, Prec_Relational,
+  Prec_Additive, Prec_Additive, Prec_Multiplicative, Prec_Multiplicative, Prec_Multiplicative,
+  Prec_Cond
+};
+
+Store_Expr::Store_Expr(const Node_Store& _s, Context* _cxt) : s(_s) {
+  cxt = _cxt;
+  size = int(s.count);
+  prec = Store_Precedence[s.op[s.count - 1]];
+  ExprType = s.type[s.count - 1] ? static_cast<const Type*>(&cxt->Int_) : &cxt->Bool_;
+}
+
+// Evaluates every node in order, operands first, with no recursion. An
+// error is kept with the node it arose in rather than thrown, and is passed
+// up only where the tree walker would have reached it: never out of the
+// side of &&, || or ?: that is not taken, and from the first operand before
+// the second. So the error that reaches the root is the one the walker
+// would have thrown.
+int Store_Expr::Value() {
+  struct Result {
+    int32_t value;
+    uint32_t status; // an Eval_Status
+  };
+  static thread_local std::vector<Result> results;
+  if(results.size() < s.count)
+    results.resize(s.count);
+  Result* r = results.data();
+
+  for(uint32_t k = 0; k < s.count; ++k) {
+    const uint32_t kind = s.op[k];
+    if(kind <= Flat_Var_Ref) {
+      r[k] = { kind == Flat_Var_Ref ? s.vars[s.value[k]].value : s.value[k], Eval_Ok };
+      continue;
+    }
+    const Result y = r[k - 1];
+    if(kind <= Flat_Neg) { // one operand
+      if(y.status)
+	r[k] = y;
+      else if(kind == Flat_Not)
+	r[k] = { !y.value, Eval_Ok };
+      else if(kind == Flat_Bit_Comp)
+	r[k] = { s.type[k] ? ~y.value : !y.value, Eval_Ok };
+      else
+	r[k].status = Checked_Neg(y.value, r[k].value);
+      continue;
+    }
+    const Result x = r[s.a[k]];
+    if(x.status) {
+      r[k] = x;
+      continue;
+    }
+    switch(kind) {
+    case Flat_And: r[k] = x.value ? y : Result{ false, Eval_Ok }; continue;
+    case Flat_Or: r[k] = x.value ? Result{ true, Eval_Ok } : y; continue;
+    case Flat_Cond: r[k] = x.value ? r[s.value[k]] : y; continue;
+    }
+    if(y.status) {
+      r[k] = y;
+      continue;
+    }
+    r[k].status = Apply_Binary(kind, x.value, y.value, r[k].value);
+  }
+
+  return Checked(Eval_Status(r[s.count - 1].status), r[s.count - 1].value);
+}
+
+// Appends the text as the Expr nodes print it, walking the tree with a
+// stack of its own: each entry is a node still to print, or the text
+// between two of them
+void Store_Expr::Print_To(std::string& out) {
+  struct Item {
+    uint32_t node;
+    const char* text; // printed instead of the node, if set
+  };
+  std::vector<Item> stack;
+  auto Operand = [&](uint32_t n) { // pushed last part first
+    const bool atom = s.op[n] <= Flat_Var_Ref;
+    if(!atom)
+      stack.push_back({0, ")"});
+    stack.push_back({n, nullptr});
+    if(!atom)
+      stack.push_back({0, "("});
+  };
+
+  stack.push_back({s.count - 1, nullptr});
+  while(!stack.empty()) {
+    const Item it = stack.back();
+    stack.pop_back();
+    if(it.text) {
+      out += it.text;
+      continue;
+    }
+    const uint32_t k = it.node, kind = s.op[k];
+    if(kind <= Flat_Var_Ref) {
+      const int value = kind == Flat_Var_Ref ? s.vars[s.value[k]].value : s.value[k];
+      if(!s.type[k])
+	out += value ? "true" : "false";
+      else {
+	char buf[Int_Chars];
+	out.append(buf, Format_Int(buf, value, cxt->outputFormat));
+      }
+    }
+    else if(kind <= Flat_Neg) {
+      out += Operator_Text[kind];
+      Operand(k - 1);
+    }
+    else {
+      Operand(k - 1);
+      if(kind == Flat_Cond) {
+	stack.push_back({0, " : "});
+	Operand(s.value[k]);
+      }
+      stack.push_back({0, Operator_Text[kind].data()});
+      Operand(s.a[k]);
+    }
+  }
+}
+
+int Store_Expr::Flatten(Flat_Tree& f) {
+  const int base = int(f.nodes.size());
+  for(uint32_t k = 0; k < s.count; ++k) {
+    const Flat_Kind kind = Flat_Kind(s.op[k]);
+    if(kind == Flat_Var_Ref) {
+      const Node_Store::Var& v = s.vars[s.value[k]];
+      f.Add(kind, f.Variable(v.var, v.var->id, v.value));
+    }
+    else if(kind <= Flat_Neg)
+      f.Add(kind, s.value[k]);
+    else
+      f.Add(kind, kind == Flat_Cond ? base + s.value[k] : 0, base + int(s.a[k]));
+  }
+  return base + int(s.count) - 1;
+}
+
+// Emits the subtree at root the way the Expr nodes of its kinds do, in the
+// same order, with a stack of its own rather than a call per node. Each
+// entry is a node partway through: stage counts the operands it has had
+// lowered, and saved holds a register or jump it still needs. The register
+// of the node finished last is in ret.
+int Store_Expr::Lower(Compiler& c, uint32_t root, int rootDst) {
+  struct Item {
+    uint32_t k;
+    int dst;
+    int stage;
+    int saved;
+  };
+  std::vector<Item> stack;
+  stack.push_back({root, rootDst, 0, 0});
+  int ret = 0;
+  bool call; // an operand of k is to be lowered before coming back to k
+  uint32_t next;
+  int nextDst;
+  auto Operand = [&](uint32_t n, int d) { call = true; next = n; nextDst = d; };
+
+  while(!stack.empty()) {
+    Item& it = stack.back();
+    const uint32_t k = it.k, kind = s.op[k];
+    const int dst = it.dst, stage = it.stage++;
+    call = false;
+    switch(kind) {
+    case Flat_Bool:
+    case Flat_Int:
+      ret = c.Constant(s.value[k]);
+      break;
+    case Flat_Var_Ref:
+      ret = c.Variable(s.vars[s.value[k]].var, s.vars[s.value[k]].value, dst);
+      break;
+    case Flat_Not:
+    case Flat_Bit_Comp:
+    case Flat_Neg:
+      if(stage == 0) {
+	Operand(k - 1, dst);
+	break;
+      }
+      c.Emit(kind == Flat_Neg ? Op_Neg : kind == Flat_Bit_Comp && s.type[k] ? Op_Comp : Op_Not, dst, ret);
+      ret = dst;
+      break;
+    case Flat_And:
+    case Flat_Or:
+      if(stage == 0)
+	Operand(s.a[k], dst);
+      else if(stage == 1) {
+	c.Move(dst, ret);
+	it.saved = c.Emit(kind == Flat_And ? Op_Jump_False : Op_Jump_True, dst, dst);
+	Operand(k - 1, dst);
+      }
+      else {
+	c.Move(dst, ret);
+	c.Patch(it.saved);
+	ret = dst;
+      }
+      break;
+    case Flat_Cond:
+      if(stage == 0)
+	Operand(s.a[k], dst);
+      else if(stage == 1) {
+	it.saved = c.Emit(Op_Jump_False, dst, ret); // to the false branch
+	Operand(s.value[k], dst);
+      }
+      else if(stage == 2) {
+	c.Move(dst, ret);
+	int done = c.Emit(Op_Jump, dst);
+	c.Patch(it.saved);
+	it.saved = done;
+	Operand(k - 1, dst);
+      }
+      else {
+	c.Move(dst, ret);
+	c.Patch(it.saved);
+	ret = dst;
+      }
+      break;
+    default:
+      if(stage == 0)
+	Operand(s.a[k], dst);
+      else if(stage == 1) {
+	it.saved = ret;
+	Operand(k - 1, dst + 1);
+      }
+      else {
+	c.Emit(Binary_Opcodes[kind], dst, it.saved, ret);
+	ret = dst;
+      }
+      break;
+    }
+    if(call)
+      stack.push_back({next, nextDst, 0, 0});
+    else
+      stack.pop_back();
+  }
+  return ret;
+}
+
+// Builds a tree into a Node_Store for the parser, checking types as the
+// Expr constructors do and in the same order, so the same error comes
+// first. Nodes are added to arrays kept by the thread from one statement
+// to the next, and the finished tree is copied into the statement's region
+// at its exact size.
+struct Store_Builder {
+  typedef uint32_t Node;
+
+private:
+  struct Arrays {
+    std::vector<uint8_t> op, type;
+    std::vector<uint32_t> a;
+    std::vector<int32_t> value;
+    std::vector<Node_Store::Var> vars;
+    std::vector<uint32_t> numbers; // 1 + each variable's number in vars, by its name number; 0 if unread
+  };
+  Arena& arena;
+  Context* cxt;
+  Arrays& n;
+
+  static Arrays& Buffers() { static thread_local Arrays a; return a; }
+  Node Add(Flat_Kind, uint8_t type, uint32_t a = 0, int32_t value = 0);
+  static void Type_Error() { throw std::runtime_error("Invalid expression type."); }
+
+public:
+  Store_Builder(Arena&, Context*);
+
+  Node Int(int value) { return Add(Flat_Int, 1, 0, value); }
+  Node Bool(bool value) { return Add(Flat_Bool, 0, 0, value); }
+  Node Var(Var_Decl*, int value);
+  Node Unary(int op, Node e);
+  Node Binary(int op, Node e1, Node e2); // e2 is always the node just built
+  Node Cond(Node e1, Node e2, Node e3);
+  Expr* Finish(); // the tree built, as one node in the region
+};
+
+Store_Builder::Store_Builder(Arena& _arena, Context* _cxt) : arena(_arena), cxt(_cxt), n(Buffers()) {
+  for(const Node_Store::Var& v : n.vars) // left by a statement that failed
+    n.numbers[v.var->id] = 0;
+  n.op.clear();
+  n.type.clear();
+  n.a.clear();
+  n.value.clear();
+  n.vars.clear();
+}
+
+Store_Builder::Node Store_Builder::Add(Flat_Kind kind, uint8_t type, uint32_t a, int32_t value) {
+  n.op.push_back(kind);
+  n.type.push_back(type);
+  n.a.push_back(a);
+  n.value.push_back(value);
+  return uint32_t(n.op.size()) - 1;
+}
+
+Store_Builder::Node Store_Builder::Var(Var_Decl* var, int value) {
+  if(size_t(var->id) >= n.numbers.size())
+    n.numbers.resize(var->id + 1);
+  uint32_t& number = n.numbers[var->id];
+  if(!number) {
+    n.vars.push_back({ var, value });
+    number = uint32_t(n.vars.size());
+  }
+  return Add(Flat_Var_Ref, var->type == &cxt->Int_, 0, number - 1);
+}
+
+Store_Builder::Node Store_Builder::Unary(int op, Node e) {
+  const uint8_t t = n.type[e];
+  switch(op) {
+  case Bang_Tok:
+    if(t)
+      Type_Error();
+    return Add(Flat_Not, 0);
+  case Minus_Tok:
+    if(!t)
+      Type_Error();
+    return Add(Flat_Neg, 1);
+  case Tilde_Tok:
+    return Add(Flat_Bit_Comp, t);
+  }
+  throw std::runtime_error("Invalid syntax.");
+}
+
+Store_Builder::Node Store_Builder::Binary(int op, Node e1, Node e2) {
+  const uint8_t t1 = n.type[e1], t2 = n.type[e2];
+  Flat_Kind kind;
+  switch(op) {
+  case PipePipe_Tok: kind = Flat_Or; break;
+  case AmpAmp_Tok: kind = Flat_And; break;
+  case Pipe_Tok: kind = Flat_Bit_Or; break;
+  case Caret_Tok: kind = Flat_Bit_Xor; break;
+  case Amp_Tok: kind = Flat_Bit_And; break;
+  case EqualEqual_Tok: kind = Flat_Equal_Equal; break;
+  case Not_Equal_Tok: kind = Flat_Not_Equal; break;
+  case LT_Tok: kind = Flat_Less_Than; break;
+  case GT_Tok: kind = Flat_Greater_Than; break;
+  case LTE_Tok: kind = Flat_Less_Than_Equal; break;
+  case GTE_Tok: kind = Flat_Greater_Than_Equal; break;
+  case Plus_Tok: kind = Flat_Add; break;
+  case Minus_Tok: kind = Flat_Sub; break;
+  case Star_Tok: kind = Flat_Mult; break;
+  case Slash_Tok: kind = Flat_Div; break;
+  case Percent_Tok: kind = Flat_Rem; break;
+  default: throw std::runtime_error("Invalid syntax.");
+  }
+
+  uint8_t t;
+  switch(kind) {
+  case Flat_And:
+  case Flat_Or: // bools
+    if(t1 || t2)
+      Type_Error();
+    t = 0;
+    break;
+  case Flat_Bit_And:
+  case Flat_Bit_Or:
+  case Flat_Bit_Xor: // either, alike
+    if(t1 != t2)
+      Type_Error();
+    t = t1;
+    break;
+  case Flat_Equal_Equal:
+  case Flat_Not_Equal:
+    if(t1 != t2)
+      Type_Error();
+    t = 0;
+    break;
+  case Flat_Less_Than:
+  case Flat_Greater_Than:
+  case Flat_Less_Than_Equal:
+  case Flat_Greater_Than_Equal: // ints, giving a bool
+    if(!t1 || !t2)
+      Type_Error();
+    t = 0;
+    break;
+  default: // arithmetic
+    if(!t1 || !t2)
+      Type_Error();
+    t = 1;
+    break;
+  }
+  return Add(kind, t, e1);
+}
+
+Store_Builder::Node Store_Builder::Cond(Node e1, Node e2, Node e3) {
+  if(n.type[e1] || n.type[e2] != n.type[e3])
+    Type_Error();
+  return Add(Flat_Cond, n.type[e2], e1, int32_t(e2));
+}
+
+Expr* Store_Builder::Finish() {
+  for(const Node_Store::Var& v : n.vars)
+    n.numbers[v.var->id] = 0;
+  Node_Store built, s;
+  built.op = n.op.data();
+  built.type = n.type.data();
+  built.a = n.a.data();
+  built.value = n.value.data();
+  built.vars = n.vars.data();
+  built.count = uint32_t(n.op.size());
+  built.varCount = uint32_t(n.vars.size());
+  s.Copy(built, arena);
+  n.vars.clear();
+  return arena.Make<Store_Expr>(s, cxt);
+}
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef SYMBOLS_HPP
+#define SYMBOLS_HPP
+
+#include "decl.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// Persistent map from name numbers (see Interner) to declarations: a hash
+// array mapped trie whose hash is the number itself, 5 bits per level from
+// the top. Each node keeps a bitmap of the children it has and only those.
+//
+// Copying a table shares its root, so it is O(1). A change copies the
+// nodes on its path that some other table also holds; nodes held by this
+// table alone are changed in place, so a table that is never copied
+// allocates only as it grows. Nodes and declarations count the tables and
+// nodes holding them, and go when the last one does.
+struct Symbol_Table {
+private:
+  struct Node {
+    std::atomic<int> refs;
+    uint32_t bitmap; // children present, by 5-bit digit
+    void** Slots() { return reinterpret_cast<void**>(this + 1); } // nodes, or declarations at the bottom level
+  };
+
+  Node* root = nullptr;
+  int shift = 0; // of the root's digit; the root covers numbers below 32 << shift
+  size_t count = 0; // declarations
+
+  static std::atomic<size_t>& TotalBytes() { static std::atomic<size_t> n(0); return n; }
+  static int Index(const Node* n, uint32_t bit) { return __builtin_popcount(n->bitmap & (bit - 1)); }
+  static Node* Allocate(uint32_t bitmap);
+  static Node* Copy(const Node*, uint32_t bit, int shift);
+  static Node* Widen(Node*, uint32_t bit);
+  static void Release(Node*, int shift);
+  static void Release(Decl*);
+  static Node* Set(Node*, int shift, uint32_t id, Decl*, bool& added);
+  template<typename F>
+  static void Each(Node*, int shift, F&);
+
+public:
+  Symbol_Table() = default;
+  Symbol_Table(const Symbol_Table& t) : root(t.root), shift(t.shift), count(t.count) { if(root) ++root->refs; }
+  Symbol_Table& operator=(const Symbol_Table& t) {
+    Symbol_Table copy(t);
+    std::swap(root, copy.root);
+    std::swap(shift, copy.shift);
+    std::swap(count, copy.count);
+    return *this;
+  }
+  ~Symbol_Table() { Release(root, shift); }
+
+  Decl* Find(int id) const;
+  bool Owns(int id) const; // the declaration is held by this table alone
+  void Set(int id, Decl*);
+  size_t Size() const { return count; }
+  template<typename F>
+  void Each(F f) const { Each(root, shift, f); } // calls f(Decl*) for every declaration, in number order
+  static size_t AllBytes() { return TotalBytes(); } // nodes of all tables
+};
+
+// A node holding nothing yet, with a slot for each bit of bitmap
+Symbol_Table::Node* Symbol_Table::Allocate(uint32_t bitmap) {
+  const int size = __builtin_popcount(bitmap);
+  const size_t bytes = sizeof(Node) + size * sizeof(void*);
+  Node* m = static_cast<Node*>(std::malloc(bytes));
+  if(!m)
+    throw std::bad_alloc();
+  TotalBytes() += bytes;
+  new (&m->refs) std::atomic<int>(1);
+  m->bitmap = bitmap;
+  void** to = m->Slots();
+  for(int k = 0; k < size; ++k)
+    to[k] = nullptr;
+  return m;
+}
+
+// A node like n (or an empty one) with room for the child at bit too;
+// the children it shares gain a holder
+Symbol_Table::Node* Symbol_Table::Copy(const Node* n, uint32_t bit, int shift) {
+  Node* m = Allocate((n ? n->bitmap : 0) | bit);
+  if(n) {
+    void** from = const_cast<Node*>(n)->Slots();
+    void** to = m->Slots();
+    for(uint32_t rest = n->bitmap; rest; rest &= rest - 1) {
+      const uint32_t b = rest & -rest;
+      void* child = from[Index(n, b)];
+      to[Index(m, b)] = child;
+      if(!child)
+	continue;
+      if(shift)
+	++static_cast<Node*>(child)->refs;
+      else
+	++static_cast<Decl*>(child)->refs;
+    }
+  }
+  return m;
+}
+
+// n, held by its caller alone, moved into a node with room for the child
+// at bit too; its children keep their holders, so none are counted
+Symbol_Table::Node* Symbol_Table::Widen(Node* n, uint32_t bit) {
+  Node* m = Allocate(n->bitmap | bit);
+  const int at = Index(m, bit);
+  const int size = __builtin_popcount(n->bitmap);
+  memcpy(m->Slots(), n->Slots(), at * sizeof(void*));
+  memcpy(m->Slots() + at + 1, n->Slots() + at, (size - at) * sizeof(void*));
+  TotalBytes() -= sizeof(Node) + size * sizeof(void*);
+  std::free(n);
+  return m;
+}
+
+void Symbol_Table::Release(Decl* d) {
+  if(d && --d->refs == 0)
+    delete d;
+}
+
+void Symbol_Table::Release(Node* n, int shift) {
+  if(!n || --n->refs > 0)
+    return;
+  void** slots = n->Slots();
+  const int size = __builtin_popcount(n->bitmap);
+  for(int k = 0; k < size; ++k) {
+    if(shift)
+      Release(static_cast<Node*>(slots[k]), shift - 5);
+    else
+      Release(static_cast<Decl*>(slots[k]));
+  }
+  TotalBytes() -= sizeof(Node) + size * sizeof(void*);
+  std::free(n);
+}
+
+// Sets id below n, taking over the caller's hold on n; returns the node
+// now in its place, which is n itself when nothing else held it
+Symbol_Table::Node* Symbol_Table::Set(Node* n, int shift, uint32_t id, Decl* d, bool& added) {
+  const uint32_t bit = 1u << ((id >> shift) & 31);
+  Node* m = n;
+  if(n && n->refs == 1) {
+    if(!(n->bitmap & bit))
+      m = Widen(n, bit);
+  }
+  else {
+    m = Copy(n, bit, shift);
+    Release(n, shift);
+  }
+  void*& slot = m->Slots()[Index(m, bit)];
+  if(shift) {
+    slot = Set(static_cast<Node*>(slot), shift - 5, id, d, added);
+    return m;
+  }
+  Decl* old = static_cast<Decl*>(slot);
+  if(old != d) {
+    added = !old;
+    ++d->refs;
+    slot = d;
+    Release(old);
+  }
+  return m;
+}
+
+Decl* Symbol_Table::Find(int id) const {
+  if(id < 0 || uint64_t(id) >= (uint64_t(32) << shift))
+    return nullptr;
+  Node* n = root;
+  for(int s = shift; n; s -= 5) {
+    const uint32_t bit = 1u << ((uint32_t(id) >> s) & 31);
+    if(!(n->bitmap & bit))
+      return nullptr;
+    void* child = n->Slots()[Index(n, bit)];
+    if(!s)
+      return static_cast<Decl*>(child);
+    n = static_cast<Node*>(child);
+  }
+  return nullptr;
+}
+
+bool Symbol_Table::Owns(int id) const {
+  if(id < 0 || uint64_t(id) >= (uint64_t(32) << shift))
+    return false;
+  Node* n = root;
+  for(int s = shift; n && n->refs == 1; s -= 5) {
+    const uint32_t bit = 1u << ((uint32_t(id) >> s) & 31);
+    if(!(n->bitmap & bit))
+      return false;
+    void* child = n->Slots()[Index(n, bit)];
+    if(!s)
+      return child && static_cast<Decl*>(child)->refs == 1;
+    n = static_cast<Node*>(child);
+  }
+  return false;
+}
+
+template<typename F>
+void Symbol_Table::Each(Node* n, int shift, F& f) {
+  if(!n)
+    return;
+  void** slots = n->Slots();
+  const int size = __builtin_popcount(n->bitmap);
+  for(int k = 0; k < size; ++k) {
+    if(shift)
+      Each(static_cast<Node*>(slots[k]), shift - 5, f);
+    else if(slots[k])
+      f(static_cast<Decl*>(slots[k]));
+  }
+}
+
+void Symbol_Table::Set(int id, Decl* d) {
+  while(uint64_t(id) >= (uint64_t(32) << shift)) { // add levels above the root
+    if(root) {
+      Node* top = Copy(nullptr, 1, shift + 5);
+      top->Slots()[0] = root;
+      root = top;
+    }
+    shift += 5;
+  }
+  bool added = false;
+  root = Set(root, shift, uint32_t(id), d, added);
+  count += added;
+}
+
+#endif
@@ -0,0 +1,105 @@
+#!/bin/sh
+# Regression inputs: runs each one through the compiler with its options
+# and compares the output with the expected one. From this directory:
+#   ./run.sh [path to build]
+cd "$(dirname "$0")" || exit 1
+build=${1:-../build}
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+failed=0
+
+# check input expected-output options...
+check() {
+  input=$1 expected=$2
+  shift 2
+  "$build" "$@" < "$input" > "$tmp/got" 2>&1
+  status=$?
+  if [ $status -gt 1 ] || ! cmp -s "$expected" "$tmp/got"; then
+    echo "FAIL: $input $* (exit $status)"
+    failed=1
+  fi
+}
+
+# Expressions nested far deeper than the call stack could follow.
+awk 'function repeat(s, n) { for(; n > 0; n--) printf "%s", s }
+BEGIN {
+  n = 200000
+  printf "1"; repeat("+1", n - 1); print ""
+  repeat("-", n); print "7"
+  repeat("(", n / 2); printf "5"; repeat(")", n / 2); print ""
+  printf "true"; repeat(" && true", n - 1); print ""
+  printf "false"; repeat(" || false", n - 1); print ""
+  repeat("~", n); print "3"
+  repeat("true ? ", n / 4); printf "0"; repeat(" : 1", n / 4); print ""
+  printf "var int d = 1"; repeat("*1", n - 1); print ""
+  printf "d = 2147483647"; repeat("+0", n - 1); print "+1"
+}' > "$tmp/deep"
+printf '%s\n' 200000 7 5 true false 3 0 "d = 1" "Error: Integer overflow." > "$tmp/deep.out"
+for engine in tree vm; do
+  for ast in tree soa; do
+    check "$tmp/deep" "$tmp/deep.out" --results-only --engine=$engine --ast=$ast
+  done
+done
+# The echoed input and the assembly are too long to keep, but the flat
+# arrays print them without recursing at all
+for options in "" -S; do
+  "$build" $options --ast=soa < "$tmp/deep" > "$tmp/deep.soa" 2>&1
+  check "$tmp/deep" "$tmp/deep.soa" $options
+done
+
+# Branches run on forks of the variables the input left, and of nothing else
+check branch.in branch.out --branch branch-1.txt --branch branch-2.txt
+
+# One input per mode: each NAME.in is run with its options and compared
+# with NAME.out
+check ../testinput.txt ../output.txt
+check /dev/null ../output.txt -f ../testinput.txt
+check literals.in literals.out
+for engine in tree vm; do
+  check engine.in engine.out --results-only --engine=$engine
+done
+check assembly.in assembly.out -S
+for engine in tree jit; do
+  check rows.in rows.out --rows rows.csv --expr 'a * b + c' --engine=$engine
+  check rows.in rows-bin.out --rows rows.bin --fields a,b,c --expr 'a * b + c' --engine=$engine
+  check rows.in rows-empty.out --rows rows-empty.csv --expr 'a * b + c' --engine=$engine
+  check rows.in filter.out --rows rows.csv --expr 'keep && a > b' --filter --engine=$engine
+done
+for options in "" --parallel; do
+  check parallel.in parallel.out $options
+done
+for threads in 1 3; do
+  check lex.in lex.out --lex-threads $threads
+done
+check pipeline.in pipeline.out --pipeline
+for format in d h b; do
+  check format.in format-$format.out -$format
+done
+check output.in results.out --results-only
+check output.in jsonl.out --jsonl
+check output.in jsonl-h.out --jsonl -h
+# variables saved by one run are restored by the next, from a snapshot, a
+# journal or both; a snapshot that cannot be written fails before any input
+for files in "--snapshot $tmp/s --journal $tmp/j" "--journal $tmp/j2" "--snapshot $tmp/s3"; do
+  check snapshot-1.in snapshot-1.out $files
+  check snapshot-2.in snapshot-2.out $files
+done
+echo "Error: Could not write snapshot." > "$tmp/unwritable.out"
+check snapshot-1.in "$tmp/unwritable.out" --snapshot "$tmp/missing/s"
+# statements are taken from the cache only while their variables are as
+# they were when cached
+for run in 1 2; do
+  check cache.in cache.out --results-only --ast-cache "$tmp/ast"
+done
+check cache-2.in cache-2.out --results-only --ast-cache "$tmp/ast"
+for ast in tree soa; do
+  check soa.in soa.out --ast=$ast
+done
+# a write that fails is an error
+if [ -w /dev/full ]; then
+  "$build" < format.in > /dev/full 2> /dev/null
+  [ $? = 1 ] || { echo "FAIL: format.in > /dev/full"; failed=1; }
+fi
+
+[ $failed = 0 ] && echo "All tests passed."
+exit $failed
@@ -4,7 +4,23 @@
 #include <iostream>
 #include <string>
 #include <sstream>
-#include <unordered_map>
+#include <string_view>
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+
+// Keywords as (token kind, spelling). The enum, Token_Names and the
+// lexer's keyword lookup below are all generated from this one list.
+#define KEYWORDS(X)					\
+  X(True_KW, "true")    /*  true value */		\
+  X(False_KW, "false")  /*  false value */		\
+  X(Var_KW, "var")      /*  var declaration */	\
+  X(Int_KW, "int")      /*  int var type */		\
+  X(Bool_KW, "bool")    /*  bool var type */
+
+#define KEYWORD_KIND(kind, spelling) kind,
+#define KEYWORD_NAME(kind, spelling) #kind,
+#define KEYWORD_ENTRY(kind, spelling) {spelling, kind},
 
 enum Token_Kind {
   Eof_Tok,         //  End of file, 0, null
@@ -35,15 +51,12 @@ enum Token_Kind {
   Bool_Tok,        //  boolean
   Int_Tok,         //  integers
   Id_Tok,          //  identifier
-  True_KW,         //  true value
-  False_KW,        //  false value
-  Var_KW,          //  var declaration
-  Int_KW,          //  int var type
-  Bool_KW          //  bool var type
+  KEYWORDS(KEYWORD_KIND)
+  Token_Kind_Count // number of token kinds
 };
 
 // Used for printing -- this array needs to match the enum above
-std::string Token_Names[33] = {
+std::string Token_Names[Token_Kind_Count] = {
   "Eof_Tok",
   "Plus_Tok",
   "Minus_Tok",
@@ -72,95 +85,94 @@ std::string Token_Names[33] = {
   "Bool_Tok",
   "Int_Tok",
   "Id_Tok",
-  "True_KW",
-  "False_KW",
-  "Var_KW",
-  "Int_KW",
-  "Bool_KW"
+  KEYWORDS(KEYWORD_NAME)
 };
 
+// A token is a small value: its kind, where it sits in the statement text,
+// and the value of integer/boolean literals. The text itself is not copied;
+// identifiers carry the number the context's Interner gave their name.
 struct Token {
   int kind; // this value defines the kind of Token in the enum
-  std::string symbol;
-  virtual ~Token() = default;
-  std::string EnumName() { return Token_Names[kind]; }
-  std::string Print() { return symbol; }
+  uint32_t offset; // start of the token in the statement text
+  uint32_t length; // number of characters in the token
+  int value; // value of literals: integers, and 1/0 for true/false; the number of an identifier, -1 if unknown
+  std::string EnumName() const { return Token_Names[kind]; }
+  std::string_view Print(std::string_view src) const { return src.substr(offset, length); }
 };
 
-struct Punc_Op_Token : Token {
-  // creates a non-literal token of the passed kind
-  Punc_Op_Token(int tok) {
-    kind = tok;
-
-    switch(kind) {
-    case Eof_Tok: symbol = ""; break;
-    case Plus_Tok: symbol = "+"; break;
-    case Minus_Tok: symbol = "-"; break;
-    case Star_Tok: symbol = "*"; break;
-    case Slash_Tok: symbol = "/"; break;
-    case Percent_Tok: symbol = "%"; break;
-    case Amp_Tok: symbol = "&"; break;
-    case Pipe_Tok: symbol = "|"; break;
-    case AmpAmp_Tok: symbol = "&&"; break;
-    case PipePipe_Tok: symbol = "||"; break;
-    case Caret_Tok: symbol = "^"; break;
-    case Tilde_Tok: symbol = "~"; break;
-    case Bang_Tok: symbol = "!"; break;
-    case Equal_Tok: symbol = "="; break;
-    case EqualEqual_Tok: symbol = "=="; break;
-    case LT_Tok: symbol = "<"; break;
-    case GT_Tok: symbol = ">"; break;
-    case LTE_Tok: symbol = "<="; break;
-    case GTE_Tok: symbol = ">="; break;
-    case Query_Tok: symbol = "?"; break;
-    case Colon_Tok: symbol = ":"; break;
-    case Semicolon_Tok: symbol = ";"; break;
-    case LParen_Tok: symbol = "("; break;
-    case RParen_Tok: symbol = ")"; break;
-    }
-  }
-};
+static_assert(sizeof(Token) == 16, "Token should stay 16 bytes");
+static_assert(std::is_trivially_copyable<Token>::value, "Token is copied by value");
 
-struct Bool_Token : Token {
-  // creates a boolean token with passed value
-  bool value;
-  Bool_Token(bool b) : value(b) {
-    kind = Bool_Tok;
-    symbol = value ? "true" : "false";
-  }
+// Keyword recognition. A perfect hash over (length, first char, last char)
+// is found at compile time for the keyword list, so recognizing a keyword
+// is one multiply, one table load and one short compare however many
+// keywords there are, and nothing is allocated.
+struct Keyword {
+  std::string_view spelling;
+  Token_Kind kind;
 };
 
-struct Int_Token : Token {
-  // creates an integer token with passed value
-  int value;
-  Int_Token(int i) : value(i) {
-    kind = Int_Tok;
-    symbol = std::to_string(value);
-  }
-};
+constexpr Keyword Keywords[] = { KEYWORDS(KEYWORD_ENTRY) };
+constexpr size_t Keyword_Count = sizeof(Keywords) / sizeof(Keywords[0]);
+constexpr unsigned Keyword_Bits = 4; // table of 16 slots
+static_assert(Keyword_Count * 2 <= (1u << Keyword_Bits), "Grow Keyword_Bits for more keywords");
 
-struct Id_Token : Token {
-  // creates an identifier token
-  const std::string name;
-  Id_Token(const std::string n) : name(n) { // constructor for generic identifier
-    kind = Id_Tok;
-    symbol = name;
-  }
-  Id_Token(const std::string n, Token_Kind k) : name(n) { // constructor for keyword identifier
-    kind = k;
-    symbol = name;
+constexpr uint32_t Keyword_Key(std::string_view s) {
+  return uint32_t(s.size()) | uint32_t((unsigned char)s.front()) << 8 | uint32_t((unsigned char)s.back()) << 16;
+}
+
+constexpr unsigned Keyword_Slot(uint32_t key, uint32_t seed) {
+  return (key * seed) >> (32 - Keyword_Bits);
+}
+
+// Smallest multiplier that sends every keyword to its own slot, or 0
+constexpr uint32_t Find_Keyword_Seed() {
+  for(uint32_t seed = 1; seed < (1u << 20); seed += 2) {
+    bool used[1u << Keyword_Bits] = {};
+    bool ok = true;
+    for(size_t i = 0; i < Keyword_Count && ok; ++i) {
+      unsigned slot = Keyword_Slot(Keyword_Key(Keywords[i].spelling), seed);
+      ok = !used[slot];
+      used[slot] = true;
+    }
+    if(ok)
+      return seed;
   }
+  return 0;
+}
+
+constexpr uint32_t Keyword_Seed = Find_Keyword_Seed();
+static_assert(Keyword_Seed != 0, "Keywords need a longer hash key");
+
+struct Keyword_Slots {
+  int index[1u << Keyword_Bits]; // position in Keywords, -1 when empty
+  size_t minLength, maxLength;
 };
 
-// List of keywords in the system
-struct Keyword_Table : std::unordered_map<std::string, Token_Kind> {
-  Keyword_Table() {
-    insert({{"true", True_KW},
-	    {"false", False_KW},
-	    {"var", Var_KW},
-	    {"int", Int_KW},
-	    {"bool", Bool_KW}});
+constexpr Keyword_Slots Make_Keyword_Slots() {
+  Keyword_Slots t = {};
+  for(int& i : t.index)
+    i = -1;
+  t.minLength = Keywords[0].spelling.size();
+  t.maxLength = Keywords[0].spelling.size();
+  for(size_t i = 0; i < Keyword_Count; ++i) {
+    t.index[Keyword_Slot(Keyword_Key(Keywords[i].spelling), Keyword_Seed)] = i;
+    t.minLength = std::min(t.minLength, Keywords[i].spelling.size());
+    t.maxLength = std::max(t.maxLength, Keywords[i].spelling.size());
   }
-};
+  return t;
+}
+
+constexpr Keyword_Slots Keyword_Table = Make_Keyword_Slots();
+
+// Kind of the given identifier: its keyword kind, or Id_Tok
+constexpr Token_Kind Keyword_Kind(std::string_view s) {
+  if(s.size() < Keyword_Table.minLength || s.size() > Keyword_Table.maxLength)
+    return Id_Tok;
+  int i = Keyword_Table.index[Keyword_Slot(Keyword_Key(s), Keyword_Seed)];
+  return (i >= 0 && Keywords[i].spelling == s) ? Keywords[i].kind : Id_Tok;
+}
+
+static_assert(Keyword_Kind("bool") == Bool_KW && Keyword_Kind("boo") == Id_Tok, "Keyword table is broken");
 
 #endif
@@ -0,0 +1,75 @@
+#ifndef WRITER_HPP
+#define WRITER_HPP
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <streambuf>
+
+#include <unistd.h>
+
+// The output writer: a stream buffer that collects output in one large
+// reusable buffer and hands it to write(2) in big blocks. main points
+// std::cout at one for standard output, so every mode writes through it.
+// Once a write fails the rest of the output is dropped, and Failed() says
+// so; the stream sees the failure at its next flush.
+struct Fd_Buf : std::streambuf {
+  static const size_t Default_Size = 1 << 20;
+
+private:
+  int fd;
+  std::unique_ptr<char[]> buf;
+  size_t size;
+  bool failed = false;
+
+  void Write(const char* p, size_t n) {
+    while(n && !failed) {
+      ssize_t w = write(fd, p, n);
+      if(w < 0 && errno == EINTR)
+	continue;
+      if(w <= 0)
+	failed = true; // output closed or full; the rest is dropped
+      else {
+	p += w;
+	n -= w;
+      }
+    }
+  }
+  void Flush() {
+    Write(pbase(), pptr() - pbase());
+    setp(buf.get(), buf.get() + size);
+  }
+
+protected:
+  int overflow(int c) override {
+    Flush();
+    if(failed)
+      return traits_type::eof();
+    if(c != traits_type::eof())
+      sputc(char(c));
+    return traits_type::not_eof(c);
+  }
+  std::streamsize xsputn(const char* s, std::streamsize n) override {
+    if(n > epptr() - pptr()) {
+      Flush();
+      if(size_t(n) >= size) { // too big to buffer
+	Write(s, n);
+	return n;
+      }
+    }
+    memcpy(pptr(), s, n);
+    pbump(int(n));
+    return n;
+  }
+  int sync() override { Flush(); return failed ? -1 : 0; }
+
+public:
+  Fd_Buf(int _fd, size_t _size = Default_Size) : fd(_fd), buf(new char[_size]), size(_size) { setp(buf.get(), buf.get() + size); }
+  ~Fd_Buf() { Flush(); }
+  Fd_Buf(const Fd_Buf&) = delete;
+  Fd_Buf& operator=(const Fd_Buf&) = delete;
+
+  bool Failed() const { return failed; }
+};
+
+#endif